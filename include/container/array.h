@@ -2,6 +2,7 @@
 #define INSOMNIA_ARRAY_H
 
 #include <cstring>
+#include <type_traits>
 
 #include "exception.h"
 
@@ -197,6 +198,21 @@ public:
     return strcmp(_data, other._data) >= 0;
   }
 
+  /**
+   * @brief the smallest string greater than every string prefixed by this one.
+   * @return false if there's no such string (empty, or every char is 0xff).
+   */
+  bool prefix_successor(array &succ) const {
+    size_t len = std::strlen(_data);
+    while(len > 0 && static_cast<unsigned char>(_data[len - 1]) == 0xff)
+      --len;
+    if(len == 0) return false;
+    memcpy(succ._data, _data, len);
+    succ._data[len - 1] = static_cast<char>(static_cast<unsigned char>(_data[len - 1]) + 1);
+    succ._data[len] = '\0';
+    return true;
+  }
+
   char* data() { return _data; }
   const char* c_str() const { return _data; }
   std::string str() { return std::string(_data); }
@@ -215,6 +231,17 @@ private:
   char _data[size + 1];
 };
 
+template <class T>
+struct is_char_array : std::false_type {};
+
+template <size_t size>
+struct is_char_array<array<char, size>> : std::true_type {
+  static constexpr size_t length = size; // longest string it holds
+};
+
+template <class T>
+constexpr bool is_char_array_v = is_char_array<T>::value;
+
 }
 
 #endif
\ No newline at end of file
@@ -202,6 +202,8 @@ public:
     return insert(iter._ptr - _beg, std::forward<Args>(args)...);
   }
   iterator erase(size_t pos);
+  // erases [first, last) in one shift.
+  iterator erase(size_t first, size_t last);
   iterator erase(iterator iter) {
     if(this != iter._container) throw invalid_iterator();
     return erase(iter._ptr - _beg);
@@ -1,21 +1,25 @@
 #ifndef INSOMNIA_BPLUSTREE_H
 #define INSOMNIA_BPLUSTREE_H
 
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "algorithm.h"
 #include "bpt_nodes.h"
+#include "bpt_tree_base.h"
 #include "buffer_pool.h"
 #include "exception.h"
+#include "hash.h"
+#include "search_cache.h"
 
 namespace insomnia {
 
 
-template <
-  Trivial KeyT, Trivial ValueT,
-  class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>
->
-class MultiBPlusTree {
-  using index_t = BptNodeBase::index_t;
-  static constexpr index_t nullpos = IndexPool::nullpos;
-
+// the entries of MultiBPlusTree: (key, value) pairs, ordered by key and then value in leaves and internal nodes alike.
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+struct MultiBptEntry {
   struct KVType {
     KeyT key;
     ValueT value;
@@ -30,6 +34,27 @@ class MultiBPlusTree {
       return value_compare(lhs.value, rhs.value);
     }
   };
+
+  // string keys get truncated separators, prefix compressed internal nodes and slotted leaves.
+  static constexpr bool is_prefixed =
+    is_char_array_v<KeyT> && std::is_same_v<KeyCompare, std::less<KeyT>>;
+
+  using Leaf = typename BptLeafNodeOf<KVType, ValueT, is_prefixed>::type;
+  using TreeBase = BptTreeBase<KVType, KVCompare, Leaf, is_prefixed>;
+};
+
+template <
+  Trivial KeyT, Trivial ValueT,
+  class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>
+>
+class MultiBPlusTree : private MultiBptEntry<KeyT, ValueT, KeyCompare, ValueCompare>::TreeBase {
+  using EntryTraits = MultiBptEntry<KeyT, ValueT, KeyCompare, ValueCompare>;
+  using TreeBase = typename EntryTraits::TreeBase;
+  using typename TreeBase::index_t;
+  using TreeBase::nullpos;
+
+  using KVType = typename EntryTraits::KVType;
+  using KVCompare = typename EntryTraits::KVCompare;
   struct KeyEqual {
     KeyCompare key_compare;
     bool operator()(const KeyT &lhs, const KeyT &rhs) const {
@@ -43,57 +68,348 @@ class MultiBPlusTree {
     }
   };
 
-  using Base = BptNodeBase;
-  using Internal = BptInternalNode<KVType, index_t>;
-  using Leaf = BptLeafNode<KVType, ValueT>;
+  static constexpr bool is_prefixed = EntryTraits::is_prefixed;
+  using typename TreeBase::Base;
+  using typename TreeBase::Internal;
+  using typename TreeBase::Leaf;
+  using typename TreeBase::RootHolder;
 
-  struct alignas(4096) RootHolder {
-    int root;
+  // search results can be cached for keys whose hash agrees with KeyEqual.
+  static constexpr bool is_cacheable = std::is_same_v<KeyCompare, std::less<KeyT>> &&
+    (is_char_array_v<KeyT> || std::is_integral_v<KeyT> || std::is_enum_v<KeyT>);
+  struct KeyHash {
+    size_t operator()(const KeyT &key) const {
+      if constexpr(is_char_array_v<KeyT>)
+        return hash1(key.c_str());
+      else if constexpr(std::is_integral_v<KeyT> || std::is_enum_v<KeyT>)
+        return std::hash<KeyT>()(key);
+      else
+        return 0; // never cached.
+    }
   };
+  using Cache = SearchCache<KeyT, ValueT, KeyHash, KeyEqual>;
 
-  using BufferPoolType = BufferPool<
-    Base, RootHolder, std::max(sizeof(Internal), sizeof(Leaf))
-  >;
-  using Reader = typename BufferPoolType::Reader;
-  using Writer = typename BufferPoolType::Writer;
+  using typename TreeBase::BufferPoolType;
+  using typename TreeBase::Reader;
+  using typename TreeBase::Writer;
 
 public:
 
+  /**
+   * @brief forward cursor over the leaf chain, starting from a lower bound.
+   * Keeps at most one leaf Reader pinned (two while hopping to the right sibling).
+   * @warning Writers touching the current leaf wait until the cursor moves on.
+   *   Don't modify the tree in the thread that holds a live cursor.
+   */
+  class Cursor {
+    friend MultiBPlusTree;
+  public:
+    Cursor() = default;
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+    // the moved-from cursor becomes invalid.
+    Cursor(Cursor &&other) noexcept;
+    Cursor& operator=(Cursor &&other) noexcept;
+    ~Cursor() = default;
+
+    bool valid() const { return leaf_ != nullptr; }
+    // decoded from the leaf, so returned by value.
+    KeyT key() const { return leaf_->key(pos_).key; }
+    const ValueT& value() const { return leaf_->value(pos_); }
+    void next();
+    // releases the leaf. The cursor becomes invalid.
+    void reset();
+
+  private:
+    // skips exhausted leaves and checks the upper bound.
+    void settle();
+    // starts reading the right sibling of the leaf, unless the scan ends in the leaf.
+    void read_ahead();
+
+    Reader reader_;
+    MultiBPlusTree *tree_{nullptr};
+    const Leaf *leaf_{nullptr};
+    int pos_{0};
+    bool bounded_{false};
+    KeyT upper_{};
+  };
+
+  /**
+   * @brief the values of one key, read in place from the pinned leaves, one leaf at a time.
+   * Entries keep key and value together, so the values of a leaf are indexed rather than handed out as a span.
+   * @warning same latching caveats as Cursor.
+   */
+  class ValueView {
+    friend MultiBPlusTree;
+  public:
+    ValueView() = default;
+    ValueView(const ValueView&) = delete;
+    ValueView& operator=(const ValueView&) = delete;
+    // the moved-from view becomes invalid.
+    ValueView(ValueView &&other) noexcept;
+    ValueView& operator=(ValueView &&other) noexcept;
+    ~ValueView() = default;
+
+    bool valid() const { return leaf_ != nullptr; }
+    // number of values of the key in the current leaf.
+    int size() const { return end_ - begin_; }
+    const ValueT& operator[](int i) const { return leaf_->value(begin_ + i); }
+    // moves on to the values in the next leaf. The view becomes invalid after the last leaf.
+    void next();
+    // releases the leaf. The view becomes invalid.
+    void reset();
+
+  private:
+    // skips to the leaf holding the next value and finds where its run ends.
+    void settle();
+
+    Reader reader_;
+    MultiBPlusTree *tree_{nullptr};
+    const Leaf *leaf_{nullptr};
+    int begin_{0}, end_{0};
+    KeyT key_{};
+  };
+
+  /**
+   * @brief the tree as it was when the snapshot was taken.
+   * Searches copy pages out of the buffer pool and never wait for writers;
+   * writers pay a page copy the first time they write a page the snapshot still sees.
+   * @warning release it before the tree deconstructs.
+   */
+  class Snapshot {
+    friend MultiBPlusTree;
+  public:
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    Snapshot(Snapshot&&) noexcept = default;
+    Snapshot& operator=(Snapshot&&) noexcept = default;
+    ~Snapshot() = default;
+
+    bool valid() const { return snapshot_.is_valid(); }
+    vector<ValueT> search(const KeyT &key) const;
+    // see MultiBPlusTree::search.
+    template <class Visitor>
+    requires std::invocable<Visitor&, const ValueT&>
+    size_t search(const KeyT &key, Visitor &&visitor,
+      size_t limit = std::numeric_limits<size_t>::max()) const;
+    size_t count(const KeyT &key) const;
+    void release() { snapshot_.release(); }
+
+  private:
+    struct PageCopy {
+      alignas(64) char data[std::max(sizeof(Internal), sizeof(Leaf))];
+    };
+    // copies the leftmost leaf that may contain key into page. false if the tree was empty.
+    bool FindLeaf(const KeyT &key, PageCopy &page) const;
+
+    typename BufferPoolType::Snapshot snapshot_;
+    const MultiBPlusTree *tree_{nullptr};
+    index_t root_{nullpos};
+  };
+
+  /**
+   * @brief shape and health of the tree, for deciding when to rebuild it and for tuning the buffer pool.
+   * Counts may be off by the writes that land in leaves while they are walked.
+   */
+  struct Stats {
+    int height{0};
+    vector<size_t> level_pages;   // pages on each level, root level first.
+    size_t entries{0};
+    size_t fill_histogram[10]{};  // leaves by fill, in tenths of their capacity. Full leaves count in the last.
+    size_t underfull_nodes{0};    // non-root nodes below their minimum fill, e.g. left by deferred removes.
+    size_t contiguous_links{0};   // leaf chain links pointing to the physically next page.
+    size_t page_capacity{0};      // pages ever allocated in the file.
+    size_t free_pages{0};         // pages deallocated and waiting in IndexPool for reuse.
+    size_t cache_bytes{0};        // held by the search cache, if enabled.
+    size_t cache_hits{0};
+    size_t cache_misses{0};
+    std::string error;            // the first structural problem found. Empty if the tree is sound.
+  };
+
+  /**
+   * @brief opens the tree stored in name.dat. With a log_mode other than off, every write is logged to name.wal
+   * and the tree comes back after a crash as of its last committed write; see LogMode.
+   * A log left by a crash is replayed here whatever log_mode is.
+   */
   MultiBPlusTree(const std::filesystem::path &name,
-    size_t k_param, size_t buffer_capacity, size_t thread_num);
+    size_t k_param, size_t buffer_capacity, size_t thread_num, LogMode log_mode = LogMode::off);
+  // disk I/O goes to scheduler, shared with other trees. It should outlive the tree.
+  MultiBPlusTree(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, TaskScheduler &scheduler, LogMode log_mode = LogMode::off);
   ~MultiBPlusTree();
 
   vector<ValueT> search(const KeyT &key);
 
+  /**
+   * @brief passes the values of key to visitor in ValueCompare order, stopping after limit values.
+   * A visitor returning bool stops the search early by returning false.
+   * @return the number of values visited.
+   */
+  template <class Visitor>
+  requires std::invocable<Visitor&, const ValueT&>
+  size_t search(const KeyT &key, Visitor &&visitor,
+    size_t limit = std::numeric_limits<size_t>::max());
+
+  // writes at most limit values of key to out. Returns the iterator past the last value written.
+  template <class OutputIt>
+  requires std::output_iterator<OutputIt, const ValueT&> && (!std::invocable<OutputIt&, const ValueT&>)
+  OutputIt search(const KeyT &key, OutputIt out,
+    size_t limit = std::numeric_limits<size_t>::max());
+
+  // view over the values of key, without copying them out.
+  ValueView search_view(const KeyT &key);
+
+  size_t count(const KeyT &key);
+
+  // a snapshot of the tree as of the writes started before it. Waits for those to finish; later ones go on.
+  Snapshot snapshot();
+
+  // cursor over all entries with key not less than lower.
+  Cursor lower_bound(const KeyT &lower);
+
+  // cursor over all entries with key in [lower, upper).
+  Cursor range(const KeyT &lower, const KeyT &upper);
+
+  // cursor over all entries whose key starts with prefix.
+  // Only meaningful for string-like keys ordered lexicographically.
+  Cursor prefix_range(const KeyT &prefix)
+  requires requires(const KeyT &key, KeyT &bound) {
+    { key.prefix_successor(bound) } -> std::convertible_to<bool>;
+  };
+
   bool insert(const KeyT &key, const ValueT &value);
 
   bool remove(const KeyT &key, const ValueT &value);
 
+  /**
+   * @brief inserts a batch of (key, value) pairs.
+   * The batch is sorted first. Pairs landing in the same leaf share one descent and one leaf latch;
+   * a full leaf is split once and the rest of its run continues in the halves.
+   * @return the number of pairs actually inserted.
+   */
+  template <class InputIt>
+  size_t insert_batch(InputIt first, InputIt last);
+
+  /**
+   * @brief removes a batch of (key, value) pairs, sharing descents the way insert_batch does.
+   * @return the number of pairs actually removed.
+   */
+  template <class InputIt>
+  size_t remove_batch(InputIt first, InputIt last);
+
+  /**
+   * @brief builds the tree bottom-up from (key, value) pairs sorted by key, then value.
+   * Nodes are filled to fill_factor of their capacity and written out in allocation order.
+   * Repeated pairs are skipped.
+   * @throw database_exception if the tree is not empty or the input is not sorted.
+   *   The tree stays empty in that case.
+   * @return the number of pairs loaded.
+   */
+  template <class InputIt>
+  size_t bulk_load(InputIt first, InputIt last, double fill_factor = 1.0);
+
+  /**
+   * @brief lets remove leave underfull leaves behind instead of merging them with a sibling on the spot.
+   * Once compact_after leaves have been left underfull, compact() is scheduled in the background.
+   * compact_after = 0 turns eager rebalancing back on (the default).
+   * @warning not to be called while other threads use the tree.
+   */
+  void defer_rebalance(size_t compact_after);
+
+  /**
+   * @brief merges or redistributes every underfull node, bottom-up, and shrinks the root.
+   * Holds root_latch_ and write latches down the path it works on, so writers wait for the whole pass:
+   * run it when the tree is idle.
+   * @return the number of nodes merged away.
+   */
+  size_t compact();
+
+  // compact() on the background compactor thread.
+  std::future<size_t> compact_async();
+
+  /**
+   * @brief caches the values of searched keys in front of the tree, within byte_budget bytes.
+   * A cached search visits the values without descending the tree or pinning a page.
+   * Every write invalidates the keys it changes, so searches never see a stale result.
+   * byte_budget = 0 drops the cache (the default). Searches with a limit are cached only if they reach the last value.
+   * @warning not to be called while other threads use the tree.
+   */
+  void enable_cache(size_t byte_budget) requires is_cacheable;
+
+  /**
+   * @brief walks the whole tree and checks its structure on the way:
+   * well-formed nodes, key order within nodes and against the separators above them,
+   * every leaf at the same depth, no page reached twice and a leaf chain in key order.
+   * Walks with read latches, holding each node over its subtree: searches and writes that fit in a leaf go on,
+   * while a split or merge waits until the walk leaves the node it would change.
+   */
+  Stats stats();
+
 private:
 
-  /*
+  using typename TreeBase::RootLock;
+  using typename TreeBase::LeafBound;
 
-  // search for the leaf.
-  Reader FindLeaf(Reader root_reader, const KeyT &key);
+  using TreeBase::SaveRoot;
+  using TreeBase::FindLeafOptim;
+  using TreeBase::FindLeafPessi;
+  using TreeBase::InsertPessi;
+  using TreeBase::RemovePessi;
+  using TreeBase::Separator;
 
-  // Optimistically find the leaf.
-  Writer FindLeafOptim(Reader root_reader, const KVType &kv);
+  using TreeBase::buffer_pool_;
+  using TreeBase::root_;
+  using TreeBase::height_;
+  using TreeBase::root_latch_;
 
-  // Pessimistically find the leaf.
-  vector<Writer> FindLeafPessi(
-    Writer root_writer, const KVType &kv, bool is_insert);
+  // search for the leftmost leaf that may contain key.
+  // Returns an empty Reader if the tree is empty.
+  Reader FindLeaf(const KeyT &key);
 
-  void InsertMaxKey(Writer root_writer, const KVType &kv);
+  // the insert and remove behind the public ones, which keep the search cache in step.
+  bool InsertEntry(const KeyT &key, const ValueT &value);
+  bool RemoveEntry(const KeyT &key, const ValueT &value);
+
+  // invalidates the keys of a batch sorted by kv_compare_, each once.
+  void InvalidateBatch(const vector<KVType> &batch);
+
+  // builds a cursor at the first entry not less than lower. bounded by upper if bounded.
+  Cursor MakeCursor(const KeyT &lower, const KeyT *upper);
+
+  // copies [first, last) into a vector sorted by kv_compare_.
+  template <class InputIt>
+  vector<KVType> SortedBatch(InputIt first, InputIt last);
+
+  // rebalances the underfull children of parent pairwise. level is the height of the children, 1 for leaves.
+  // Children are compacted before their parent. Returns the number of nodes merged away.
+  size_t CompactChildren(Internal *parent, int level);
+
+  // counts a leaf left underfull by a deferred remove and starts a compaction once there are enough.
+  void NoteUnderfull();
+
+  // what stats() carries along the walk besides the Stats themselves.
+  struct InspectState {
+    vector<uint8_t> is_seen;      // by page id
+    index_t last_leaf{nullpos};
+    index_t next_leaf{nullpos};   // rht_index of last_leaf
+  };
 
-  */
+  // inspects the subtree at index, level levels above the leaves (1 for a leaf),
+  // whose pairs should lie in [lower, upper). A null bound is open. reader latches the page at index.
+  void Inspect(Reader reader, index_t index, int level,
+    const KVType *lower, const KVType *upper, Stats &stats, InspectState &state);
 
-  BufferPoolType buffer_pool_;
-  index_t root_;
   KeyCompare key_compare_;
   KeyEqual key_equal_;
   KVCompare kv_compare_;
   KVEqual kv_equal_;
-  std::shared_mutex root_latch_;
+  // deferred rebalancing. compact_after_ = 0 means removes rebalance eagerly.
+  size_t compact_after_{0};
+  std::atomic<size_t> underfull_{0};
+  std::atomic<bool> is_compacting_{false};
+  std::unique_ptr<TaskScheduler> compactor_; // created by defer_rebalance.
+  std::unique_ptr<Cache> cache_;             // created by enable_cache.
 };
 
 }
@@ -2,8 +2,10 @@
 #define INSOMNIA_BPT_NODES_H
 
 #include <cassert>
+#include <cstdint>
 #include <shared_mutex>
 
+#include "array.h"
 #include "index_pool.h"
 
 namespace insomnia {
@@ -28,11 +30,21 @@ public:
   int max_size() const { return max_size_; }
   int min_size() const { return max_size_ * 0.40; }
   int merge_bound() const { return max_size_ * 0.90; }
+  // how full the node is, as a share of its capacity.
+  double fill() const { return static_cast<double>(size()) / max_size(); }
 
   bool is_too_large() const { return size() > max_size(); }
   bool is_too_small() const { return size() < min_size(); }
   bool is_insert_safe() const { return size() < max_size(); }
   bool is_remove_safe() const { return size() > min_size(); }
+  bool is_merge_safe(const BptNodeBase &rhs) const { return size() + rhs.size() <= merge_bound(); }
+  // fixed-size entries: a key can always be overwritten in place.
+  bool is_rewrite_safe() const { return true; }
+  // a bulk loaded node takes no more entries once filled to fill_factor of its capacity.
+  bool is_filled(double fill_factor) const {
+    int fill_size = static_cast<int>(max_size() * fill_factor);
+    return size() >= std::min(max_size(), std::max(min_size() + 1, fill_size));
+  }
 
 protected:
 
@@ -54,7 +66,8 @@ class BptInternalNode : public BptNodeBase {
 
 public:
   static constexpr int CAPACITY = std::max(8ul,
-    ((sizeof(Storage) + 4095) / 4096 * 4096) / sizeof(Storage));
+    ((sizeof(BptNodeBase) + sizeof(Storage) + 4095) / 4096 * 4096 - sizeof(BptNodeBase))
+    / sizeof(Storage));
 
   BptInternalNode() = default;
   void init(int max_size = CAPACITY - 1) { BptNodeBase::init(NodeType::Internal, max_size); }
@@ -79,16 +92,193 @@ public:
   void merge(BptInternalNode *rhs);
   void redistribute(BptInternalNode *rhs);
 
-  void self_check() {
+  // whether the node is well-formed on its own. Key order is checked by the tree.
+  bool self_check() const {
+    if(size() > CAPACITY)
+      return false;
     for(int i = 0; i < size(); ++i)
-      assert(storage_[i].value != nullpos);
+      if(storage_[i].value == nullpos)
+        return false;
+    return true;
   }
 
 private:
   Storage storage_[CAPACITY];
 };
 
+/**
+ * @brief internal node for string keys ordered by strcmp, with a variable number of entries.
+ * KeyT is a pair type: a char array "key" and a trivial "value".
+ *
+ * Every separator lies between the node's fence keys: key(0) (unless the node is the leftmost one
+ * of its level) and the separator following it in the parent (unless it is the rightmost one).
+ * All separators therefore start with the common prefix of the fences, and only the rest is stored.
+ * The fences are kept up by split, merge and redistribute; bulk loaders set them by set_fences.
+ *
+ * Fullness is measured in bytes. Entry slots grow from the front of the page, key suffixes
+ * and the upper fence from the back. The suffix heap has no holes: removals close them on the spot,
+ * and the heap is only repacked when the fences or the shared prefix change.
+ */
 template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+class BptPrefixInternalNode : public BptNodeBase {
+  using StrT = decltype(KeyT::key);
+  using PairValueT = decltype(KeyT::value);
+  static constexpr int KEY_LEN = is_char_array<StrT>::length;
+
+  struct Slot {
+    ValueT value;
+    PairValueT pair_value; // value part of the separator
+    uint16_t offset;       // suffix position in data_
+    uint16_t length;       // suffix length. A '\0' follows the suffix.
+  };
+
+  static constexpr int SLOT_SIZE = sizeof(Slot);
+  static constexpr int HEADER_SIZE = sizeof(BptNodeBase) + 4 * sizeof(uint16_t);
+  static constexpr int DATA_SIZE = 4096 - HEADER_SIZE;
+  static constexpr int MAX_ENTRY_SIZE = SLOT_SIZE + KEY_LEN + 1;
+  static constexpr int FENCE_SIZE = KEY_LEN + 1;
+  // one more entry always fits physically, so a node may be split after the insertion.
+  static constexpr int BYTE_CAPACITY = DATA_SIZE - MAX_ENTRY_SIZE;
+  static constexpr int MIN_BYTES = BYTE_CAPACITY * 0.40;
+  static constexpr int MERGE_BOUND = BYTE_CAPACITY * 0.90;
+
+public:
+  static constexpr int CAPACITY = DATA_SIZE / (SLOT_SIZE + 1);
+
+  BptPrefixInternalNode() = default;
+  void init() {
+    BptNodeBase::init(NodeType::Internal, CAPACITY);
+    heap_begin_ = DATA_SIZE;
+    high_len_ = prefix_len_ = 0;
+    has_low_ = has_high_ = 0;
+  }
+
+  KeyT key(int pos) const;
+  ValueT value(int pos) const { return slots()[pos].value; }
+
+  void write_key(int pos, const KeyT &key);
+  void write_value(int pos, const ValueT &value) { slots()[pos].value = value; }
+
+  // Compare should order keys by strcmp and provide value_compare for the value part.
+  template <class KeyCompare>
+  int locate_key(const KeyT &key, const KeyCompare &key_compare) const;
+  template <class T, class Compare>
+  requires requires(const T &t, const KeyT &key, const Compare &compare) {
+    { compare(t, key) } -> std::convertible_to<bool>;
+  }
+  int locate_any(const T &t, const Compare &compare) const;
+
+  void insert(int pos, const KeyT &key, const ValueT &value);
+  void remove(int pos);
+  void split(BptPrefixInternalNode *rhs);
+  void merge(BptPrefixInternalNode *rhs);
+  void redistribute(BptPrefixInternalNode *rhs);
+
+  // has_low: key(0) is a real lower fence. high: nullptr if there is no upper fence.
+  void set_fences(bool has_low, const KeyT *high);
+
+  int bytes() const { return size() * SLOT_SIZE + (DATA_SIZE - heap_begin_); }
+
+  bool is_too_large() const { return bytes() > BYTE_CAPACITY; }
+  bool is_too_small() const { return bytes() < MIN_BYTES; }
+  bool is_insert_safe() const { return bytes() + MAX_ENTRY_SIZE <= BYTE_CAPACITY; }
+  bool is_remove_safe() const { return bytes() - MAX_ENTRY_SIZE >= MIN_BYTES; }
+  bool is_merge_safe(const BptPrefixInternalNode &rhs) const;
+  // a rewritten separator may be longer than the old one.
+  bool is_rewrite_safe() const { return bytes() + KEY_LEN <= BYTE_CAPACITY; }
+  bool is_filled(double fill_factor) const {
+    int fill_bytes = std::min<int>(BYTE_CAPACITY, std::max<int>(MIN_BYTES + 1, BYTE_CAPACITY * fill_factor));
+    return bytes() + MAX_ENTRY_SIZE + FENCE_SIZE > fill_bytes;
+  }
+
+  double fill() const { return static_cast<double>(bytes()) / BYTE_CAPACITY; }
+
+  // whether the node is well-formed on its own: children, suffixes inside a heap without holes, fences.
+  bool self_check() const {
+    if(size() > CAPACITY || heap_begin_ < size() * SLOT_SIZE || heap_begin_ > DATA_SIZE)
+      return false;
+    if(high_len_ > KEY_LEN || prefix_len_ > KEY_LEN || (has_high_ && prefix_len_ > high_len_))
+      return false;
+    int heap_bytes = has_high_ ? high_len_ + 1 : 0;
+    for(int i = 0; i < size(); ++i) {
+      const Slot &slot = slots()[i];
+      if(slot.value == nullpos || slot.offset < heap_begin_ || slot.offset + slot.length >= DATA_SIZE)
+        return false;
+      if(data_[slot.offset + slot.length] != '\0' || prefix_len_ + slot.length > KEY_LEN)
+        return false;
+      heap_bytes += slot.length + 1;
+    }
+    return heap_bytes == DATA_SIZE - heap_begin_;
+  }
+
+private:
+  Slot* slots() { return reinterpret_cast<Slot*>(data_); }
+  const Slot* slots() const { return reinterpret_cast<const Slot*>(data_); }
+  const char* suffix(int pos) const { return data_ + slots()[pos].offset; }
+  // the upper fence. Its first prefix_len_ chars are the shared prefix.
+  const char* high() const { return data_ + DATA_SIZE - high_len_ - 1; }
+
+  static int common_prefix(const char *lhs, const char *rhs);
+  // writes the whole key string at pos to str. Returns its length.
+  int copy_str(int pos, char *str) const;
+  // str is a whole key string. The shared prefix is cut short first if str does not start with it.
+  void insert_str(int pos, const char *str, const PairValueT &pair_value, const ValueT &value);
+  // closes the hole the suffix at pos leaves in the heap. The slot itself stays.
+  void erase_suffix(int pos);
+  // rewrites the heap with high as the upper fence (nullptr: none), keys stripped of their first prefix_len chars.
+  // high may live in this very page.
+  void repack(int prefix_len, const char *high);
+
+  uint16_t heap_begin_;
+  uint16_t high_len_;
+  uint16_t prefix_len_;
+  uint8_t has_low_;
+  uint8_t has_high_;
+  alignas(Slot) char data_[DATA_SIZE];
+};
+
+// internal node type for a tree over pairs KeyT. prefixed: keys are char arrays ordered by strcmp.
+template <class KeyT, class ValueT, bool prefixed>
+struct BptInternalNodeOf {
+  using type = BptInternalNode<KeyT, ValueT>;
+};
+
+template <class KeyT, class ValueT>
+struct BptInternalNodeOf<KeyT, ValueT, true> {
+  using type = BptPrefixInternalNode<KeyT, ValueT>;
+};
+
+/**
+ * @brief normalized heads of string keys: the first 8 chars, big-endian, zero padded.
+ * Heads compare as unsigned integers the way strcmp orders the strings, except for ties:
+ * head(a) < head(b) implies a < b.
+ */
+struct BptStrHead {
+  static uint64_t of(const char *str) {
+    uint64_t head = 0;
+    for(int i = 0; i < 8 && str[i] != '\0'; ++i)
+      head |= static_cast<uint64_t>(static_cast<unsigned char>(str[i])) << (56 - 8 * i);
+    return head;
+  }
+  template <class T>
+  requires requires(const T &t) { { t.c_str() } -> std::convertible_to<const char*>; }
+  static uint64_t of(const T &t) { return of(t.c_str()); }
+  template <class T>
+  requires requires(const T &t) { { t.key.c_str() } -> std::convertible_to<const char*>; }
+  static uint64_t of(const T &t) { return of(t.key.c_str()); }
+
+  // in sorted heads[0, size): less = heads below head, not_greater = heads not above it.
+  static void count(const uint64_t *heads, int size, uint64_t head, int &less, int &not_greater);
+};
+
+/**
+ * @brief leaf node. Entries are ordered by the compare object passed to the locate functions.
+ * With a HeadT (see BptStrHead), an array of key heads is kept next to the entries.
+ * Locating counts heads first and compares whole keys only among the entries tied on the head,
+ * so the compare objects must then order keys consistently with the heads.
+ */
+template <Trivial KeyT, Trivial ValueT, class HeadT = void>
 class BptLeafNode : public BptNodeBase {
 
   struct Storage {
@@ -96,9 +286,14 @@ class BptLeafNode : public BptNodeBase {
     ValueT value;
   };
 
+  static constexpr bool has_heads = !std::is_void_v<HeadT>;
+  static constexpr size_t HEAD_SIZE = has_heads ? sizeof(uint64_t) : 0;
+  struct NoHeads {};
+
 public:
   static constexpr int CAPACITY = std::max(8ul,
-    ((sizeof(Storage) + sizeof(index_t) + 4095) / 4096 * 4096 - sizeof(index_t)) / sizeof(Storage));
+    ((sizeof(BptNodeBase) + sizeof(Storage) + HEAD_SIZE + sizeof(index_t) + 4095) / 4096 * 4096
+    - sizeof(BptNodeBase) - sizeof(index_t)) / (sizeof(Storage) + HEAD_SIZE));
 
   BptLeafNode() = default;
   void init(int max_size = CAPACITY - 1) { BptNodeBase::init(NodeType::Leaf, max_size); rht_index_ = nullpos; }
@@ -107,8 +302,13 @@ public:
   const ValueT& value(int pos) const { return storage_[pos].value; }
   const index_t& rht_index() const { return rht_index_; }
 
-  void write_key(int pos, const KeyT &key) { storage_[pos].key = key; }
+  void write_key(int pos, const KeyT &key) {
+    storage_[pos].key = key;
+    if constexpr(has_heads)
+      heads_[pos] = HeadT::of(key);
+  }
   void write_value(int pos, const ValueT &value) { storage_[pos].value = value; }
+  void write_rht_index(index_t rht_index) { rht_index_ = rht_index; }
 
   template <class KeyCompare>
   int locate_key(const KeyT &key, const KeyCompare &key_compare) const;
@@ -124,9 +324,167 @@ public:
   void merge(BptLeafNode *rhs);
   void redistribute(BptLeafNode *rhs);
 
+  // whether the node is well-formed on its own. Key order is checked by the tree.
+  bool self_check() const {
+    if(size() > CAPACITY)
+      return false;
+    if constexpr(has_heads) {
+      for(int i = 0; i < size(); ++i)
+        if(heads_[i] != HeadT::of(storage_[i].key))
+          return false;
+    }
+    return true;
+  }
+
 private:
+  // [lft, rht): the entries that may need a whole key comparison against something with this head.
+  void head_range(uint64_t head, int &lft, int &rht) const;
+  // moves count entries from src[src_pos] to dst[dst_pos], heads included. Ranges may overlap.
+  static void move_entries(BptLeafNode *dst, int dst_pos, const BptLeafNode *src, int src_pos, int count);
+
   Storage storage_[CAPACITY];
+  [[no_unique_address]] std::conditional_t<has_heads, uint64_t[CAPACITY], NoHeads> heads_;
+  index_t rht_index_;
+};
+
+/**
+ * @brief leaf node for string keys ordered by strcmp, with a variable number of entries.
+ * KeyT is a pair type: a char array "key" and a trivial "value".
+ *
+ * Keys are stored with their own length instead of the full char array.
+ * Entry slots grow from the front of the page, key bytes from the back; removed keys leave holes
+ * that are packed away only when an insertion runs out of room.
+ * Each slot keeps the BptStrHead of its key, and only the rest of the key goes to the key bytes:
+ * locating searches the heads in the slot array, and follows the offsets into the key bytes
+ * only among the entries tied on the head.
+ * Fullness is measured in bytes, the way BptPrefixInternalNode does.
+ * key(pos) decodes the entry, so it returns by value.
+ */
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+class BptSlottedLeafNode : public BptNodeBase {
+  using StrT = decltype(KeyT::key);
+  using PairValueT = decltype(KeyT::value);
+  static constexpr int KEY_LEN = is_char_array<StrT>::length;
+  static constexpr int HEAD_LEN = sizeof(uint64_t);
+
+  struct Slot {
+    ValueT value;
+    PairValueT pair_value;
+    // BptStrHead of the key, in halves: the slot needs no more alignment than the values.
+    uint32_t head_hi;
+    uint32_t head_lo;
+    uint16_t offset; // suffix position in data_
+    uint16_t length; // suffix length: the key past its head. A '\0' follows the suffix.
+  };
+
+  static constexpr int SLOT_SIZE = sizeof(Slot);
+  static constexpr int SLOT_ALIGN = alignof(Slot);
+  static constexpr int HEADER_SIZE =
+    (sizeof(BptNodeBase) + sizeof(index_t) + 2 * sizeof(uint16_t) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+  static constexpr int DATA_SIZE = (4096 - HEADER_SIZE) / SLOT_ALIGN * SLOT_ALIGN;
+  static constexpr int MAX_ENTRY_SIZE = SLOT_SIZE + KEY_LEN + 1;
+  // one more entry always fits physically, so a node may be split after the insertion.
+  static constexpr int BYTE_CAPACITY = DATA_SIZE - MAX_ENTRY_SIZE;
+  static constexpr int MIN_BYTES = BYTE_CAPACITY * 0.40;
+  static constexpr int MERGE_BOUND = BYTE_CAPACITY * 0.90;
+
+public:
+  static constexpr int CAPACITY = DATA_SIZE / (SLOT_SIZE + 1);
+
+  BptSlottedLeafNode() = default;
+  void init() {
+    static_assert(sizeof(BptSlottedLeafNode) <= 4096);
+    BptNodeBase::init(NodeType::Leaf, CAPACITY);
+    rht_index_ = nullpos;
+    heap_begin_ = DATA_SIZE;
+    key_bytes_ = 0;
+  }
+
+  KeyT key(int pos) const;
+  const ValueT& value(int pos) const { return slots()[pos].value; }
+  const index_t& rht_index() const { return rht_index_; }
+
+  void write_value(int pos, const ValueT &value) { slots()[pos].value = value; }
+  void write_rht_index(index_t rht_index) { rht_index_ = rht_index; }
+
+  // Compare should order keys by strcmp and provide value_compare for the value part.
+  template <class KeyCompare>
+  int locate_key(const KeyT &key, const KeyCompare &key_compare) const;
+  template <class T, class Compare>
+  requires requires(const T &t, const KeyT &key, const Compare &compare) {
+    { compare(key, t) } -> std::convertible_to<bool>;
+  }
+  int locate_any(const T &t, const Compare &compare) const;
+
+  void insert(int pos, const KeyT &key, const ValueT &value);
+  void remove(int pos);
+  void split(BptSlottedLeafNode *rhs, index_t rht_index);
+  void merge(BptSlottedLeafNode *rhs);
+  void redistribute(BptSlottedLeafNode *rhs);
+
+  int bytes() const { return size() * SLOT_SIZE + key_bytes_; }
+
+  bool is_too_large() const { return bytes() > BYTE_CAPACITY; }
+  bool is_too_small() const { return bytes() < MIN_BYTES; }
+  bool is_insert_safe() const { return bytes() + MAX_ENTRY_SIZE <= BYTE_CAPACITY; }
+  bool is_remove_safe() const { return bytes() - MAX_ENTRY_SIZE >= MIN_BYTES; }
+  bool is_merge_safe(const BptSlottedLeafNode &rhs) const { return bytes() + rhs.bytes() <= MERGE_BOUND; }
+  bool is_filled(double fill_factor) const {
+    int fill_bytes = std::min<int>(BYTE_CAPACITY, std::max<int>(MIN_BYTES + 1, BYTE_CAPACITY * fill_factor));
+    return bytes() + MAX_ENTRY_SIZE > fill_bytes;
+  }
+  double fill() const { return static_cast<double>(bytes()) / BYTE_CAPACITY; }
+
+  // whether the node is well-formed on its own: keys inside the heap, key_bytes_ in step with them.
+  bool self_check() const {
+    if(size() > CAPACITY || heap_begin_ < size() * SLOT_SIZE || heap_begin_ > DATA_SIZE)
+      return false;
+    int key_bytes = 0;
+    for(int i = 0; i < size(); ++i) {
+      const Slot &slot = slots()[i];
+      if(slot.offset < heap_begin_ || slot.offset + slot.length >= DATA_SIZE || slot.length > KEY_LEN)
+        return false;
+      if(data_[slot.offset + slot.length] != '\0')
+        return false;
+      // a suffix follows a full head only.
+      if(head(i) != BptStrHead::of(key(i)) || (slot.length > 0 && (head(i) & 0xff) == 0))
+        return false;
+      key_bytes += slot.length + 1;
+    }
+    return key_bytes == key_bytes_;
+  }
+
+private:
+  Slot* slots() { return reinterpret_cast<Slot*>(data_); }
+  const Slot* slots() const { return reinterpret_cast<const Slot*>(data_); }
+  const char* suffix(int pos) const { return data_ + slots()[pos].offset; }
+  uint64_t head(int pos) const { return static_cast<uint64_t>(slots()[pos].head_hi) << 32 | slots()[pos].head_lo; }
+  int entry_bytes(int pos) const { return SLOT_SIZE + slots()[pos].length + 1; }
+
+  // [lft, rht): the entries that may need a whole key comparison against something with this head.
+  void head_range(uint64_t head, int &lft, int &rht) const;
+
+  // removes count entries from pos on.
+  void remove_range(int pos, int count);
+  // packs the key bytes of the live entries to the back of the page.
+  void compact();
+
   index_t rht_index_;
+  uint16_t heap_begin_;
+  uint16_t key_bytes_; // '\0's included
+  alignas(Slot) char data_[DATA_SIZE];
+};
+
+// leaf node type for a tree over pairs KeyT. slotted: keys are char arrays ordered by strcmp.
+template <class KeyT, class ValueT, bool slotted>
+struct BptLeafNodeOf {
+  using type = BptLeafNode<KeyT, ValueT>;
+};
+
+template <class KeyT, class ValueT>
+struct BptLeafNodeOf<KeyT, ValueT, true> {
+  using type = BptSlottedLeafNode<KeyT, ValueT>;
 };
 
 }
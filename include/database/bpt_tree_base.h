@@ -0,0 +1,97 @@
+#ifndef INSOMNIA_BPT_TREE_BASE_H
+#define INSOMNIA_BPT_TREE_BASE_H
+
+#include <shared_mutex>
+#include <utility>
+
+#include "bpt_nodes.h"
+#include "buffer_pool.h"
+
+namespace insomnia {
+
+/**
+ * @brief the page-level half of a B+ tree: the buffer pool, the root, the latched descents
+ * and the splits and merges that run up a pessimistic path.
+ * Internal nodes hold SepT, ordered by SepCompare; leaves are LeafT, whose key(pos) converts to SepT.
+ * The tree on top decides what a leaf entry matches, and hands the leaf step of an insert or remove
+ * to InsertPessi/RemovePessi.
+ */
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+class BptTreeBase {
+protected:
+  using index_t = BptNodeBase::index_t;
+  static constexpr index_t nullpos = IndexPool::nullpos;
+
+  using Base = BptNodeBase;
+  using Internal = typename BptInternalNodeOf<SepT, index_t, is_prefixed>::type;
+  using Leaf = LeafT;
+
+  struct alignas(4096) RootHolder {
+    int root;
+  };
+
+  using BufferPoolType = BufferPool<
+    Base, RootHolder, std::max(sizeof(Internal), sizeof(Leaf))
+  >;
+  using Reader = typename BufferPoolType::Reader;
+  using Writer = typename BufferPoolType::Writer;
+  using RootLock = std::unique_lock<std::shared_mutex>;
+
+  // exclusive upper bound of the entries a leaf holds, collected during the descent.
+  struct LeafBound {
+    bool bounded{false};
+    SepT upper;
+  };
+
+  // opens the buffer pool with args and reads the root from its meta.
+  template <class... Args>
+  explicit BptTreeBase(Args &&...args);
+  // the tree on top saves the root; it may have to stop its own threads first.
+  ~BptTreeBase() = default;
+
+  // reads root_ from the file meta and measures height_.
+  void LoadRoot();
+  // writes root_ to the file meta. Called in the write scope that moved the root, so the log commits them together.
+  void SaveRoot();
+
+  // Optimistically find the leaf: read latches on the path, write latch on the leaf only.
+  // Returns an empty Writer if the tree is empty. Fills bound if given.
+  Writer FindLeafOptim(const SepT &sep, LeafBound *bound = nullptr);
+
+  // Pessimistically find the leaf: write latches from the root down.
+  // Ancestors are released (root_lock included) once a node safe for the operation is reached.
+  // The tree should not be empty.
+  vector<Writer> FindLeafPessi(RootLock &root_lock, const SepT &sep, bool is_insert);
+
+  /**
+   * @brief insert/remove along a pessimistic path found by sep. The last writer is the leaf.
+   * leaf_step(Leaf*) changes the leaf and returns false if there was nothing to change;
+   * the path is then split or merged up as far as needed.
+   * root_latch_ should still be held if the path starts from the root.
+   */
+  template <class LeafStep>
+  bool InsertPessi(vector<Writer> &writers, const SepT &sep, LeafStep &&leaf_step);
+  template <class LeafStep>
+  bool RemovePessi(vector<Writer> &writers, const SepT &sep, LeafStep &&leaf_step);
+
+  // a separator for two adjacent leaves: greater than lhs, not greater than rhs.
+  // Truncated to the shortest key prefix that tells them apart if is_prefixed.
+  static SepT Separator(const SepT &lhs, const SepT &rhs);
+
+  // whether the node behind writer survives the operation without restructuring.
+  static bool IsSafe(const Writer &writer, bool is_insert);
+
+  BufferPoolType buffer_pool_;
+  index_t root_;
+  int height_{0}; // levels of the tree. guarded by root_latch_.
+  SepCompare sep_compare_;
+  // guards root_ and height_ only. Pages are latched one by one through the buffer pool.
+  std::shared_mutex root_latch_;
+};
+
+}
+
+
+#include "bpt_tree_base.tcc"
+
+#endif
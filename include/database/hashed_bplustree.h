@@ -0,0 +1,80 @@
+#ifndef INSOMNIA_HASHED_BPLUSTREE_H
+#define INSOMNIA_HASHED_BPLUSTREE_H
+
+#include <mutex>
+
+#include "array.h"
+#include "bplustree.h"
+#include "hash.h"
+
+namespace insomnia {
+
+/**
+ * @brief MultiBPlusTree over long string keys, indexed by their hash_pair.
+ * Entries live in a tree keyed by (hash_pair, salt): 24 bytes compared as integers
+ * instead of strcmp over the whole string.
+ * A dictionary tree maps each hash_pair to the strings seen with it and the salt each of them got,
+ * so colliding strings never share entries and lookups stay exact.
+ * Dictionary entries outlive the values of their string; a string inserted again gets its old salt back.
+ * HashT is built from a std::string_view and ordered by operator<; hash_pair by default.
+ * @warning Entries are ordered by hash, so there are no range scans.
+ */
+template <
+  Trivial KeyT, Trivial ValueT,
+  class ValueCompare = std::less<ValueT>, Trivial HashT = hash_pair
+>
+requires is_char_array_v<KeyT>
+class HashedMultiBPlusTree {
+  struct HashKey {
+    HashT hash;
+    unsigned salt;
+    bool operator<(const HashKey &other) const {
+      if(hash < other.hash) return true;
+      if(other.hash < hash) return false;
+      return salt < other.salt;
+    }
+  };
+
+  struct DictEntry {
+    KeyT key;
+    unsigned salt;
+  };
+  struct DictCompare {
+    bool operator()(const DictEntry &lhs, const DictEntry &rhs) const { return lhs.salt < rhs.salt; }
+  };
+
+public:
+  HashedMultiBPlusTree(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, size_t thread_num);
+
+  vector<ValueT> search(const KeyT &key);
+
+  bool insert(const KeyT &key, const ValueT &value);
+
+  bool remove(const KeyT &key, const ValueT &value);
+
+  // see MultiBPlusTree::insert_batch.
+  template <class InputIt>
+  size_t insert_batch(InputIt first, InputIt last);
+
+  // see MultiBPlusTree::remove_batch.
+  template <class InputIt>
+  size_t remove_batch(InputIt first, InputIt last);
+
+private:
+  // finds the salt of key. Registers key in the dictionary if it is unknown and create is set.
+  // returns false if key is unknown and not registered.
+  bool FindSalt(const KeyT &key, const HashT &hash, bool create, unsigned &salt);
+
+  MultiBPlusTree<HashKey, ValueT, std::less<HashKey>, ValueCompare> tree_;
+  MultiBPlusTree<HashT, DictEntry, std::less<HashT>, DictCompare> dict_;
+  // serializes salt assignment. Lookups don't take it.
+  std::mutex dict_latch_;
+};
+
+}
+
+
+#include "hashed_bplustree.tcc"
+
+#endif
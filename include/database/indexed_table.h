@@ -0,0 +1,115 @@
+#ifndef INSOMNIA_INDEXED_TABLE_H
+#define INSOMNIA_INDEXED_TABLE_H
+
+#include <tuple>
+
+#include "bplustree.h"
+#include "record_store.h"
+
+namespace insomnia {
+
+/**
+ * @brief describes one secondary index of a table over RecordT:
+ * @code
+ * struct ByStation {
+ *   using key_type = array<char, 30>;
+ *   static key_type key_of(const Train &train) { return train.station; }
+ * };
+ * @endcode
+ */
+template <class Index, class RecordT>
+concept TableIndex = requires(const RecordT &record) {
+  requires Trivial<typename Index::key_type>;
+  { Index::key_of(record) } -> std::convertible_to<typename Index::key_type>;
+};
+
+/**
+ * @brief a visitor of table records: called with the RID and the record, or with the record alone.
+ */
+template <class Visitor, class RecordT>
+concept TableVisitor =
+  std::invocable<Visitor&, const RID&, const RecordT&> || std::invocable<Visitor&, const RecordT&>;
+
+/**
+ * @brief records of RecordT in a RecordStore, plus one MultiBPlusTree<key, RID> per Index.
+ * Writes go to the store and to every index together; reads pick their index by its descriptor type.
+ * The store and the indexes share one TaskScheduler for their disk I/O,
+ * and split buffer_capacity frames evenly among their buffer pools.
+ *
+ * There are no transactions. A record is stored before it is indexed and unindexed before it is removed,
+ * so that an index never leads to a missing record; a concurrent reader may miss a record being written.
+ * @warning Writes to the same record should not race.
+ */
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+class IndexedTable {
+  template <class Index>
+  using Tree = MultiBPlusTree<typename Index::key_type, RID>;
+
+  // position of Index among Indexes.
+  template <class Index>
+  static constexpr size_t position_of() {
+    constexpr bool is_same[] = {std::is_same_v<Index, Indexes>...};
+    for(size_t i = 0; i < sizeof...(Indexes); ++i)
+      if(is_same[i])
+        return i;
+    return sizeof...(Indexes);
+  }
+
+public:
+  IndexedTable(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, size_t thread_num);
+
+  RID insert(const RecordT &record);
+  bool read(const RID &rid, RecordT &record);
+  // re-indexes the record under the indexes whose key changed.
+  bool update(const RID &rid, const RecordT &record);
+  bool remove(const RID &rid);
+
+  // the records whose Index key is key, in RID order.
+  template <class Index>
+  vector<RecordT> search(const typename Index::key_type &key);
+
+  /**
+   * @brief passes the records whose Index key is key to visitor, in RID order, with their RIDs if it takes them.
+   * A visitor returning bool stops the search early by returning false.
+   * @return the number of records visited.
+   * @warning the visitor runs under a leaf latch of the index: keep the RIDs and update or remove
+   *   the records after the search returns.
+   */
+  template <class Index, class Visitor>
+  requires TableVisitor<Visitor, RecordT>
+  size_t search(const typename Index::key_type &key, Visitor &&visitor);
+
+  // same as search, over the records whose Index key is in [lower, upper), in key order.
+  template <class Index, class Visitor>
+  requires TableVisitor<Visitor, RecordT>
+  size_t range(const typename Index::key_type &lower, const typename Index::key_type &upper, Visitor &&visitor);
+
+private:
+  template <class Index>
+  Tree<Index>& IndexTree() {
+    static_assert(position_of<Index>() < sizeof...(Indexes), "not an index of this table");
+    return *std::get<position_of<Index>()>(indexes_);
+  }
+
+  // calls f(tree, key) for the tree and the key of record under every index.
+  template <class F>
+  void ForEachIndex(const RecordT &record, F &&f);
+
+  // passes the record at rid, and rid if it takes it, to visitor. false if visitor asked to stop.
+  // A record removed since it was found is skipped.
+  template <class Visitor>
+  bool Visit(const RID &rid, Visitor &visitor, size_t &visited);
+
+  TaskScheduler scheduler_; // outlives the pools sharing it.
+  RecordStore store_;
+  std::tuple<std::unique_ptr<Tree<Indexes>>...> indexes_;
+};
+
+}
+
+
+#include "indexed_table.tcc"
+
+#endif
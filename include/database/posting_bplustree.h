@@ -0,0 +1,92 @@
+#ifndef INSOMNIA_POSTING_BPLUSTREE_H
+#define INSOMNIA_POSTING_BPLUSTREE_H
+
+#include <limits>
+
+#include "unique_bplustree.h"
+
+namespace insomnia {
+
+/**
+ * @brief MultiBPlusTree for keys with long runs of values.
+ * Each key is stored once, in a BPlusTree entry (the posting head) followed by its sorted values.
+ * A few values live in the head itself; longer runs move to a chain of overflow pages
+ * holding nothing but values, in ValueCompare order.
+ * A key with n values costs one head plus about n * sizeof(ValueT) bytes,
+ * instead of n copies of (key, value, value) in a MultiBPlusTree leaf.
+ * Overflow pages are only reached through their head, under its leaf latch.
+ * @warning A key with a single value costs more than in MultiBPlusTree. Use it for duplicate-heavy indexes.
+ */
+template <
+  Trivial KeyT, Trivial ValueT,
+  class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>
+>
+class PostingMultiBPlusTree {
+  using index_t = IndexPool::index_t;
+  static constexpr index_t nullpos = IndexPool::nullpos;
+
+  // a piece of a long run. Pages of a run are chained in value order.
+  struct PostingPage {
+    static constexpr int CAPACITY = std::max<int>(8,
+      (4096 - sizeof(index_t) - sizeof(int)) / sizeof(ValueT));
+    index_t rht_index;
+    int size;
+    ValueT values[CAPACITY];
+  };
+
+  struct PostingHead {
+    static constexpr int INLINE_CAPACITY = std::max<int>(1, 32 / sizeof(ValueT));
+    size_t size;             // values of the key
+    index_t head_index;      // first overflow page. nullpos while the values are inline.
+    index_t tail_index;      // last overflow page
+    ValueT values[INLINE_CAPACITY];
+  };
+
+  using Tree = BPlusTree<KeyT, PostingHead, KeyCompare>;
+  using BufferPoolType = BufferPool<PostingPage>;
+  using Reader = typename BufferPoolType::Reader;
+  using Writer = typename BufferPoolType::Writer;
+
+public:
+  PostingMultiBPlusTree(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, size_t thread_num);
+
+  vector<ValueT> search(const KeyT &key);
+
+  // see MultiBPlusTree::search.
+  template <class Visitor>
+  requires std::invocable<Visitor&, const ValueT&>
+  size_t search(const KeyT &key, Visitor &&visitor,
+    size_t limit = std::numeric_limits<size_t>::max());
+
+  // read from the head, without touching the overflow pages.
+  size_t count(const KeyT &key);
+
+  bool insert(const KeyT &key, const ValueT &value);
+
+  bool remove(const KeyT &key, const ValueT &value);
+
+private:
+  // first position in values[0, size) not less than value.
+  int LowerBound(const ValueT *values, int size, const ValueT &value) const;
+
+  // the run of head, with one more or one less value. false if nothing changed.
+  bool InsertValue(PostingHead &head, const ValueT &value);
+  bool RemoveValue(PostingHead &head, const ValueT &value);
+
+  // moves an overflowing inline run, plus value, to a new overflow page.
+  void Spill(PostingHead &head, const ValueT &value);
+  // moves a run that fits inline again back into the head, freeing its pages.
+  void Unspill(PostingHead &head);
+
+  Tree tree_;
+  BufferPoolType buffer_pool_;
+  ValueCompare value_compare_;
+};
+
+}
+
+
+#include "posting_bplustree.tcc"
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef INSOMNIA_RECORD_STORE_H
+#define INSOMNIA_RECORD_STORE_H
+
+#include <compare>
+#include <mutex>
+
+#include "bpt_nodes.h"
+#include "buffer_pool.h"
+#include "exception.h"
+
+namespace insomnia {
+
+/**
+ * @brief where a record lives: its heap page and its slot there.
+ * Stays the same for the life of the record, updates included, so indexes can hold it as a value.
+ */
+struct RID {
+  IndexPool::index_t page{IndexPool::nullpos};
+  uint32_t slot{0};
+
+  bool is_valid() const { return page != IndexPool::nullpos; }
+  auto operator<=>(const RID&) const = default;
+};
+
+/**
+ * @brief heap file of variable-length records, addressed by RID.
+ * Records live in slotted heap pages: slots grow from the front of the page, record bytes from the back.
+ * A record that doesn't fit in a page (or no longer fits in its own page after an update)
+ * moves to a chain of overflow pages and leaves a stub in its slot, so its RID never changes.
+ * Reading a record that fits in a page costs one page read.
+ *
+ * Pages are latched one by one through the buffer pool. Overflow pages are only reached
+ * through their stub, under the latch of its heap page.
+ * @warning Slots of removed records are reused: an RID must be dropped from the indexes with its record.
+ */
+class RecordStore {
+  using index_t = IndexPool::index_t;
+  static constexpr index_t nullpos = IndexPool::nullpos;
+  static constexpr size_t PAGE_SIZE = 4096;
+
+  enum class PageType : uint32_t { Heap = 0x48454150, Overflow = 0x4f564552 };
+
+  struct PageBase {
+    PageType type;
+  };
+
+  struct HeapPage : PageBase {
+    struct Slot {
+      uint16_t offset;    // record position in data. 0 for a free slot.
+      uint16_t length;    // record bytes, or the stub for an overflowed record.
+      uint16_t is_overflow;
+    };
+    static constexpr int HEADER_SIZE = sizeof(PageBase) + 3 * sizeof(uint16_t);
+    static constexpr int DATA_SIZE = PAGE_SIZE - HEADER_SIZE;
+    static constexpr int SLOT_SIZE = sizeof(Slot);
+
+    uint16_t slot_count;
+    uint16_t heap_begin;  // record bytes lie in [heap_begin, DATA_SIZE), holes included.
+    uint16_t hole_bytes;  // bytes freed by removed records and not packed away yet.
+    alignas(Slot) char data[DATA_SIZE];
+
+    Slot* slots() { return reinterpret_cast<Slot*>(data); }
+    const Slot* slots() const { return reinterpret_cast<const Slot*>(data); }
+    int free_bytes() const { return heap_begin - slot_count * SLOT_SIZE + hole_bytes; }
+  };
+
+  struct OverflowPage : PageBase {
+    static constexpr int DATA_SIZE = PAGE_SIZE - sizeof(PageBase) - sizeof(index_t) - sizeof(uint32_t);
+    uint32_t length;
+    index_t rht_index;
+    char data[DATA_SIZE];
+  };
+
+  // what an overflowed record leaves in its slot.
+  struct Stub {
+    uint32_t size;
+    index_t head_index;
+  };
+  // every record takes at least this much of its page, so it can always turn into a stub in place.
+  static constexpr int MIN_RECORD_BYTES = sizeof(Stub);
+  // pages with less room than this are not tried for new records.
+  static constexpr int RETIRE_BYTES = HeapPage::DATA_SIZE / 16;
+  // a page whose room grows past this after removals is tried for new records again.
+  static constexpr int HINT_BYTES = HeapPage::DATA_SIZE / 4;
+
+  // pages with room for new records that are not the tail page. Kept across runs.
+  static constexpr int HINT_CAPACITY = 64;
+  struct alignas(4096) StoreMeta {
+    index_t tail_index;
+    int hint_count;
+    index_t hints[HINT_CAPACITY];
+  };
+
+  using BufferPoolType = BufferPool<PageBase, StoreMeta, PAGE_SIZE>;
+  using Reader = typename BufferPoolType::Reader;
+  using Writer = typename BufferPoolType::Writer;
+
+public:
+  // records of at most INLINE_LIMIT bytes are stored in their heap page.
+  static constexpr size_t INLINE_LIMIT = HeapPage::DATA_SIZE - HeapPage::SLOT_SIZE;
+  static constexpr size_t MAX_RECORD_SIZE = 1 << 20;
+
+  RecordStore(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, size_t thread_num);
+  // disk I/O goes to scheduler, shared with other stores and trees. It should outlive the store.
+  RecordStore(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, TaskScheduler &scheduler);
+  ~RecordStore();
+
+  // @throw database_exception if the record is larger than MAX_RECORD_SIZE.
+  RID insert(const void *data, size_t size);
+  template <Trivial T>
+  RID insert(const T &record) { return insert(&record, sizeof(T)); }
+
+  // copies the record into data. false if there is no such record.
+  bool read(const RID &rid, vector<char> &data);
+  // false if there is no such record, or it is not sizeof(T) bytes long.
+  template <Trivial T>
+  bool read(const RID &rid, T &record);
+
+  // the record keeps its RID whatever its new size.
+  // @throw database_exception if the record is larger than MAX_RECORD_SIZE.
+  bool update(const RID &rid, const void *data, size_t size);
+  template <Trivial T>
+  bool update(const RID &rid, const T &record) { return update(rid, &record, sizeof(T)); }
+
+  bool remove(const RID &rid);
+
+private:
+  // reads tail_index_ and hints_ from the file meta.
+  void LoadMeta();
+  // latches the heap page of rid and finds its slot. Returns nullptr if the record doesn't exist.
+  template <class Guard>
+  auto FindSlot(Guard &guard, const RID &rid) -> decltype(guard.template as<HeapPage>()->slots());
+
+  // the heap page to try after tried pages failed: the hinted pages, then the tail page, then a new tail page.
+  index_t PickPage(size_t tried);
+  // allocates an empty heap page. Its header is written before the index is handed out.
+  index_t NewHeapPage();
+  // forgets a page too full for new records.
+  void RetirePage(index_t index);
+  // remembers a page that got room for new records again.
+  void AddHint(index_t index);
+  // frees what the record in slot takes of its page, overflow chain included. The slot stays in place.
+  void FreeRecord(HeapPage *page, typename HeapPage::Slot *slot);
+
+  // bytes of page taken by a record of length bytes stored in its slot, the slot excluded.
+  static int StoredBytes(int length) { return std::max(length, MIN_RECORD_BYTES); }
+  // reserves bytes at the front of the record heap, packing the holes away if needed.
+  static uint16_t Allocate(HeapPage *page, int bytes);
+  // moves the records to the back of the page, removing the holes.
+  static void Compact(HeapPage *page);
+
+  // writes size bytes to a new overflow chain. Returns its head.
+  index_t WriteChain(const char *data, size_t size);
+  void ReadChain(index_t index, char *data);
+  void FreeChain(index_t index);
+  // stores the record in slot: inline if it fits in the page, as a stub to a new chain otherwise.
+  // The old contents of the slot should be freed already.
+  void StoreRecord(HeapPage *page, typename HeapPage::Slot *slot, const char *data, size_t size);
+
+  BufferPoolType buffer_pool_;
+  // guards tail_index_ and hints_ only.
+  std::mutex store_latch_;
+  index_t tail_index_{nullpos};
+  vector<index_t> hints_;
+};
+
+template <Trivial T>
+bool RecordStore::read(const RID &rid, T &record) {
+  Reader reader;
+  auto slot = FindSlot(reader, rid);
+  if(!slot)
+    return false;
+  const HeapPage *page = reader.template as<HeapPage>();
+  if(slot->is_overflow) {
+    Stub stub;
+    memcpy(&stub, page->data + slot->offset, sizeof(Stub));
+    if(stub.size != sizeof(T))
+      return false;
+    ReadChain(stub.head_index, reinterpret_cast<char*>(&record));
+    return true;
+  }
+  if(slot->length != sizeof(T))
+    return false;
+  memcpy(&record, page->data + slot->offset, sizeof(T));
+  return true;
+}
+
+template <class Guard>
+auto RecordStore::FindSlot(Guard &guard, const RID &rid) -> decltype(guard.template as<HeapPage>()->slots()) {
+  if(!rid.is_valid() || rid.page > buffer_pool_.page_capacity())
+    return nullptr;
+  if constexpr(std::is_same_v<Guard, Writer>)
+    guard = buffer_pool_.get_writer(rid.page);
+  else
+    guard = buffer_pool_.get_reader(rid.page);
+  auto *page = guard.template as<HeapPage>();
+  if(page->type != PageType::Heap || rid.slot >= page->slot_count || page->slots()[rid.slot].offset == 0)
+    return nullptr;
+  return page->slots() + rid.slot;
+}
+
+}
+
+#endif
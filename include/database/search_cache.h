@@ -0,0 +1,82 @@
+#ifndef INSOMNIA_SEARCH_CACHE_H
+#define INSOMNIA_SEARCH_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "unordered_map.h"
+#include "vector.h"
+
+namespace insomnia {
+
+/**
+ * @brief the values of recently searched keys, kept within byte_budget bytes, least recently used evicted first.
+ * Split into shards by key hash, each with its own latch and its share of the budget.
+ *
+ * Writers invalidate the keys they changed after changing them. A search that misses reads generation(key)
+ * before it goes to the tree and passes it back to store, which drops the result if the key
+ * has been invalidated in between: a result read before a write is never cached after it.
+ */
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+class SearchCache {
+public:
+  using Values = std::shared_ptr<const vector<ValueT>>;
+
+  explicit SearchCache(size_t byte_budget);
+  SearchCache(const SearchCache&) = delete;
+  SearchCache& operator=(const SearchCache&) = delete;
+  ~SearchCache();
+
+  // the cached values of key, or nullptr on a miss. Stay valid after the entry is evicted.
+  Values lookup(const KeyT &key);
+  uint64_t generation(const KeyT &key) const { return generations_[Stripe(key)].load(); }
+  // caches values of key, unless key has been invalidated since generation was read.
+  void store(const KeyT &key, uint64_t generation, vector<ValueT> &&values);
+  void invalidate(const KeyT &key);
+  // invalidates every key.
+  void clear();
+
+  size_t bytes() const { return bytes_.load(); }
+  size_t hits() const { return hits_.load(); }
+  size_t misses() const { return misses_.load(); }
+
+private:
+  static constexpr size_t SHARD_COUNT = 16;
+  static constexpr size_t STRIPE_COUNT = 1024; // a multiple of SHARD_COUNT.
+
+  struct Entry {
+    KeyT key;
+    Values values;
+    size_t bytes;
+    Entry *prv{nullptr}, *nxt{nullptr}; // LRU order, most recent first.
+  };
+  struct Shard {
+    std::mutex latch;
+    unordered_map<KeyT, Entry*, Hash, KeyEqual> entries;
+    Entry *head{nullptr}, *tail{nullptr};
+    size_t bytes{0};
+  };
+
+  // generation stripe of key. Its shard is the stripe modulo SHARD_COUNT.
+  size_t Stripe(const KeyT &key) const;
+  Shard& ShardOf(const KeyT &key) { return shards_[Stripe(key) % SHARD_COUNT]; }
+
+  void Link(Shard &shard, Entry *entry);
+  void Unlink(Shard &shard, Entry *entry);
+  // unlinks and frees entry. The shard latch should be held.
+  void Drop(Shard &shard, Entry *entry);
+
+  size_t shard_budget_;
+  Hash hash_;
+  Shard shards_[SHARD_COUNT];
+  std::atomic<uint64_t> generations_[STRIPE_COUNT]{};
+  std::atomic<size_t> bytes_{0}, hits_{0}, misses_{0};
+};
+
+}
+
+
+#include "search_cache.tcc"
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef INSOMNIA_SHARDED_BPLUSTREE_H
+#define INSOMNIA_SHARDED_BPLUSTREE_H
+
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#include "bplustree.h"
+#include "hash.h"
+
+namespace insomnia {
+
+/**
+ * @brief the default shard hash: hash1 of the string for char arrays, std::hash for integers and enums,
+ * hash1 of the object bytes otherwise. The last case needs a KeyCompare under which keys with different
+ * bytes never compare equal.
+ */
+template <class KeyT>
+struct ShardHash {
+  size_t operator()(const KeyT &key) const {
+    if constexpr(is_char_array_v<KeyT>)
+      return hash1(key.c_str());
+    else if constexpr(std::is_integral_v<KeyT> || std::is_enum_v<KeyT>)
+      return std::hash<KeyT>()(key);
+    else
+      return hash1(std::string_view(reinterpret_cast<const char*>(&key), sizeof(KeyT)));
+  }
+};
+
+/**
+ * @brief MultiBPlusTree split by key hash into shard_count independent trees,
+ * each with its own file, buffer pool and root latch. All the values of a key live in one shard,
+ * so point operations behave as on a single tree, while writers to different shards never meet.
+ * The shards share one TaskScheduler for their disk I/O and split buffer_capacity frames evenly.
+ * Range scans merge a cursor per shard.
+ * @warning reopen the tree with the same shard_count and KeyHash, or keys are looked up in the wrong shard.
+ */
+template <
+  Trivial KeyT, Trivial ValueT,
+  class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>,
+  class KeyHash = ShardHash<KeyT>
+>
+class ShardedMultiBPlusTree {
+  using Tree = MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>;
+
+public:
+  using Stats = typename Tree::Stats;
+
+  /**
+   * @brief forward cursor over the entries of every shard, in key order.
+   * Keeps one shard cursor open per shard, each holding a leaf of its own buffer pool.
+   * @warning same latching caveats as MultiBPlusTree::Cursor.
+   */
+  class Cursor {
+    friend ShardedMultiBPlusTree;
+  public:
+    Cursor() = default;
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+    // the moved-from cursor becomes invalid.
+    Cursor(Cursor &&other) noexcept;
+    Cursor& operator=(Cursor &&other) noexcept;
+    ~Cursor() = default;
+
+    bool valid() const { return current_ != cursors_.size(); }
+    KeyT key() const { return cursors_[current_].key(); }
+    const ValueT& value() const { return cursors_[current_].value(); }
+    void next();
+    // releases every shard cursor. The cursor becomes invalid.
+    void reset();
+
+  private:
+    // points current_ at the shard cursor with the least key, or past the last cursor if they are all done.
+    void settle();
+
+    vector<typename Tree::Cursor> cursors_;
+    size_t current_{0};
+    KeyCompare key_compare_;
+  };
+
+  /**
+   * @brief opens the shards stored in name.shard0.dat, name.shard1.dat, ...
+   * log_mode applies to every shard; see MultiBPlusTree.
+   */
+  ShardedMultiBPlusTree(const std::filesystem::path &name, size_t shard_count,
+    size_t k_param, size_t buffer_capacity, size_t thread_num, LogMode log_mode = LogMode::off);
+
+  size_t shard_count() const { return shards_.size(); }
+
+  vector<ValueT> search(const KeyT &key) { return ShardOf(key).search(key); }
+
+  // see MultiBPlusTree::search.
+  template <class Visitor>
+  requires std::invocable<Visitor&, const ValueT&>
+  size_t search(const KeyT &key, Visitor &&visitor,
+    size_t limit = std::numeric_limits<size_t>::max()) {
+    return ShardOf(key).search(key, std::forward<Visitor>(visitor), limit);
+  }
+
+  size_t count(const KeyT &key) { return ShardOf(key).count(key); }
+
+  bool insert(const KeyT &key, const ValueT &value) { return ShardOf(key).insert(key, value); }
+
+  bool remove(const KeyT &key, const ValueT &value) { return ShardOf(key).remove(key, value); }
+
+  // splits the batch by shard, then see MultiBPlusTree::insert_batch.
+  template <class InputIt>
+  size_t insert_batch(InputIt first, InputIt last);
+
+  // splits the batch by shard, then see MultiBPlusTree::remove_batch.
+  template <class InputIt>
+  size_t remove_batch(InputIt first, InputIt last);
+
+  /**
+   * @brief splits the sorted pairs by shard, keeping their order, and bulk loads every shard.
+   * @throw database_exception if the input is not sorted, before any shard is loaded,
+   *   or if a shard is not empty, in which case the shards before it are loaded.
+   */
+  template <class InputIt>
+  size_t bulk_load(InputIt first, InputIt last, double fill_factor = 1.0);
+
+  // cursor over all entries with key not less than lower.
+  Cursor lower_bound(const KeyT &lower);
+
+  // cursor over all entries with key in [lower, upper).
+  Cursor range(const KeyT &lower, const KeyT &upper);
+
+  // cursor over all entries whose key starts with prefix.
+  Cursor prefix_range(const KeyT &prefix)
+  requires requires(const KeyT &key, KeyT &bound) {
+    { key.prefix_successor(bound) } -> std::convertible_to<bool>;
+  };
+
+  // see MultiBPlusTree::defer_rebalance. Applies to every shard.
+  void defer_rebalance(size_t compact_after);
+
+  // compacts every shard. Returns the number of nodes merged away.
+  size_t compact();
+
+  // see MultiBPlusTree::enable_cache. The budget is split evenly among the shards.
+  void enable_cache(size_t byte_budget) requires requires(Tree &tree, size_t budget) { tree.enable_cache(budget); };
+
+  Stats stats(size_t shard) { return shards_[shard]->stats(); }
+
+private:
+  size_t ShardIndex(const KeyT &key) const;
+  Tree& ShardOf(const KeyT &key) { return *shards_[ShardIndex(key)]; }
+
+  // calls f(shard, batch) with the pairs of [first, last) falling into every shard that got any.
+  template <class InputIt, class F>
+  void SplitBatch(InputIt first, InputIt last, F &&f);
+
+  // a cursor merging make(shard) over every shard.
+  template <class F>
+  Cursor MergeCursors(F &&make);
+
+  TaskScheduler scheduler_; // outlives the pools sharing it.
+  vector<std::unique_ptr<Tree>> shards_;
+  KeyHash key_hash_;
+};
+
+}
+
+
+#include "sharded_bplustree.tcc"
+
+#endif
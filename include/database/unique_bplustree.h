@@ -0,0 +1,121 @@
+#ifndef INSOMNIA_UNIQUE_BPLUSTREE_H
+#define INSOMNIA_UNIQUE_BPLUSTREE_H
+
+#include "bpt_nodes.h"
+#include "bpt_tree_base.h"
+#include "buffer_pool.h"
+#include "exception.h"
+
+namespace insomnia {
+
+// the entries of BPlusTree: leaves hold (key, value) once, internal nodes hold the keys alone.
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+struct UniqueBptEntry {
+  // separators carry an empty value part, so that string keys can share the prefixed internal node.
+  struct Nothing {};
+  struct SepType {
+    KeyT key;
+    [[no_unique_address]] Nothing value;
+  };
+  struct SepCompare {
+    struct NothingCompare {
+      bool operator()(const Nothing&, const Nothing&) const { return false; }
+    };
+    KeyCompare key_compare;
+    NothingCompare value_compare;
+    bool operator()(const SepType &lhs, const SepType &rhs) const {
+      return key_compare(lhs.key, rhs.key);
+    }
+  };
+
+  static constexpr bool is_prefixed =
+    is_char_array_v<KeyT> && std::is_same_v<KeyCompare, std::less<KeyT>>;
+
+  using Leaf = BptLeafNode<KeyT, ValueT, std::conditional_t<is_prefixed, BptStrHead, void>>;
+  using TreeBase = BptTreeBase<SepType, SepCompare, Leaf, is_prefixed>;
+};
+
+/**
+ * @brief B+ tree mapping each key to one value.
+ * Compares keys only; internal nodes hold nothing but keys and child indices,
+ * and leaves hold (key, value) once. Descents, splits and merges are those of MultiBPlusTree, from BptTreeBase.
+ */
+template <Trivial KeyT, Trivial ValueT, class KeyCompare = std::less<KeyT>>
+class BPlusTree : private UniqueBptEntry<KeyT, ValueT, KeyCompare>::TreeBase {
+  using EntryTraits = UniqueBptEntry<KeyT, ValueT, KeyCompare>;
+  using TreeBase = typename EntryTraits::TreeBase;
+  using SepType = typename EntryTraits::SepType;
+
+  using typename TreeBase::index_t;
+  using TreeBase::nullpos;
+  using typename TreeBase::Base;
+  using typename TreeBase::Internal;
+  using typename TreeBase::Leaf;
+  using typename TreeBase::Reader;
+  using typename TreeBase::Writer;
+
+public:
+
+  BPlusTree(const std::filesystem::path &name,
+    size_t k_param, size_t buffer_capacity, size_t thread_num);
+  ~BPlusTree();
+
+  // copies the value of key into value. false if key is absent.
+  bool find(const KeyT &key, ValueT &value);
+
+  bool contains(const KeyT &key);
+
+  // false if key is already present.
+  bool insert(const KeyT &key, const ValueT &value);
+
+  // inserts, or overwrites the value of key. true if inserted.
+  bool insert_or_assign(const KeyT &key, const ValueT &value);
+
+  // overwrites the value of key in place. false if key is absent.
+  bool update(const KeyT &key, const ValueT &value);
+
+  // applies modifier to the value of key in place, under the leaf latch. false if key is absent.
+  template <class Modifier>
+  requires std::invocable<Modifier, ValueT&>
+  bool update(const KeyT &key, Modifier &&modifier);
+
+  // passes the value of key to visitor, under the leaf latch. false if key is absent.
+  template <class Visitor>
+  requires std::invocable<Visitor, const ValueT&>
+  bool visit(const KeyT &key, Visitor &&visitor);
+
+  bool remove(const KeyT &key);
+
+  // removes key if predicate holds for its value, under the leaf latch. false if nothing was removed.
+  template <class Predicate>
+  requires std::predicate<Predicate, const ValueT&>
+  bool remove_if(const KeyT &key, Predicate &&predicate);
+
+private:
+
+  using typename TreeBase::RootLock;
+
+  using TreeBase::SaveRoot;
+  using TreeBase::FindLeafOptim;
+  using TreeBase::FindLeafPessi;
+  using TreeBase::InsertPessi;
+  using TreeBase::RemovePessi;
+
+  using TreeBase::buffer_pool_;
+  using TreeBase::root_;
+  using TreeBase::height_;
+  using TreeBase::sep_compare_;
+  using TreeBase::root_latch_;
+
+  // the leaf that may contain key. Returns an empty Reader if the tree is empty.
+  Reader FindLeaf(const KeyT &key);
+
+  KeyCompare key_compare_;
+};
+
+}
+
+
+#include "unique_bplustree.tcc"
+
+#endif
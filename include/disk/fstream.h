@@ -42,6 +42,10 @@ public:
 
   index_t alloc() { return index_pool_.allocate(); }
   void dealloc(index_t index) { index_pool_.deallocate(index); }
+  void alloc_at(index_t index) { index_pool_.allocate_at(index); }
+  // indexes ever allocated, and those of them free for reuse.
+  index_t capacity() const { return index_pool_.size(); }
+  size_t free_count() const { return index_pool_.free_count(); }
   void write(index_t index, const T *data);
   void read(index_t index, T *data);
   void write_meta(const Meta *meta) requires (!std::is_same_v<Meta, monometa>);
@@ -49,6 +53,8 @@ public:
   // You can use it to see whether the db file is newly created.
   bool read_meta(Meta *meta) requires (!std::is_same_v<Meta, monometa>);
   void reserve(size_t file_size);
+  // hands the data written so far, and the allocated indexes, to the operating system.
+  void flush();
 
 private:
   bool is_open_locked() const { return basic_fstream_.is_open(); }
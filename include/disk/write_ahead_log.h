@@ -0,0 +1,89 @@
+#ifndef INSOMNIA_WRITE_AHEAD_LOG_H
+#define INSOMNIA_WRITE_AHEAD_LOG_H
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+#include "exception.h"
+#include "vector.h"
+
+namespace insomnia {
+
+/**
+ * @brief append-only redo log of page images, grouped into commits.
+ * Records are buffered by append and written out together by sync: one write and one flush
+ * for every group committed since the last sync.
+ * Every record carries a checksum, so a record torn by a crash ends the log.
+ * @warning sync flushes to the operating system, which survives a crash of the process, not of the machine.
+ */
+class WriteAheadLog {
+public:
+  enum class RecordType : uint32_t {
+    Page = 1,     // the image of page index, as written by group.
+    Restore,      // the committed image of page index. Not part of any group.
+    Meta,         // the file meta, as written by group.
+    Alloc,        // page index allocated by group.
+    Dealloc,      // page index deallocated by group.
+    Commit        // group is complete.
+  };
+  struct RecordHeader {
+    RecordType type;
+    uint32_t size;      // bytes of data following the header.
+    uint64_t group;
+    uint64_t index;
+    uint64_t checksum;  // of the data and the fields above.
+  };
+
+  explicit WriteAheadLog(const std::filesystem::path &file);
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  ~WriteAheadLog();
+
+  void append(RecordType type, uint64_t group, uint64_t index, const void *data = nullptr, uint32_t size = 0);
+  // writes out the records appended so far and flushes the file.
+  void sync();
+  // bytes written out since the last truncate.
+  size_t size() const;
+  // drops every record, once what they describe is safe in the data file.
+  void truncate();
+
+  /**
+   * @brief calls visitor(header, data) for every record of the log in order,
+   * skipping the records of groups that never committed. Restore records are always passed.
+   */
+  template <class Visitor>
+  void replay(Visitor &&visitor);
+
+private:
+  // reads the records written out before the log was opened, up to the first torn one.
+  vector<char> Load();
+  // the record at offset of log. false at its end, or if the record there is torn.
+  static bool Parse(vector<char> &log, size_t offset, RecordHeader &header);
+  static uint64_t Checksum(const RecordHeader &header, const char *data);
+
+  std::filesystem::path file_;
+  std::fstream fstream_;
+  mutable std::mutex latch_;
+  vector<char> buffer_;
+  size_t size_{0};
+};
+
+template <class Visitor>
+void WriteAheadLog::replay(Visitor &&visitor) {
+  vector<char> log = Load();
+  RecordHeader header;
+  // groups are committed in order, so the last commit tells every committed group.
+  uint64_t last_commit = 0;
+  for(size_t offset = 0; Parse(log, offset, header); offset += sizeof(RecordHeader) + header.size)
+    if(header.type == RecordType::Commit)
+      last_commit = header.group;
+  for(size_t offset = 0; Parse(log, offset, header); offset += sizeof(RecordHeader) + header.size)
+    if(header.type == RecordType::Restore || (header.type != RecordType::Commit && header.group <= last_commit))
+      visitor(static_cast<const RecordHeader&>(header),
+        static_cast<const char*>(log.data() + offset + sizeof(RecordHeader)));
+}
+
+}
+
+#endif
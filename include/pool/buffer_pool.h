@@ -1,17 +1,31 @@
 #ifndef INSOMNIA_BUFFER_POOL_H
 #define INSOMNIA_BUFFER_POOL_H
 
+#include <algorithm>
+#include <memory>
 #include <shared_mutex>
+#include <span>
+#include <thread>
 
 #include "fstream.h"
 #include "unordered_map.h"
 #include "index_pool.h"
 #include "lru_k_replacer.h"
+#include "page_table.h"
 #include "task_scheduler.h"
+#include "write_ahead_log.h"
 
 
 namespace insomnia {
 
+/**
+ * @brief how a buffer pool logs the writes made in its write scopes.
+ * off: not at all. Pages reach the disk when evicted or flushed, so a crash may leave any mix of old and new pages.
+ * async: write scopes are committed to the log in groups every few milliseconds. A crash loses the last groups only.
+ * sync: closing a write scope waits until its group is in the log.
+ */
+enum class LogMode { off, async, sync };
+
 template <class T, class Derived, size_t align>
 concept ReadableDerived =
       std::is_trivially_copyable_v<Derived> &&
@@ -34,6 +48,8 @@ public:
   using frame_id_t = IndexPool::index_t;
   class Writer;
   class Reader;
+  class WriteScope;
+  class Snapshot;
 
 private:
 
@@ -52,17 +68,25 @@ private:
     alignas(PAGE_SIZE) AlignedPage page_;
 
     const frame_id_t frame_id_;
+    const frame_id_t slot_id_; // the index of the frame in the replacer of its shard.
     std::atomic<size_t> pin_count_{0};
     bool is_dirty_{false};
     bool is_valid_{false};
+    bool is_loading_{false}; // under I/O by the thread that fetched it. guarded by the shard latch.
+    bool is_cleaning_{false}; // pinned by a background write-back. guarded by the shard latch.
 
     alignas(64) std::shared_mutex page_latch_; // false sharing stuff..
     size_t page_id_;
+    std::atomic<uint64_t> version_{0}; // epoch of the last scope to write it. 0 if older than every snapshot.
+    uint64_t log_group_{0}; // group of the last Writer on it, if logged. guarded by the shard latch.
 
   public:
-    explicit Frame(frame_id_t frame_id) : frame_id_(frame_id) {}
-    Frame(Frame &&other) : frame_id_(other.frame_id_), pin_count_(other.pin_count_.load()),
-        is_dirty_(other.is_dirty_), is_valid_(other.is_valid_), page_id_(other.page_id_) {
+    Frame(frame_id_t frame_id, frame_id_t slot_id) : frame_id_(frame_id), slot_id_(slot_id) {}
+    Frame(Frame &&other) : frame_id_(other.frame_id_), slot_id_(other.slot_id_), pin_count_(other.pin_count_.load()),
+        is_dirty_(other.is_dirty_), is_valid_(other.is_valid_), is_loading_(other.is_loading_),
+        is_cleaning_(other.is_cleaning_),
+        page_id_(other.page_id_),
+        version_(other.version_.load()), log_group_(other.log_group_) {
       other.pin_count_.store(0);
       other.is_dirty_ = false;
       other.is_valid_ = false;
@@ -74,17 +98,31 @@ private:
       pin_count_.store(0);
       is_valid_ = false;
       is_dirty_ = false;
+      log_group_ = 0;
     }
   };
 
+  // a page as it was before a write, kept for the snapshots that still see it.
+  struct Version {
+    uint64_t end_; // the epoch of the scope that overwrote it.
+    char data_[PAGE_SIZE];
+  };
+  // the same for the meta.
+  struct MetaVersion {
+    uint64_t end_;
+    bool has_meta_;
+    Meta meta_;
+  };
+
 public:
   class Writer {
+    friend BufferPool;
   public:
     Writer() = default;
     explicit Writer(
       page_id_t page_id, Frame *frame, LruKReplacer *replacer,
       std::mutex *bp_latch, TaskScheduler *scheduler, fstream<AlignedPage, Meta> *fstream,
-      std::condition_variable *replacer_cv, std::unique_lock<std::mutex> lock);
+      std::condition_variable *replacer_cv, std::unique_lock<std::mutex> lock, bool is_logged = false);
     Writer(const Writer&) = delete;
     Writer& operator=(const Writer&) = delete;
     Writer(Writer &&other) noexcept;
@@ -93,14 +131,25 @@ public:
 
     page_id_t id() const { return page_id_; }
     char* data() {
+      // the old content is saved for the snapshots that still see it before anything is written.
+      if(!is_touched_) {
+        is_touched_ = true;
+        pool_->PreserveVersion(page_id_, *frame_);
+      }
       frame_->is_dirty_ = true;
       return frame_->data();
     }
+    const char* data() const { return frame_->data(); }
     template <class Derived = T>
     Derived* as() requires ReadableDerived<T, Derived, align> {
       // is_dirty_ = true; set in data().
       return reinterpret_cast<Derived*>(data());
     }
+    // a look at the page that writes nothing: it neither dirties the page nor makes snapshots keep a copy.
+    template <class Derived = T>
+    const Derived* as() const requires ReadableDerived<T, Derived, align> {
+      return reinterpret_cast<const Derived*>(frame_->data());
+    }
     template <class Derived = T>
     void write(const Derived *data) requires ReadableDerived<T, Derived, align> {
       write_impl(data, sizeof(Derived));
@@ -119,6 +168,7 @@ public:
     }
     bool is_dirty() const { return frame_->is_dirty_; }
     bool is_valid() const { return is_valid_; }
+    // writes the page back now. Does nothing if the pool is logged: pages go out after their log records.
     void flush();
     void drop();
 
@@ -130,7 +180,10 @@ public:
     TaskScheduler *scheduler_;
     fstream<AlignedPage, Meta> *fstream_;
     std::condition_variable *replacer_cv_;
+    BufferPool *pool_{nullptr};
     bool is_valid_{false};
+    bool is_logged_{false};
+    bool is_touched_{false}; // data() called: the page is being written.
 
     void write_impl(const void *ptr, size_t size) {
       // is_dirty_ = true; set in data().
@@ -146,7 +199,7 @@ public:
     explicit Reader(
       page_id_t page_id, Frame *frame, LruKReplacer *replacer,
       std::mutex *bp_latch, TaskScheduler *scheduler, fstream<AlignedPage, Meta> *fstream,
-      std::condition_variable *replacer_cv, std::unique_lock<std::mutex> lock);
+      std::condition_variable *replacer_cv, std::unique_lock<std::mutex> lock, bool is_logged = false);
     Reader(const Reader&) = delete;
     Reader& operator=(const Reader&) = delete;
     Reader(Reader &&other) noexcept;
@@ -169,6 +222,7 @@ public:
     }
     bool is_dirty() const { return frame_->is_dirty_; }
     bool is_valid() const { return is_valid_; }
+    // writes the page back now. Does nothing if the pool is logged: pages go out after their log records.
     void flush();
     void drop();
 
@@ -181,58 +235,306 @@ public:
     fstream<AlignedPage, Meta> *fstream_;
     std::condition_variable *replacer_cv_;
     bool is_valid_{false};
+    bool is_logged_{false};
 
     void read_impl(void *ptr, size_t size) const {
       memcpy(ptr, data(), size);
     }
   };
 
-  BufferPool(const std::string &file_prefix, size_t k_param, size_t frame_num, size_t thread_num);
+  /**
+   * @brief an open write operation. A snapshot sees the scopes opened before it in whole and none opened after it,
+   * so it never sees an operation half done. The log commits its groups when no scope is open.
+   * A scope opened inside another scope on the same pool by the same thread does nothing.
+   */
+  class WriteScope {
+    friend BufferPool;
+  public:
+    WriteScope() = default;
+    WriteScope(const WriteScope&) = delete;
+    WriteScope& operator=(const WriteScope&) = delete;
+    WriteScope(WriteScope &&other) noexcept;
+    WriteScope& operator=(WriteScope &&other) noexcept;
+    ~WriteScope() { release(); }
+
+    void release();
+
+  private:
+    WriteScope(BufferPool *pool, size_t writes, uint64_t epoch) : pool_(pool), writes_(writes), epoch_(epoch) {}
+    BufferPool *pool_{nullptr};
+    size_t writes_{0}; // Writers taken by the thread before the scope opened.
+    uint64_t epoch_{0};
+  };
+
+  /**
+   * @brief a consistent, read-only version of every page and the meta, as of the write scopes opened before it.
+   * Reads copy the page out and never wait for page latches: while a snapshot lives,
+   * a later scope saves the old content of a page for it when it first writes to the page.
+   * @warning release snapshots before the buffer pool deconstructs. Pages are kept in memory until then.
+   */
+  class Snapshot {
+    friend BufferPool;
+  public:
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot& operator=(Snapshot &&other) noexcept;
+    ~Snapshot() { release(); }
+
+    bool is_valid() const { return pool_ != nullptr; }
+    // copies align bytes of the page as of the snapshot into data.
+    void read(page_id_t page_id, char *data) const { pool_->ReadVersion(page_id, epoch_, data); }
+    bool read_meta(Meta *meta) const requires (!std::is_same_v<Meta, monometa>) {
+      return pool_->ReadMetaVersion(epoch_, meta);
+    }
+    void release();
+
+  private:
+    Snapshot(BufferPool *pool, uint64_t epoch) : pool_(pool), epoch_(epoch) {}
+    BufferPool *pool_{nullptr};
+    uint64_t epoch_{0};
+  };
+
+  /**
+   * @brief opens the pool over file_prefix.dat. A log left in file_prefix.wal by a crash is replayed first,
+   * whatever log_mode is.
+   */
+  BufferPool(const std::string &file_prefix, size_t k_param, size_t frame_num, size_t thread_num,
+    LogMode log_mode = LogMode::off);
+  // disk I/O goes to scheduler, shared with other pools. It should outlive the pool.
+  BufferPool(const std::string &file_prefix, size_t k_param, size_t frame_num, TaskScheduler &scheduler,
+    LogMode log_mode = LogMode::off);
   BufferPool(const BufferPool&) = delete;
   BufferPool(BufferPool&&) = delete;
   BufferPool& operator=(const BufferPool&) = delete;
   BufferPool& operator=(BufferPool&&) = delete;
-  ~BufferPool() { flush_all(); }
+  ~BufferPool();
   size_t frame_capacity() const { return frame_num_; }
-  page_id_t alloc() { return fstream_.alloc(); }
+  page_id_t alloc();
+  // pages ever allocated, and those of them free for reuse.
+  page_id_t page_capacity() const { return fstream_.capacity(); }
+  size_t free_pages() const { return fstream_.free_count(); }
   // fails if this page is still in use by writer/reader.
   bool dealloc(page_id_t page_id);
   Writer get_writer(page_id_t page_id);
   Reader get_reader(page_id_t page_id);
+  /**
+   * @brief starts reading the page into a frame on the scheduler, so that a get_reader/get_writer soon after
+   * finds it there. Never blocks and pins nothing: a page already present, or a shard with neither a free frame
+   * nor a clean victim to spare, is skipped. Threads asking for the page meanwhile wait for the read.
+   */
+  void prefetch(page_id_t page_id);
+  void prefetch(std::span<const page_id_t> page_ids) {
+    for(page_id_t page_id : page_ids)
+      prefetch(page_id);
+  }
+  // Writers that may race with snapshot() should be taken inside a write scope.
+  WriteScope write_scope();
+  /**
+   * @brief takes a snapshot, once the write scopes open now have closed. Scopes opened meanwhile go on.
+   * Should one of those write a page before an older scope writes it again, the two can't be told apart on the page:
+   * the snapshot is then taken again, holding new scopes back until the open ones close.
+   */
+  Snapshot snapshot();
   // void flush(frame_id_t frame_id);
+  // writes every dirty page back. If the pool is logged, commits the open group first and truncates the log.
   void flush_all();
-  bool read_meta(Meta *meta) requires (!std::is_same_v<Meta, monometa>) {
-    return fstream_.read_meta(meta);
-  }
-  void write_meta(const Meta *meta) requires (!std::is_same_v<Meta, monometa>) {
-    fstream_.write_meta(meta);
-  }
+  /**
+   * @brief keeps about frame_count of the coldest evictable frames clean, so that a miss costs a read, not a write
+   * and a read. Whenever a miss has to write back a dirty victim, the coldest dirty frames of its shard are written
+   * back on the scheduler in the background. Pages written by a group not yet in the log are left to their eviction.
+   * 0 turns it off. Defaults to frame_capacity() / 16.
+   * @warning not to be called while other threads use the pool.
+   */
+  void set_clean_reserve(size_t frame_count) { clean_reserve_ = frame_count; }
+  bool read_meta(Meta *meta) requires (!std::is_same_v<Meta, monometa>);
+  // if the pool is logged, the meta is committed with the writes of the open group
+  // and reaches the file at the next checkpoint. Call it inside a write scope.
+  void write_meta(const Meta *meta) requires (!std::is_same_v<Meta, monometa>);
 
   /*
   // if page not in buffer, returns SIZE_MAX.
   size_t get_pin_count(page_id_t page_id) {
-    std::unique_lock lock(bp_latch_);
-    if (auto it = page_map_.find(page_id); it == page_map_.end())
+    Shard &shard = ShardOf(page_id);
+    std::unique_lock lock(shard.latch);
+    if (frame_id_t frame_id = shard.page_map.find(page_id); frame_id == PageTable::npos)
       return SIZE_MAX;
     else
-      return frames_[it->second].pin_count_.load();
+      return frames_[frame_id].pin_count_.load();
   }
   */
 
 private:
-  alignas(64) std::mutex bp_latch_;
-  alignas(64) std::condition_variable replacer_cv_;
-  unordered_map<page_id_t, frame_id_t> page_map_;
+  /**
+   * @brief a partition of the frames and the page table: pages go to shard page_id % shard count,
+   * and frame i serves shard i % shard count, as slot i / shard count of its replacer.
+   * Hits and misses on different shards never share a latch.
+   */
+  struct Shard {
+    // a frame maps its victim too while writing it back: the page table holds two pages per frame.
+    Shard(size_t index, size_t k_param, size_t shard_frames)
+      : index(index), page_map(shard_frames * 2), replacer(k_param, shard_frames) {}
+
+    const size_t index;
+    alignas(64) std::mutex latch;
+    std::condition_variable replacer_cv;
+    std::condition_variable load_cv;    // frames done loading, with latch.
+    PageTable page_map;
+    LruKReplacer replacer;
+    vector<frame_id_t> free_frames;
+    size_t write_backs{0};              // victims being written back outside latch.
+    size_t cleanings{0};                // background write-backs in flight.
+    size_t prefetches{0};               // background reads in flight.
+    // guards versions. Writers take it only to save a version.
+    alignas(64) std::shared_mutex version_latch;
+    unordered_map<page_id_t, vector<Version>> versions; // in the order they were overwritten.
+    // (end_, page) of every version in versions, as a min-heap: a release trims only the pages it frees.
+    vector<std::pair<uint64_t, page_id_t>> version_queue;
+    // Frame::version_ of pages evicted while snapshots were around. guarded by latch.
+    unordered_map<page_id_t, uint64_t> stamps;
+    // (stamp, page) of the stamps kept, as a min-heap. guarded by latch.
+    // Stamps taken back since linger until they are stale, or until it is rebuilt.
+    vector<std::pair<uint64_t, page_id_t>> stamp_queue;
+  };
+
+  // a shard gets at least this many frames: Writers pin whole paths, and a small shard would run out.
+  static constexpr size_t SHARD_FRAMES = 256;
+  static constexpr size_t MAX_SHARDS = 16;
+  // the log is checkpointed once it grows past this.
+  static constexpr size_t CHECKPOINT_BYTES = 64 << 20;
+  // how long the log writer lets writes gather before it commits them in async mode.
+  static constexpr std::chrono::milliseconds COMMIT_INTERVAL{5};
+
+  void InitFrames();
+  Shard& ShardOf(page_id_t page_id) { return *shards_[page_id % shards_.size()]; }
+  Shard& ShardOfFrame(frame_id_t frame_id) { return *shards_[frame_id % shards_.size()]; }
+  // the frame in a slot of the replacer of shard.
+  frame_id_t FrameOfSlot(const Shard &shard, frame_id_t slot_id) const {
+    return slot_id * shards_.size() + shard.index;
+  }
+  // the latches of every shard, in order.
+  vector<std::unique_lock<std::mutex>> LockShards();
+  // replays the log left by a crash, then opens the log if log_mode asks for one.
+  void InitLog(const std::string &file_prefix, LogMode log_mode);
+  // leaves every write scope out while f runs.
+  template <class F>
+  void Quiesce(F &&f);
+  // commits the open group, if it wrote anything, and checkpoints if the log has grown too long.
+  void Commit();
+  // writes every dirty page and the meta back, then truncates the log.
+  void Checkpoint();
+  // appends the records of the open group and its commit, then opens the next one.
+  // Returns the group closed. Every shard latch should be held and no write scope open.
+  uint64_t CaptureGroup();
+  // writes the appended records out. Closed groups up to group become durable.
+  void SyncLog(uint64_t group);
+  // waits until group is durable, asking the log writer to commit it.
+  void WaitDurable(uint64_t group);
+  // the group the dirty page in frame should be logged under before it is written back, 0 if the log has it already.
+  // An open group is held open until LogEviction appends the page. The shard latch should be held.
+  uint64_t HoldEviction(const Frame &frame);
+  // makes the log safe for writing back the evicted page, data, of a group HoldEviction returned.
+  // Called with no shard latch held, so its disk I/O stalls nobody else.
+  void LogEviction(page_id_t page_id, uint64_t group, const char *data);
+  void MarkLogged(page_id_t page_id);
+  bool IsLogged(page_id_t page_id) const {
+    return page_id < is_logged_page_.size() && is_logged_page_[page_id];
+  }
+  // the body of log_writer_.
+  void LogWriter();
+  void CloseScope(size_t writes, uint64_t epoch);
+  /**
+   * @brief finds the frame of the page, loading it if absent. The latch of shard should be held by lock.
+   * The latch is released while the victim is logged and written back and the page read in; the frame is marked
+   * loading meanwhile, and threads asking for either page wait on load_cv. Returns with the latch held again.
+   */
+  frame_id_t FetchFrame(Shard &shard, page_id_t page_id, std::unique_lock<std::mutex> &lock);
+  // pins the coldest dirty frames of shard and schedules their write-back. The shard latch should be held.
+  void ScheduleCleaning(Shard &shard);
+  // the background write-back of a frame pinned by ScheduleCleaning. Never waits for a page latch.
+  void CleanFrame(Shard &shard, frame_id_t frame_id);
+  // the background read of a frame mapped and marked loading by prefetch.
+  void PrefetchFrame(Shard &shard, frame_id_t frame_id);
+  // the epoch of the write scope this thread has open on the pool, or the current one.
+  uint64_t ScopeEpoch() const;
+  // whether a snapshot sees content written at epoch stamp, but not what a scope at epoch writes over it.
+  bool NeedsVersion(uint64_t stamp, uint64_t epoch);
+  // a scope at epoch writes over what a later one wrote: the pending snapshots in between can't be taken.
+  void BreakSnapshots(uint64_t epoch, uint64_t stamp);
+  // called with the page latched by a Writer about to write it, or under the shard latch before it is deallocated.
+  void PreserveVersion(page_id_t page_id, Frame &frame);
+  // Frame::version_ for a page being loaded into a frame. The shard latch should be held.
+  uint64_t TakeStamp(Shard &shard, page_id_t page_id);
+  // keeps Frame::version_ of a page being evicted. The shard latch should be held.
+  void KeepStamp(Shard &shard, const Frame &frame);
+  // the saved version of the page a snapshot at epoch should see. The shard version_latch should be held.
+  const Version* FindVersion(Shard &shard, page_id_t page_id, uint64_t epoch);
+  void ReadVersion(page_id_t page_id, uint64_t epoch, char *data);
+  bool ReadMetaVersion(uint64_t epoch, Meta *meta) requires (!std::is_same_v<Meta, monometa>);
+  // the next epoch, with a snapshot at it. gate_latch_ should be held.
+  uint64_t OpenSnapshot();
+  void ReleaseSnapshot(uint64_t epoch);
 
   const size_t frame_num_;
-  LruKReplacer replacer_;
-  TaskScheduler scheduler_;
+  const size_t k_param_;
+  size_t clean_reserve_;
+  vector<std::unique_ptr<Shard>> shards_;
+  std::unique_ptr<TaskScheduler> own_scheduler_; // null if the scheduler is shared.
+  TaskScheduler *scheduler_;
   // disk::IndexPool page_id_pool_; Duplicated with the pool in fstream_.
   static_assert(std::is_same_v<page_id_t, IndexPool::index_t>);
   fstream<AlignedPage, Meta> fstream_;
 
   vector<Frame> frames_;
-  vector<frame_id_t> free_frames_;
+
+  // snapshot() waits for the write scopes opened before it to close. New ones wait only while a snapshot
+  // is taken again, or while the log commits a group.
+  std::mutex gate_latch_;
+  std::condition_variable gate_cv_;
+  size_t active_writes_{0};
+  vector<std::pair<uint64_t, size_t>> open_epochs_; // open scopes by epoch, oldest first.
+  bool snapshot_pending_{false};
+  bool quiesce_pending_{false};
+  // pools with a write scope open in this thread and the epochs of the scopes, and the Writers the thread has taken.
+  static inline thread_local vector<std::pair<const BufferPool*, uint64_t>> open_scopes_;
+  static inline thread_local size_t writes_{0};
+
+  // the redo log, null if off. Groups are numbered from 1 and committed in order:
+  // a group holds the writes of the scopes that closed since the previous commit.
+  // Pages written by an open group are still evicted, after a Restore record of their committed image.
+  // guarded by log_latch_, except log_ itself and durable_group_. open_group_ changes with every shard latch
+  // held as well, so any shard latch is enough to read it.
+  std::mutex log_latch_;
+  std::unique_ptr<WriteAheadLog> log_;
+  LogMode log_mode_{LogMode::off};
+  uint64_t open_group_{1};
+  vector<frame_id_t> logged_frames_;               // frames taken by a Writer in the open group.
+  vector<std::pair<page_id_t, bool>> page_events_; // pages allocated (true) or deallocated by the open group.
+  std::unique_ptr<Meta> meta_;                     // the meta last written, if logged.
+  bool is_meta_dirty_{false};                      // meta_ written by the open group.
+  vector<uint8_t> is_logged_page_;                 // by page id: the log holds a committed image of the page.
+  size_t held_evictions_{0};                       // victims of the open group not yet appended by LogEviction.
+  std::condition_variable eviction_cv_;            // held_evictions_ dropped to 0.
+  std::mutex durable_latch_;
+  std::condition_variable durable_cv_;
+  std::atomic<uint64_t> durable_group_{0};
+  bool is_commit_requested_{false};                // guarded by durable_latch_, like is_closing_.
+  bool is_closing_{false};
+  std::thread log_writer_;
+
+  // a scope takes the epoch current when it opens, and a snapshot the next one: it sees the scopes before it.
+  // epoch_ changes under gate_latch_ as well.
+  std::atomic<uint64_t> epoch_{1};
+  std::atomic<uint64_t> newest_snapshot_{0}; // 0 if there is none.
+  // guards the fields below. Writers take it shared, and only while snapshots are around.
+  alignas(64) std::shared_mutex snapshot_latch_;
+  vector<uint64_t> snapshots_;        // epochs of the live and pending snapshots.
+  vector<uint64_t> broken_snapshots_; // pending ones that must be taken again.
+  // the versions of the meta, and the epoch of its last write. guarded by meta_version_latch_.
+  std::mutex meta_version_latch_;
+  uint64_t meta_version_{0};
+  vector<MetaVersion> meta_versions_;
 
 };
 
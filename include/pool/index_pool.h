@@ -28,12 +28,23 @@ public:
   }
   index_t allocate();
   void deallocate(index_t index);
+  // takes index out of the free ones, as replayed from a log. Indexes skipped on the way become free.
+  void allocate_at(index_t index);
+  // writes the free indexes out, keeping the file open.
+  void flush();
   index_t size() const {
     std::unique_lock lock(latch_);
     return capacity_;
   }
+  // indexes deallocated and waiting for reuse.
+  size_t free_count() const {
+    std::unique_lock lock(latch_);
+    return unallocated_.size();
+  }
 
 private:
+  void flush_locked();
+
   std::fstream pool_;
   index_t capacity_{0}; // 0 reserved for nullptr
   vector<index_t> unallocated_; // alignas(64) useful?
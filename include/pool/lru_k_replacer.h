@@ -4,7 +4,7 @@
 #include <mutex>
 
 #include "index_pool.h"
-#include "unordered_map.h"
+#include "vector.h"
 
 namespace insomnia {
 
@@ -15,8 +15,10 @@ public:
   static constexpr timestamp_t TIME_T_MAX = SIZE_MAX;
 
 public:
+  // tracks frames 0 to capacity - 1.
   LruKReplacer(size_t k, size_t capacity)
-    : k_(k), capacity_(capacity), npos(capacity) {}
+    : npos(capacity), k_(k), capacity_(capacity),
+      slots_(capacity), history_(capacity * k), heap_pos_(capacity) {}
 
 
   /**
@@ -31,7 +33,17 @@ public:
    * @return whether the remove succeeds.
    */
   bool remove(index_t index);
+  /**
+   * @brief the evictable frames evict() would pick next, at most count of them, in eviction order.
+   * Nothing is evicted.
+   */
+  vector<index_t> coldest(size_t count);
   void access(index_t index); // initially non-evictable
+  /**
+   * @brief tracks a frame read ahead of its use: evictable, and ranked with the frames accessed once,
+   * as if accessed now. No access is counted, so the first real one does not heat it.
+   */
+  void admit(index_t index);
   void unpin(index_t index);
   void pin(index_t index);
   size_t evictable_cnt() const { return size_; }
@@ -41,55 +53,35 @@ public:
 
 private:
   enum class SlotStat { Invalid, Obscure, Hotspot };
-  class Slot {
-  private:
-    size_t k_;
-    timestamp_t *history;
-    size_t access_num{0};
-
-  public:
+  // the accesses of a frame live in history_[index * k_, (index + 1) * k_), as a ring of the last k.
+  struct Slot {
+    SlotStat stat{SlotStat::Invalid};
     bool evictable{false};
-
-    explicit Slot(size_t k) : k_(k) { history = new timestamp_t[k]; }
-    Slot(Slot &&other) : k_(other.k_) {
-      history = other.history;
-      access_num = other.access_num;
-      evictable = other.evictable;
-      other.history = nullptr;
-    }
-    Slot& operator=(Slot &&other) {
-      if(this == &other) return *this;
-      delete[] history;
-      k_ = other.k_;
-      history = other.history;
-      access_num = other.access_num;
-      evictable = other.evictable;
-      other.history = nullptr;
-      return *this;
-    }
-    ~Slot() { delete[] history; }
-    void clear() {
-      access_num = 0;
-      evictable = false;
-    }
-    size_t k_dist() const {
-      if(heated())
-        return history[access_num % k_];
-      return history[0];
-    }
-    void access(timestamp_t timestamp) {
-      history[(access_num++) % k_] = timestamp;
-    }
-    bool heated() const {
-      return access_num >= k_;
-    }
+    size_t access_num{0};
   };
+  // evictable frames of one list as a binary min-heap on k-distance. heap_pos_ finds a frame in its heap.
+  using Heap = vector<index_t>;
+
+  // the k-th last access of a heated frame, the first access of the others.
+  timestamp_t k_dist(index_t index) const {
+    if(slots_[index].access_num >= k_)
+      return history_[index * k_ + slots_[index].access_num % k_];
+    return history_[index * k_];
+  }
+  Heap& HeapOf(index_t index) { return slots_[index].stat == SlotStat::Hotspot ? hotspot_heap_ : obscure_heap_; }
+  void Push(Heap &heap, index_t index);
+  void Erase(Heap &heap, index_t index);
+  // moves the frame at pos up or down the heap until its k-distance is in order again.
+  void Fix(Heap &heap, size_t pos);
 
   const size_t k_, capacity_;
-  unordered_map<index_t, Slot> hotspot_list_, obscure_list_;
+  vector<Slot> slots_;
+  vector<timestamp_t> history_;
+  vector<size_t> heap_pos_;
+  Heap hotspot_heap_, obscure_heap_;
   size_t size_{0};
   timestamp_t timestamp_{0};
-  std::mutex hotspot_latch_, obscure_latch_;
+  std::mutex latch_;
 };
 
 }
@@ -0,0 +1,66 @@
+#ifndef INSOMNIA_PAGE_TABLE_H
+#define INSOMNIA_PAGE_TABLE_H
+
+#include <cstdint>
+
+#include "index_pool.h"
+#include "vector.h"
+
+namespace insomnia {
+
+/**
+ * @brief the page to frame map of a buffer pool: open addressing with linear probing in one flat array,
+ * allocated once for a fixed number of pages and never grown. A lookup is a hash and a probe of adjacent slots,
+ * usually in one cache line. Erasure shifts the rest of the cluster back, so no tombstones pile up under churn.
+ * Not thread-safe; the pool guards it with its shard latch.
+ */
+class PageTable {
+public:
+  using page_id_t = IndexPool::index_t;
+  using frame_id_t = IndexPool::index_t;
+  static constexpr frame_id_t npos = SIZE_MAX;
+
+  // room for capacity pages, at most half full.
+  explicit PageTable(size_t capacity);
+
+  // the frame of the page, or npos.
+  frame_id_t find(page_id_t page_id) const {
+    for(size_t pos = Home(page_id); slots_[pos].page_id != EMPTY; pos = (pos + 1) & mask_)
+      if(slots_[pos].page_id == page_id)
+        return slots_[pos].frame_id;
+    return npos;
+  }
+  bool contains(page_id_t page_id) const { return find(page_id) != npos; }
+  /**
+   * @brief maps the page, which should not be mapped yet, to the frame.
+   * @throw pool_overflow if capacity pages are mapped already.
+   */
+  void insert(page_id_t page_id, frame_id_t frame_id);
+  // returns whether the page was mapped.
+  bool erase(page_id_t page_id);
+  size_t size() const { return size_; }
+
+private:
+  // nullpos is never a page of the pool, so it marks the empty slots.
+  static constexpr page_id_t EMPTY = IndexPool::nullpos;
+
+  struct Slot {
+    page_id_t page_id{EMPTY};
+    frame_id_t frame_id{npos};
+  };
+
+  // page ids of a shard are sequential or strided: a multiplicative hash spreads them over the table.
+  size_t Home(page_id_t page_id) const {
+    return (static_cast<uint64_t>(page_id) * 0x9e3779b97f4a7c15ull) >> shift_;
+  }
+
+  vector<Slot> slots_;
+  size_t mask_;
+  int shift_;
+  size_t capacity_;
+  size_t size_{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef INSOMNIA_ALGORITHM_H
+#define INSOMNIA_ALGORITHM_H
+
+#include <functional>
+#include <utility>
+
+namespace insomnia {
+
+/**
+ * @brief unstable in-place sort on [first, last).
+ * Quicksort with median-of-three pivots, insertion sort on short ranges,
+ * and heapsort once the recursion goes too deep. O(n log n) in the worst case.
+ */
+template <class T, class Compare = std::less<T>>
+void sort(T *first, T *last, const Compare &compare = Compare());
+
+}
+
+#include "algorithm.tcc"
+
+#endif
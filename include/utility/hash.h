@@ -0,0 +1,29 @@
+#ifndef INSOMNIA_HASH_H
+#define INSOMNIA_HASH_H
+
+#include <string_view>
+
+namespace insomnia {
+
+// FNV-1a.
+unsigned long hash1(std::string_view str);
+// DJB2.
+unsigned long hash2(std::string_view str);
+
+// two independent hashes of a string. Ordered by h1, then h2.
+struct hash_pair {
+  unsigned long h1, h2;
+
+  hash_pair() = default;
+  hash_pair(std::string_view str) : h1(hash1(str)), h2(hash2(str)) {}
+
+  bool operator==(const hash_pair &other) const { return h1 == other.h1 && h2 == other.h2; }
+  bool operator<(const hash_pair &other) const {
+    if(h1 != other.h1) return h1 < other.h1;
+    return h2 < other.h2;
+  }
+};
+
+}
+
+#endif
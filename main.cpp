@@ -3,22 +3,6 @@
 #include "array.h"
 #include "bplustree.h"
 
-unsigned long hash1(const std::string &str) {
-  unsigned long hash = 2166136261;
-  for(const auto &c : str) {
-    hash ^= c;
-    hash *= 16777619;
-  }
-  return hash;
-}
-
-unsigned long hash2(const std::string &str) {
-  unsigned long hash = 5371;
-  for(const auto &c : str)
-    hash = (hash << 5) + hash + c;
-  return hash;
-}
-
 void print_list(insomnia::vector<int> &&list) {
   if(list.empty())
     std::cout << "null" << std::endl;
@@ -29,14 +13,25 @@ void print_list(insomnia::vector<int> &&list) {
   }
 }
 
-struct hash_pair {
-  unsigned long h1, h2;
-  hash_pair(const std::string &str) : h1(hash1(str)), h2(hash2(str)) {}
-  bool operator<(const hash_pair &other) const {
-    if(h1 != other.h1) return h1 < other.h1;
-    return h2 < other.h2;
-  }
-};
+template <class Stats>
+void print_stats(const Stats &stats) {
+  std::cout << "height " << stats.height << std::endl;
+  std::cout << "pages per level";
+  for(size_t pages : stats.level_pages)
+    std::cout << ' ' << pages;
+  std::cout << std::endl;
+  std::cout << "entries " << stats.entries << std::endl;
+  std::cout << "leaf fill (tenths)";
+  for(size_t count : stats.fill_histogram)
+    std::cout << ' ' << count;
+  std::cout << std::endl;
+  std::cout << "underfull nodes " << stats.underfull_nodes << std::endl;
+  std::cout << "contiguous leaf links " << stats.contiguous_links << std::endl;
+  std::cout << "pages " << stats.page_capacity << ", free " << stats.free_pages << std::endl;
+  std::cout << "search cache " << stats.cache_bytes << " bytes, "
+    << stats.cache_hits << " hits, " << stats.cache_misses << " misses" << std::endl;
+  std::cout << (stats.error.empty() ? "structure ok" : "structure broken: " + stats.error) << std::endl;
+}
 
 void BptTest() {
   using index_t = insomnia::array<char, 64>;
@@ -51,26 +46,45 @@ void BptTest() {
   int buffer_cap = 2048;
   int thread_num = 1;
   MulBpt_t mul_bpt(name_base, k_param, buffer_cap, thread_num);
+  // keys are often looked up again before they change.
+  mul_bpt.enable_cache(4 << 20);
 
   // freopen("temp/input.txt", "r", stdin);
   // freopen("temp/output.txt", "w", stdout);
 
+  // runs of inserts (or of removes) commute, so they are applied as one batch.
+  insomnia::vector<std::pair<index_t, value_t>> pending;
+  char pending_opt = '\0';
+  auto flush_pending = [&] {
+    if(pending_opt == 'i')
+      mul_bpt.insert_batch(pending.begin(), pending.end());
+    else if(pending_opt == 'd')
+      mul_bpt.remove_batch(pending.begin(), pending.end());
+    pending.clear();
+    pending_opt = '\0';
+  };
+
   int optcnt, value;
   std::string opt, index;
   std::cin >> optcnt;
   for(int i = 1; i <= optcnt; ++i) {
     std::cin >> opt;
-    if(opt[0] == 'i') {
+    if(opt[0] == 'i' || opt[0] == 'd') {
       std::cin >> index >> value;
-      mul_bpt.insert(index, value);
+      if(pending_opt != opt[0])
+        flush_pending();
+      pending_opt = opt[0];
+      pending.push_back({index, value});
     } else if(opt[0] == 'f') {
       std::cin >> index;
+      flush_pending();
       print_list(mul_bpt.search(index));
-    } else if(opt[0] == 'd') {
-      std::cin >> index >> value;
-      mul_bpt.remove(index, value);
+    } else if(opt == "stats") {
+      flush_pending();
+      print_stats(mul_bpt.stats());
     }
   }
+  flush_pending();
   // system("diff -bB temp/output.txt temp/answer.txt");
 }
 
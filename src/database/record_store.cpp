@@ -0,0 +1,264 @@
+#include "record_store.h"
+
+namespace insomnia {
+
+static_assert(sizeof(RID) == 16);
+
+RecordStore::RecordStore(const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, size_t thread_num)
+    : buffer_pool_(name, k_param, buffer_capacity, thread_num) {
+  LoadMeta();
+}
+
+RecordStore::RecordStore(const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, TaskScheduler &scheduler)
+    : buffer_pool_(name, k_param, buffer_capacity, scheduler) {
+  LoadMeta();
+}
+
+void RecordStore::LoadMeta() {
+  static_assert(sizeof(HeapPage) == PAGE_SIZE);
+  static_assert(sizeof(OverflowPage) == PAGE_SIZE);
+  StoreMeta meta;
+  if(buffer_pool_.read_meta(&meta)) {
+    tail_index_ = meta.tail_index;
+    for(int i = 0; i < meta.hint_count; ++i)
+      hints_.push_back(meta.hints[i]);
+  }
+}
+
+RecordStore::~RecordStore() {
+  StoreMeta meta;
+  meta.tail_index = tail_index_;
+  meta.hint_count = static_cast<int>(hints_.size());
+  for(int i = 0; i < meta.hint_count; ++i)
+    meta.hints[i] = hints_[i];
+  buffer_pool_.write_meta(&meta);
+}
+
+RID RecordStore::insert(const void *data, size_t size) {
+  if(size > MAX_RECORD_SIZE)
+    throw database_exception("Record too large");
+  int bytes = size <= INLINE_LIMIT ? StoredBytes(static_cast<int>(size)) : MIN_RECORD_BYTES;
+  for(size_t tried = 0; ; ++tried) {
+    index_t index = PickPage(tried);
+    Writer writer = buffer_pool_.get_writer(index);
+    HeapPage *page = writer.as<HeapPage>();
+    // free slots are reused before the slot array grows.
+    int pos = 0;
+    while(pos < page->slot_count && page->slots()[pos].offset != 0)
+      ++pos;
+    int need = bytes + (pos == page->slot_count ? HeapPage::SLOT_SIZE : 0);
+    if(page->free_bytes() >= need) {
+      if(pos == page->slot_count) {
+        // the slot array may run into the record heap until Allocate packs the holes away.
+        if(page->heap_begin < (page->slot_count + 1) * HeapPage::SLOT_SIZE)
+          Compact(page);
+        page->slots()[pos].offset = 0;
+        ++page->slot_count;
+      }
+      StoreRecord(page, page->slots() + pos, static_cast<const char*>(data), size);
+      return RID(index, static_cast<uint32_t>(pos));
+    }
+    bool is_full = page->free_bytes() < RETIRE_BYTES;
+    writer.drop();
+    if(is_full)
+      RetirePage(index);
+  }
+}
+
+bool RecordStore::read(const RID &rid, vector<char> &data) {
+  Reader reader;
+  auto slot = FindSlot(reader, rid);
+  if(!slot)
+    return false;
+  const HeapPage *page = reader.as<HeapPage>();
+  if(slot->is_overflow) {
+    Stub stub;
+    memcpy(&stub, page->data + slot->offset, sizeof(Stub));
+    data.resize(stub.size);
+    ReadChain(stub.head_index, data.data());
+  } else {
+    data.resize(slot->length);
+    memcpy(data.data(), page->data + slot->offset, slot->length);
+  }
+  return true;
+}
+
+bool RecordStore::update(const RID &rid, const void *data, size_t size) {
+  if(size > MAX_RECORD_SIZE)
+    throw database_exception("Record too large");
+  Writer writer;
+  auto slot = FindSlot(writer, rid);
+  if(!slot)
+    return false;
+  HeapPage *page = writer.as<HeapPage>();
+  // a record that doesn't grow past its bytes is rewritten in place.
+  if(!slot->is_overflow && size <= INLINE_LIMIT && StoredBytes(size) <= StoredBytes(slot->length)) {
+    page->hole_bytes += StoredBytes(slot->length) - StoredBytes(size);
+    slot->length = size;
+    memcpy(page->data + slot->offset, data, size);
+    return true;
+  }
+  FreeRecord(page, slot);
+  StoreRecord(page, slot, static_cast<const char*>(data), size);
+  return true;
+}
+
+bool RecordStore::remove(const RID &rid) {
+  Writer writer;
+  auto slot = FindSlot(writer, rid);
+  if(!slot)
+    return false;
+  HeapPage *page = writer.as<HeapPage>();
+  bool had_room = page->free_bytes() >= HINT_BYTES;
+  FreeRecord(page, slot);
+  while(page->slot_count > 0 && page->slots()[page->slot_count - 1].offset == 0)
+    --page->slot_count;
+  if(!had_room && page->free_bytes() >= HINT_BYTES)
+    AddHint(rid.page);
+  return true;
+}
+
+RecordStore::index_t RecordStore::PickPage(size_t tried) {
+  {
+    std::unique_lock lock(store_latch_);
+    // the latest hints first: they were freed most recently.
+    if(tried < hints_.size())
+      return hints_[hints_.size() - 1 - tried];
+    if(tried == hints_.size() && tail_index_ != nullpos)
+      return tail_index_;
+  }
+  // formatted before it is published: a recycled id may still hold an old page.
+  index_t index = NewHeapPage();
+  std::unique_lock lock(store_latch_);
+  // the old tail may still take small records.
+  if(tail_index_ != nullpos && hints_.size() < HINT_CAPACITY)
+    hints_.push_back(tail_index_);
+  tail_index_ = index;
+  return index;
+}
+
+RecordStore::index_t RecordStore::NewHeapPage() {
+  index_t index = buffer_pool_.alloc();
+  Writer writer = buffer_pool_.get_writer(index);
+  HeapPage *page = writer.as<HeapPage>();
+  page->type = PageType::Heap;
+  page->slot_count = 0;
+  page->heap_begin = HeapPage::DATA_SIZE;
+  page->hole_bytes = 0;
+  return index;
+}
+
+void RecordStore::RetirePage(index_t index) {
+  std::unique_lock lock(store_latch_);
+  if(tail_index_ == index)
+    tail_index_ = nullpos;
+  for(size_t i = 0; i < hints_.size(); ++i)
+    if(hints_[i] == index) {
+      hints_[i] = hints_.back();
+      hints_.pop_back();
+      break;
+    }
+}
+
+void RecordStore::AddHint(index_t index) {
+  std::unique_lock lock(store_latch_);
+  if(index == tail_index_ || hints_.size() == HINT_CAPACITY)
+    return;
+  for(size_t i = 0; i < hints_.size(); ++i)
+    if(hints_[i] == index)
+      return;
+  hints_.push_back(index);
+}
+
+uint16_t RecordStore::Allocate(HeapPage *page, int bytes) {
+  if(page->heap_begin - page->slot_count * HeapPage::SLOT_SIZE < bytes)
+    Compact(page);
+  page->heap_begin -= bytes;
+  return page->heap_begin;
+}
+
+void RecordStore::Compact(HeapPage *page) {
+  char buffer[HeapPage::DATA_SIZE];
+  int end = HeapPage::DATA_SIZE;
+  for(int i = 0; i < page->slot_count; ++i) {
+    typename HeapPage::Slot &slot = page->slots()[i];
+    if(slot.offset == 0)
+      continue;
+    int bytes = StoredBytes(slot.length);
+    end -= bytes;
+    memcpy(buffer + end, page->data + slot.offset, bytes);
+    slot.offset = end;
+  }
+  memcpy(page->data + end, buffer + end, HeapPage::DATA_SIZE - end);
+  page->heap_begin = end;
+  page->hole_bytes = 0;
+}
+
+RecordStore::index_t RecordStore::WriteChain(const char *data, size_t size) {
+  // written from the back, so that every page knows its right sibling when it is written.
+  index_t rht_index = nullpos;
+  size_t chunks = (size + OverflowPage::DATA_SIZE - 1) / OverflowPage::DATA_SIZE;
+  for(size_t i = chunks; i-- > 0; ) {
+    index_t index = buffer_pool_.alloc();
+    Writer writer = buffer_pool_.get_writer(index);
+    OverflowPage *page = writer.as<OverflowPage>();
+    size_t begin = i * OverflowPage::DATA_SIZE;
+    page->type = PageType::Overflow;
+    page->length = static_cast<uint32_t>(std::min<size_t>(OverflowPage::DATA_SIZE, size - begin));
+    page->rht_index = rht_index;
+    memcpy(page->data, data + begin, page->length);
+    rht_index = index;
+  }
+  return rht_index;
+}
+
+void RecordStore::ReadChain(index_t index, char *data) {
+  while(index != nullpos) {
+    Reader reader = buffer_pool_.get_reader(index);
+    const OverflowPage *page = reader.as<OverflowPage>();
+    memcpy(data, page->data, page->length);
+    data += page->length;
+    index = page->rht_index;
+  }
+}
+
+void RecordStore::FreeChain(index_t index) {
+  while(index != nullpos) {
+    index_t rht_index;
+    {
+      Reader reader = buffer_pool_.get_reader(index);
+      rht_index = reader.as<OverflowPage>()->rht_index;
+    }
+    buffer_pool_.dealloc(index);
+    index = rht_index;
+  }
+}
+
+void RecordStore::FreeRecord(HeapPage *page, typename HeapPage::Slot *slot) {
+  if(slot->is_overflow) {
+    Stub stub;
+    memcpy(&stub, page->data + slot->offset, sizeof(Stub));
+    FreeChain(stub.head_index);
+  }
+  page->hole_bytes += StoredBytes(slot->length);
+  slot->offset = 0;
+}
+
+void RecordStore::StoreRecord(HeapPage *page, typename HeapPage::Slot *slot, const char *data, size_t size) {
+  if(size <= INLINE_LIMIT && page->free_bytes() >= StoredBytes(static_cast<int>(size))) {
+    slot->offset = Allocate(page, StoredBytes(static_cast<int>(size)));
+    slot->length = static_cast<uint16_t>(size);
+    slot->is_overflow = 0;
+    memcpy(page->data + slot->offset, data, size);
+    return;
+  }
+  Stub stub(static_cast<uint32_t>(size), WriteChain(data, size));
+  slot->offset = Allocate(page, MIN_RECORD_BYTES);
+  slot->length = sizeof(Stub);
+  slot->is_overflow = 1;
+  memcpy(page->data + slot->offset, &stub, sizeof(Stub));
+}
+
+}
@@ -0,0 +1,94 @@
+#include "write_ahead_log.h"
+
+#include <cstring>
+#include <string_view>
+
+#include "hash.h"
+
+namespace insomnia {
+
+WriteAheadLog::WriteAheadLog(const std::filesystem::path &file) : file_(file) {
+  fstream_.open(file_, std::ios::in | std::ios::out | std::ios::binary);
+  if(!fstream_.is_open()) {
+    fstream_.open(file_, std::ios::out | std::ios::binary);
+    fstream_.close();
+    fstream_.open(file_, std::ios::in | std::ios::out | std::ios::binary);
+  }
+  if(!fstream_.is_open())
+    throw disk_exception("Cannot open the log");
+  size_ = std::filesystem::file_size(file_);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  sync();
+  fstream_.close();
+}
+
+void WriteAheadLog::append(RecordType type, uint64_t group, uint64_t index, const void *data, uint32_t size) {
+  RecordHeader header(type, size, group, index, 0);
+  header.checksum = Checksum(header, static_cast<const char*>(data));
+  std::unique_lock lock(latch_);
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + sizeof(RecordHeader) + size);
+  memcpy(buffer_.data() + offset, &header, sizeof(RecordHeader));
+  if(size != 0)
+    memcpy(buffer_.data() + offset + sizeof(RecordHeader), data, size);
+}
+
+void WriteAheadLog::sync() {
+  std::unique_lock lock(latch_);
+  if(buffer_.empty())
+    return;
+  fstream_.seekp(size_, std::ios::beg);
+  fstream_.write(buffer_.data(), buffer_.size());
+  fstream_.flush();
+  if(!fstream_)
+    throw disk_exception("Writing the log failed");
+  size_ += buffer_.size();
+  buffer_.clear();
+}
+
+size_t WriteAheadLog::size() const {
+  std::unique_lock lock(latch_);
+  return size_;
+}
+
+void WriteAheadLog::truncate() {
+  std::unique_lock lock(latch_);
+  fstream_.close();
+  fstream_.open(file_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!fstream_.is_open())
+    throw disk_exception("Cannot truncate the log");
+  buffer_.clear();
+  size_ = 0;
+}
+
+vector<char> WriteAheadLog::Load() {
+  std::unique_lock lock(latch_);
+  vector<char> log;
+  log.resize(size_);
+  fstream_.seekg(0, std::ios::beg);
+  fstream_.read(log.data(), size_);
+  fstream_.clear();
+  return log;
+}
+
+bool WriteAheadLog::Parse(vector<char> &log, size_t offset, RecordHeader &header) {
+  if(offset + sizeof(RecordHeader) > log.size())
+    return false;
+  memcpy(&header, log.data() + offset, sizeof(RecordHeader));
+  if(header.size > log.size() - offset - sizeof(RecordHeader))
+    return false;
+  return header.checksum == Checksum(header, log.data() + offset + sizeof(RecordHeader));
+}
+
+uint64_t WriteAheadLog::Checksum(const RecordHeader &header, const char *data) {
+  RecordHeader fields = header;
+  fields.checksum = 0;
+  uint64_t checksum = hash1(std::string_view(reinterpret_cast<const char*>(&fields), sizeof(RecordHeader)));
+  if(header.size != 0)
+    checksum ^= hash2(std::string_view(data, header.size));
+  return checksum;
+}
+
+}
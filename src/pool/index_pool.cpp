@@ -31,12 +31,7 @@ void IndexPool::open(const std::filesystem::path &file) {
 void IndexPool::close() {
   std::unique_lock lock(latch_);
   if(!pool_.is_open()) return;
-  pool_.seekp(0);
-  pool_.write(reinterpret_cast<char*>(&capacity_), sizeof(capacity_));
-  size_t size = unallocated_.size();
-  pool_.write(reinterpret_cast<char*>(&size), sizeof(size));
-  pool_.write(reinterpret_cast<char*>(unallocated_.data()), size * sizeof(size_t));
-  pool_.flush();
+  flush_locked();
   pool_.close();
   capacity_ = 0;
   unallocated_.resize(0);
@@ -58,4 +53,33 @@ void IndexPool::deallocate(index_t index) {
   unallocated_.push_back(index);
 }
 
-}
\ No newline at end of file
+void IndexPool::allocate_at(index_t index) {
+  std::unique_lock lock(latch_);
+  while(capacity_ < index) {
+    if(++capacity_ != index)
+      unallocated_.push_back(capacity_);
+  }
+  for(size_t i = 0; i < unallocated_.size(); ++i)
+    if(unallocated_[i] == index) {
+      unallocated_[i] = unallocated_.back();
+      unallocated_.pop_back();
+      break;
+    }
+}
+
+void IndexPool::flush() {
+  std::unique_lock lock(latch_);
+  if(pool_.is_open())
+    flush_locked();
+}
+
+void IndexPool::flush_locked() {
+  pool_.seekp(0);
+  pool_.write(reinterpret_cast<char*>(&capacity_), sizeof(capacity_));
+  size_t size = unallocated_.size();
+  pool_.write(reinterpret_cast<char*>(&size), sizeof(size));
+  pool_.write(reinterpret_cast<char*>(unallocated_.data()), size * sizeof(size_t));
+  pool_.flush();
+}
+
+}
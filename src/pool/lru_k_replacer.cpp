@@ -1,145 +1,142 @@
 #include "lru_k_replacer.h"
 
+#include <algorithm>
+
 namespace insomnia {
 
 void LruKReplacer::access(index_t index) {
-  {
-    std::unique_lock lock(obscure_latch_);
-    if(auto it = obscure_list_.find(index); it != obscure_list_.end()) {
-      it->second.access(timestamp_++);
-      if(it->second.heated()) {
-        {
-          std::unique_lock lock2(hotspot_latch_);
-          hotspot_list_.emplace(index, std::move(it->second));
-        }
-        obscure_list_.erase(it);
-      }
-      return;
-    }
-  }
-  {
-    std::unique_lock lock(hotspot_latch_);
-    if(auto it = hotspot_list_.find(index); it != hotspot_list_.end()) {
-      it->second.access(timestamp_++);
-      return;
-    }
+  std::unique_lock lock(latch_);
+  Slot &slot = slots_[index];
+  if(slot.stat == SlotStat::Invalid)
+    slot.stat = SlotStat::Obscure;
+  history_[index * k_ + slot.access_num++ % k_] = timestamp_++;
+  if(slot.stat == SlotStat::Obscure && slot.access_num >= k_) {
+    if(slot.evictable)
+      Erase(obscure_heap_, index);
+    slot.stat = SlotStat::Hotspot;
+    if(slot.evictable)
+      Push(hotspot_heap_, index);
+  } else if(slot.evictable) {
+    Fix(HeapOf(index), heap_pos_[index]);
   }
-  std::unique_lock lock(obscure_latch_);
-  Slot slot(k_);
-  slot.access(timestamp_++);
-  obscure_list_.emplace(index, std::move(slot));
+}
+
+void LruKReplacer::admit(index_t index) {
+  std::unique_lock lock(latch_);
+  Slot &slot = slots_[index];
+  if(slot.stat != SlotStat::Invalid)
+    return;
+  slot.stat = SlotStat::Obscure;
+  slot.evictable = true;
+  history_[index * k_] = timestamp_++;
+  Push(obscure_heap_, index);
+  size_++;
 }
 
 LruKReplacer::index_t LruKReplacer::evict() {
-  {
-    index_t result = npos;
-    std::unique_lock lock(obscure_latch_);
-    size_t earliest_timestamp = TIME_T_MAX;
-    for(auto &[index, node] : obscure_list_) {
-      if(!node.evictable)
-        continue;
-      if(earliest_timestamp > node.k_dist()) {
-        result = index;
-        earliest_timestamp = node.k_dist();
-      }
-    }
-    if(result != npos) {
-      obscure_list_.erase(result);
-      size_--;
-      return result;
-    }
-  }
-  {
-    index_t result = npos;
-    std::unique_lock lock(hotspot_latch_);
-    size_t earliest_timestamp = TIME_T_MAX;
-    for(auto &[index, node] : hotspot_list_) {
-      if(!node.evictable)
-        continue;
-      if(earliest_timestamp > node.k_dist()) {
-        result = index;
-        earliest_timestamp = node.k_dist();
+  std::unique_lock lock(latch_);
+  // frames accessed fewer than k times have an infinite k-distance, and all go first.
+  Heap &heap = !obscure_heap_.empty() ? obscure_heap_ : hotspot_heap_;
+  if(heap.empty())
+    return npos;
+  index_t result = heap[0];
+  Erase(heap, result);
+  slots_[result] = Slot();
+  size_--;
+  return result;
+}
+
+vector<LruKReplacer::index_t> LruKReplacer::coldest(size_t count) {
+  vector<index_t> result;
+  std::unique_lock lock(latch_);
+  for(Heap *heap : {&obscure_heap_, &hotspot_heap_}) {
+    // the next coldest frame is always a child of one taken already: walk the heap best first.
+    vector<std::pair<timestamp_t, size_t>> frontier;
+    auto later = [] (const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; };
+    if(!heap->empty())
+      frontier.push_back({k_dist((*heap)[0]), 0});
+    while(result.size() < count && !frontier.empty()) {
+      std::pop_heap(frontier.data(), frontier.data() + frontier.size(), later);
+      size_t pos = frontier.back().second;
+      frontier.pop_back();
+      result.push_back((*heap)[pos]);
+      for(size_t child = pos * 2 + 1; child <= pos * 2 + 2 && child < heap->size(); ++child) {
+        frontier.push_back({k_dist((*heap)[child]), child});
+        std::push_heap(frontier.data(), frontier.data() + frontier.size(), later);
       }
     }
-    if(result != npos) {
-      hotspot_list_.erase(result);
-      size_--;
-      return result;
-    }
   }
-  return npos;
+  return result;
 }
 
 bool LruKReplacer::remove(index_t index) {
-  {
-    std::unique_lock lock(obscure_latch_);
-    if (auto it = obscure_list_.find(index); it != obscure_list_.end()) {
-      if (!it->second.evictable)
-        return false;
-      obscure_list_.erase(it);
-      size_--;
-      return true;
-    }
-  }
-  {
-    std::unique_lock lock(hotspot_latch_);
-    if (auto it = hotspot_list_.find(index); it != hotspot_list_.end()) {
-      if (!it->second.evictable)
-        return false;
-      hotspot_list_.erase(it);
-      size_--;
-      return true;
-    }
-  }
-  return false;
+  std::unique_lock lock(latch_);
+  Slot &slot = slots_[index];
+  if(slot.stat == SlotStat::Invalid || !slot.evictable)
+    return false;
+  Erase(HeapOf(index), index);
+  slot = Slot();
+  size_--;
+  return true;
 }
 
 void LruKReplacer::pin(index_t index) {
-  {
-    std::unique_lock lock(obscure_latch_);
-    if (auto it = obscure_list_.find(index); it != obscure_list_.end()) {
-      if (it->second.evictable) {
-        it->second.evictable = false;
-        size_--;
-      }
-      return;
-    }
-  }
-  {
-    std::unique_lock lock(hotspot_latch_);
-    if (auto it = hotspot_list_.find(index); it != hotspot_list_.end()) {
-      if (it->second.evictable) {
-        it->second.evictable = false;
-        size_--;
-      }
-      return;
-    }
-  }
+  std::unique_lock lock(latch_);
+  Slot &slot = slots_[index];
+  if(slot.stat == SlotStat::Invalid || !slot.evictable)
+    return;
+  Erase(HeapOf(index), index);
+  slot.evictable = false;
+  size_--;
 }
 
 void LruKReplacer::unpin(index_t index) {
-  {
-    std::unique_lock lock(obscure_latch_);
-    if (auto it = obscure_list_.find(index); it != obscure_list_.end()) {
-      if (!it->second.evictable) {
-        it->second.evictable = true;
-        size_++;
-      }
-      return;
-    }
-  }
-  {
-    std::unique_lock lock(hotspot_latch_);
-    if (auto it = hotspot_list_.find(index); it != hotspot_list_.end()) {
-      if (!it->second.evictable) {
-        it->second.evictable = true;
-        size_++;
-      }
-      return;
-    }
-  }
+  std::unique_lock lock(latch_);
+  Slot &slot = slots_[index];
+  if(slot.stat == SlotStat::Invalid || slot.evictable)
+    return;
+  slot.evictable = true;
+  Push(HeapOf(index), index);
+  size_++;
 }
 
+void LruKReplacer::Push(Heap &heap, index_t index) {
+  heap.push_back(index);
+  heap_pos_[index] = heap.size() - 1;
+  Fix(heap, heap.size() - 1);
+}
 
+void LruKReplacer::Erase(Heap &heap, index_t index) {
+  size_t pos = heap_pos_[index];
+  index_t last = heap.back();
+  heap.pop_back();
+  if(pos == heap.size())
+    return;
+  heap[pos] = last;
+  heap_pos_[last] = pos;
+  Fix(heap, pos);
+}
 
-}
\ No newline at end of file
+void LruKReplacer::Fix(Heap &heap, size_t pos) {
+  index_t index = heap[pos];
+  timestamp_t dist = k_dist(index);
+  while(pos > 0 && k_dist(heap[(pos - 1) / 2]) > dist) {
+    heap[pos] = heap[(pos - 1) / 2];
+    heap_pos_[heap[pos]] = pos;
+    pos = (pos - 1) / 2;
+  }
+  while(pos * 2 + 1 < heap.size()) {
+    size_t child = pos * 2 + 1;
+    if(child + 1 < heap.size() && k_dist(heap[child + 1]) < k_dist(heap[child]))
+      ++child;
+    if(k_dist(heap[child]) >= dist)
+      break;
+    heap[pos] = heap[child];
+    heap_pos_[heap[pos]] = pos;
+    pos = child;
+  }
+  heap[pos] = index;
+  heap_pos_[index] = pos;
+}
+
+}
@@ -0,0 +1,47 @@
+#include "page_table.h"
+
+#include "exception.h"
+
+namespace insomnia {
+
+PageTable::PageTable(size_t capacity) : capacity_(capacity) {
+  int bits = 1;
+  while((size_t(1) << bits) < capacity * 2)
+    ++bits;
+  slots_.resize(size_t(1) << bits);
+  mask_ = (size_t(1) << bits) - 1;
+  shift_ = 64 - bits;
+}
+
+void PageTable::insert(page_id_t page_id, frame_id_t frame_id) {
+  if(size_ == capacity_)
+    throw pool_overflow("Page table full");
+  size_t pos = Home(page_id);
+  while(slots_[pos].page_id != EMPTY)
+    pos = (pos + 1) & mask_;
+  slots_[pos] = {page_id, frame_id};
+  ++size_;
+}
+
+bool PageTable::erase(page_id_t page_id) {
+  size_t pos = Home(page_id);
+  while(slots_[pos].page_id != page_id) {
+    if(slots_[pos].page_id == EMPTY)
+      return false;
+    pos = (pos + 1) & mask_;
+  }
+  // entries after the hole move back into it, unless their home lies between the hole and them.
+  size_t hole = pos;
+  for(size_t next = (hole + 1) & mask_; slots_[next].page_id != EMPTY; next = (next + 1) & mask_) {
+    size_t home = Home(slots_[next].page_id);
+    if(((next - home) & mask_) >= ((next - hole) & mask_)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole] = Slot();
+  --size_;
+  return true;
+}
+
+}
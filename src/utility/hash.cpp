@@ -0,0 +1,21 @@
+#include "hash.h"
+
+namespace insomnia {
+
+unsigned long hash1(std::string_view str) {
+  unsigned long hash = 2166136261;
+  for(const auto &c : str) {
+    hash ^= c;
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+unsigned long hash2(std::string_view str) {
+  unsigned long hash = 5371;
+  for(const auto &c : str)
+    hash = (hash << 5) + hash + c;
+  return hash;
+}
+
+}
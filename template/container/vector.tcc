@@ -138,6 +138,22 @@ typename vector<T>::iterator vector<T>::erase(size_t pos) {
   return {this, ptr};
 }
 
+template <class T>
+typename vector<T>::iterator vector<T>::erase(size_t first, size_t last) {
+  if(first > last || last > size()) throw index_out_of_bound();
+  T *ptr = _beg + first;
+  if(first == last) return {this, ptr};
+  T *cur = ptr;
+  for(T *nxt = _beg + last; nxt != _end; ++cur, ++nxt) {
+    cur->~T();
+    new (cur) T(std::move(*nxt));
+  }
+  for(T *old = cur; old != _end; ++old)
+    old->~T();
+  _end = cur;
+  return {this, ptr};
+}
+
 
 
 template <class T>
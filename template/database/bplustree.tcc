@@ -10,272 +10,982 @@ namespace insomnia {
 template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
 MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::MultiBPlusTree(
   const std::filesystem::path &name,
-  size_t k_param, size_t buffer_capacity, size_t thread_num)
-    : buffer_pool_(name, k_param, buffer_capacity, thread_num) {
-  RootHolder root_holder;
-  if(buffer_pool_.read_meta(&root_holder))
-    root_ = root_holder.root;
-  else
-    root_ = 0;
-}
+  size_t k_param, size_t buffer_capacity, size_t thread_num, LogMode log_mode)
+    : TreeBase(name, k_param, buffer_capacity, thread_num, log_mode) {}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::MultiBPlusTree(
+  const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, TaskScheduler &scheduler, LogMode log_mode)
+    : TreeBase(name, k_param, buffer_capacity, scheduler, log_mode) {}
 
 template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
 MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::~MultiBPlusTree() {
-  RootHolder root_holder;
-  root_holder.root = root_;
-  buffer_pool_.write_meta(&root_holder);
+  // a pending compaction may still move the root.
+  if(compactor_)
+    compactor_->close();
+  SaveRoot();
 }
 
 template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
-vector<ValueT> MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(
-  const KeyT &key) {
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Reader
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::FindLeaf(const KeyT &key) {
   std::shared_lock root_lock(root_latch_);
   if(root_ == nullpos)
-    return vector<ValueT>();
-  vector<Reader> readers;
-  readers.push_back(buffer_pool_.get_reader(root_));
-  while(!readers.back().template as<Base>()->is_leaf()) {
-    const Internal *internal = readers.back().template as<Internal>();
+    return Reader();
+  Reader reader = buffer_pool_.get_reader(root_);
+  // root_ can't be replaced while its page is latched.
+  root_lock.unlock();
+  while(!reader.template as<Base>()->is_leaf()) {
+    const Internal *internal = reader.template as<Internal>();
     int pos = internal->locate_any(key,
       [this] (const KeyT &key, const KVType &kv) { return !key_compare_(kv.key, key); });
-    index_t index = internal->value(pos);
-    readers.pop_back(); // Heh. I don't want to modify the main part. Parent reader released.
-    readers.push_back(buffer_pool_.get_reader(index));
+    // child latched before the parent is released.
+    reader = buffer_pool_.get_reader(internal->value(pos));
   }
-  Reader reader = std::move(readers.back());
-  readers.pop_back();
-  const Leaf *leaf = reader.template as<Leaf>();
-  int pos = leaf->locate_any(key,
-    [this] (const KVType &kv, const KeyT &key) { return key_compare_(kv.key, key); });
+  return reader;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+vector<ValueT> MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(
+  const KeyT &key) {
   vector<ValueT> result;
+  search(key, [&result] (const ValueT &value) { result.push_back(value); });
+  return result;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class Visitor>
+requires std::invocable<Visitor&, const ValueT&>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(
+  const KeyT &key, Visitor &&visitor, size_t limit) {
+  constexpr bool can_stop = std::is_convertible_v<std::invoke_result_t<Visitor&, const ValueT&>, bool>;
+  auto visit = [&visitor] (const ValueT &value) {
+    if constexpr(can_stop)
+      return static_cast<bool>(visitor(value));
+    else {
+      visitor(value);
+      return true;
+    }
+  };
+  size_t visited = 0;
+  uint64_t generation = 0;
+  if(cache_) {
+    if(typename Cache::Values values = cache_->lookup(key)) {
+      while(visited < values->size() && visited < limit)
+        if(!visit((*values)[visited++]))
+          break;
+      return visited;
+    }
+    generation = cache_->generation(key);
+  }
+  vector<ValueT> values; // for the cache, if the search gets to the last value.
+  ValueView view = search_view(key);
+  for(; view.valid() && visited < limit; view.next()) {
+    for(int i = 0; i < view.size() && visited < limit; ++i) {
+      ++visited;
+      if(cache_)
+        values.push_back(view[i]);
+      if(!visit(view[i]))
+        return visited;
+    }
+  }
+  if(cache_ && !view.valid())
+    cache_->store(key, generation, std::move(values));
+  return visited;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class OutputIt>
+requires std::output_iterator<OutputIt, const ValueT&> && (!std::invocable<OutputIt&, const ValueT&>)
+OutputIt MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(
+  const KeyT &key, OutputIt out, size_t limit) {
+  search(key, [&out] (const ValueT &value) { *out++ = value; }, limit);
+  return out;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search_view(const KeyT &key) {
+  ValueView view;
+  view.reader_ = FindLeaf(key);
+  if(!view.reader_.is_valid())
+    return view;
+  view.tree_ = this;
+  view.key_ = key;
+  view.leaf_ = view.reader_.template as<Leaf>();
+  view.begin_ = view.leaf_->locate_any(key,
+    [this] (const KVType &kv, const KeyT &key) { return key_compare_(kv.key, key); });
+  view.settle();
+  return view;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::count(const KeyT &key) {
+  if(cache_)
+    return search(key, [] (const ValueT&) {});
+  size_t result = 0;
+  for(ValueView view = search_view(key); view.valid(); view.next())
+    result += view.size();
+  return result;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Snapshot
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::snapshot() {
+  Snapshot snapshot;
+  snapshot.tree_ = this;
+  snapshot.snapshot_ = buffer_pool_.snapshot();
+  // the root saved by the same writes as the pages the snapshot sees.
+  RootHolder root_holder;
+  snapshot.root_ = snapshot.snapshot_.read_meta(&root_holder) ? root_holder.root : nullpos;
+  return snapshot;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Snapshot::FindLeaf(
+  const KeyT &key, PageCopy &page) const {
+  if(root_ == nullpos)
+    return false;
+  const KeyCompare &key_compare = tree_->key_compare_;
+  snapshot_.read(root_, page.data);
+  while(!reinterpret_cast<const Base*>(page.data)->is_leaf()) {
+    const Internal *internal = reinterpret_cast<const Internal*>(page.data);
+    int pos = internal->locate_any(key,
+      [&key_compare] (const KeyT &key, const KVType &kv) { return !key_compare(kv.key, key); });
+    snapshot_.read(internal->value(pos), page.data);
+  }
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class Visitor>
+requires std::invocable<Visitor&, const ValueT&>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Snapshot::search(
+  const KeyT &key, Visitor &&visitor, size_t limit) const {
+  constexpr bool can_stop = std::is_convertible_v<std::invoke_result_t<Visitor&, const ValueT&>, bool>;
+  PageCopy page;
+  if(limit == 0 || !FindLeaf(key, page))
+    return 0;
+  const KeyCompare &key_compare = tree_->key_compare_;
+  const Leaf *leaf = reinterpret_cast<const Leaf*>(page.data);
+  int pos = leaf->locate_any(key,
+    [&key_compare] (const KVType &kv, const KeyT &key) { return key_compare(kv.key, key); });
+  size_t visited = 0;
   while(true) {
     if(pos == leaf->size()) {
       index_t rht_index = leaf->rht_index();
       if(rht_index == nullpos)
-        return result;
-      reader = buffer_pool_.get_reader(rht_index);
-      leaf = reader.template as<Leaf>();
+        return visited;
+      snapshot_.read(rht_index, page.data);
       pos = 0;
+      continue;
     }
-    if(!key_equal_(leaf->key(pos).key, key))
-      return result;
-    result.push_back(leaf->value(pos));
+    if(!tree_->key_equal_(leaf->key(pos).key, key))
+      return visited;
+    ++visited;
+    if constexpr(can_stop) {
+      if(!visitor(leaf->value(pos)))
+        return visited;
+    } else
+      visitor(leaf->value(pos));
+    if(visited == limit)
+      return visited;
     ++pos;
   }
 }
 
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+vector<ValueT> MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Snapshot::search(
+  const KeyT &key) const {
+  vector<ValueT> result;
+  search(key, [&result] (const ValueT &value) { result.push_back(value); });
+  return result;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Snapshot::count(const KeyT &key) const {
+  return search(key, [] (const ValueT&) {});
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView::next() {
+  if(!valid()) return;
+  // a run ending inside the leaf ends the values of the key.
+  if(end_ < leaf_->size()) {
+    reset();
+    return;
+  }
+  begin_ = end_;
+  settle();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView::ValueView(ValueView &&other) noexcept
+    : reader_(std::move(other.reader_)),
+      tree_(std::exchange(other.tree_, nullptr)),
+      leaf_(std::exchange(other.leaf_, nullptr)),
+      begin_(std::exchange(other.begin_, 0)),
+      end_(std::exchange(other.end_, 0)),
+      key_(other.key_) {}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView&
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView::operator=(ValueView &&other) noexcept {
+  if(this == &other) return *this;
+  reader_ = std::move(other.reader_);
+  tree_ = std::exchange(other.tree_, nullptr);
+  leaf_ = std::exchange(other.leaf_, nullptr);
+  begin_ = std::exchange(other.begin_, 0);
+  end_ = std::exchange(other.end_, 0);
+  key_ = other.key_;
+  return *this;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView::reset() {
+  reader_.drop();
+  leaf_ = nullptr;
+  tree_ = nullptr;
+  begin_ = end_ = 0;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::ValueView::settle() {
+  while(begin_ == leaf_->size()) {
+    index_t rht_index = leaf_->rht_index();
+    if(rht_index == nullpos) {
+      reset();
+      return;
+    }
+    // the right sibling is pinned before the current leaf is released.
+    reader_ = tree_->buffer_pool_.get_reader(rht_index);
+    leaf_ = reader_.template as<Leaf>();
+    begin_ = 0;
+  }
+  const KeyCompare &key_compare = tree_->key_compare_;
+  end_ = leaf_->locate_any(key_,
+    [&key_compare] (const KVType &kv, const KeyT &key) { return !key_compare(key, kv.key); });
+  if(end_ == begin_) {
+    reset();
+    return;
+  }
+  // the run may go on into the right sibling: read it while this leaf is visited.
+  if(end_ == leaf_->size() && leaf_->rht_index() != nullpos)
+    tree_->buffer_pool_.prefetch(leaf_->rht_index());
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::MakeCursor(
+  const KeyT &lower, const KeyT *upper) {
+  Cursor cursor;
+  cursor.reader_ = FindLeaf(lower);
+  if(!cursor.reader_.is_valid())
+    return cursor;
+  cursor.tree_ = this;
+  if(upper) {
+    cursor.bounded_ = true;
+    cursor.upper_ = *upper;
+  }
+  cursor.leaf_ = cursor.reader_.template as<Leaf>();
+  cursor.pos_ = cursor.leaf_->locate_any(lower,
+    [this] (const KVType &kv, const KeyT &key) { return key_compare_(kv.key, key); });
+  cursor.read_ahead();
+  cursor.settle();
+  return cursor;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::lower_bound(const KeyT &lower) {
+  return MakeCursor(lower, nullptr);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::range(
+  const KeyT &lower, const KeyT &upper) {
+  if(!key_compare_(lower, upper))
+    return Cursor();
+  return MakeCursor(lower, &upper);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::prefix_range(const KeyT &prefix)
+requires requires(const KeyT &key, KeyT &bound) {
+  { key.prefix_successor(bound) } -> std::convertible_to<bool>;
+} {
+  KeyT upper;
+  if(prefix.prefix_successor(upper))
+    return MakeCursor(prefix, &upper);
+  return MakeCursor(prefix, nullptr);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::next() {
+  if(!valid()) return;
+  ++pos_;
+  settle();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::Cursor(Cursor &&other) noexcept
+    : reader_(std::move(other.reader_)),
+      tree_(std::exchange(other.tree_, nullptr)),
+      leaf_(std::exchange(other.leaf_, nullptr)),
+      pos_(std::exchange(other.pos_, 0)),
+      bounded_(other.bounded_),
+      upper_(other.upper_) {}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor&
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::operator=(Cursor &&other) noexcept {
+  if(this == &other) return *this;
+  reader_ = std::move(other.reader_);
+  tree_ = std::exchange(other.tree_, nullptr);
+  leaf_ = std::exchange(other.leaf_, nullptr);
+  pos_ = std::exchange(other.pos_, 0);
+  bounded_ = other.bounded_;
+  upper_ = other.upper_;
+  return *this;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::reset() {
+  reader_.drop();
+  leaf_ = nullptr;
+  tree_ = nullptr;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::settle() {
+  bool is_hopped = false;
+  while(pos_ == leaf_->size()) {
+    index_t rht_index = leaf_->rht_index();
+    if(rht_index == nullpos) {
+      reset();
+      return;
+    }
+    // the right sibling is pinned before the current leaf is released.
+    reader_ = tree_->buffer_pool_.get_reader(rht_index);
+    leaf_ = reader_.template as<Leaf>();
+    pos_ = 0;
+    is_hopped = true;
+  }
+  if(bounded_ && !tree_->key_compare_(leaf_->key(pos_).key, upper_)) {
+    reset();
+    return;
+  }
+  // the next leaf is read while this one is scanned.
+  if(is_hopped)
+    read_ahead();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Cursor::read_ahead() {
+  index_t rht_index = leaf_->rht_index();
+  if(rht_index == nullpos || leaf_->size() == 0)
+    return;
+  if(bounded_ && !tree_->key_compare_(leaf_->key(leaf_->size() - 1).key, upper_))
+    return;
+  tree_->buffer_pool_.prefetch(rht_index);
+}
+
 template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
 bool MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(
   const KeyT &key, const ValueT &value) {
+  bool is_inserted = InsertEntry(key, value);
+  if(cache_ && is_inserted)
+    cache_->invalidate(key);
+  return is_inserted;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::InsertEntry(
+  const KeyT &key, const ValueT &value) {
+  auto write_scope = buffer_pool_.write_scope();
   KVType kv(key, value);
-  std::unique_lock root_lock(root_latch_);
+  {
+    Writer leaf_writer = FindLeafOptim(kv);
+    if(leaf_writer.is_valid()) {
+      Leaf *leaf = leaf_writer.template as<Leaf>();
+      int pos = leaf->locate_key(kv, kv_compare_);
+      if(pos != leaf->size() && kv_equal_(leaf->key(pos), kv))
+        return false;
+      if(leaf->is_insert_safe()) {
+        leaf->insert(pos, kv, value);
+        return true;
+      }
+    }
+  }
+  RootLock root_lock(root_latch_);
   if(root_ == nullpos) {
     root_ = buffer_pool_.alloc();
+    height_ = 1;
+    SaveRoot();
     Writer writer = buffer_pool_.get_writer(root_);
     Leaf *leaf = writer.template as<Leaf>();
     leaf->init();
     leaf->insert(0, kv, value);
     return true;
   }
-  vector<Writer> writers;
-  writers.push_back(buffer_pool_.get_writer(root_));
-  while(!writers.back().template as<Base>()->is_leaf()) {
-    Internal *internal = writers.back().template as<Internal>();
-    int pos = internal->locate_key(kv, kv_compare_);
-    index_t index = internal->value(pos);
-    Writer writer = buffer_pool_.get_writer(index);
-    if(writer.template as<Base>()->is_insert_safe())
-      writers.clear();
-    writers.push_back(std::move(writer));
-  }
-  Writer leaf_writer = std::move(writers.back());
-  writers.pop_back();
-  Leaf *leaf = leaf_writer.template as<Leaf>();
-  {
+  vector<Writer> writers = FindLeafPessi(root_lock, kv, true);
+  return InsertPessi(writers, kv, [&] (Leaf *leaf) {
     int pos = leaf->locate_key(kv, kv_compare_);
     if(pos != leaf->size() && kv_equal_(leaf->key(pos), kv))
       return false;
     leaf->insert(pos, kv, value);
-  }
-  if(!leaf->is_too_large())
     return true;
-  {
-    index_t rhs_index = buffer_pool_.alloc();
-    Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
-    Leaf *rhs_leaf = rhs_writer.template as<Leaf>();
-    rhs_leaf->init();
-    leaf->split(rhs_leaf, rhs_index);
-    if(writers.empty()) {
-      index_t root_index = buffer_pool_.alloc();
-      Writer root_writer = buffer_pool_.get_writer(root_index);
-      Internal *root_internal = root_writer.template as<Internal>();
-      root_internal->init();
-      root_internal->insert(0, leaf->key(0), root_);
-      root_internal->insert(1, rhs_leaf->key(0), rhs_index);
-      root_ = root_index;
-      return true;
-    }
-    Writer &parent_writer = writers.back();
-    Internal *parent = parent_writer.template as<Internal>();
-    int lft_pos = parent->locate_key(leaf->key(0), kv_compare_);
-    parent->insert(lft_pos + 1, rhs_leaf->key(0), rhs_index);
-  }
-  leaf_writer.drop();
-  while(writers.size() > 1) {
-    Writer internal_writer = std::move(writers.back());
-    writers.pop_back();
-    Internal *internal = internal_writer.template as<Internal>();
-    if(!internal->is_too_large())
-      return true;
-    index_t rhs_index = buffer_pool_.alloc();
-    Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
-    Internal *rhs_internal = rhs_writer.template as<Internal>();
-    rhs_internal->init();
-    internal->split(rhs_internal);
-    Writer &parent_writer = writers.back();
-    Internal *parent = parent_writer.template as<Internal>();
-    int lft_pos = parent->locate_key(internal->key(0), kv_compare_);
-    parent->insert(lft_pos + 1, rhs_internal->key(0), rhs_index);
-  }
-  // if not root, it must be safe.
-  Writer root_writer = std::move(writers.back());
-  writers.pop_back();
-  Internal *root_internal = root_writer.template as<Internal>();
-  if(!root_internal->is_too_large())
-    return true;
-  index_t rhs_index = buffer_pool_.alloc();
-  Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
-  Internal *rhs_internal = rhs_writer.template as<Internal>();
-  rhs_internal->init();
-  root_internal->split(rhs_internal);
-  index_t new_root_index = buffer_pool_.alloc();
-  Writer new_root_writer = buffer_pool_.get_writer(new_root_index);
-  Internal *new_root_internal = new_root_writer.template as<Internal>();
-  new_root_internal->init();
-  new_root_internal->insert(0, root_internal->key(0), root_);
-  new_root_internal->insert(1, rhs_internal->key(0), rhs_index);
-  root_ = new_root_index;
-  return true;
+  });
 }
 
 template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
 bool MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::remove(
   const KeyT &key, const ValueT &value) {
+  bool is_removed = RemoveEntry(key, value);
+  if(cache_ && is_removed)
+    cache_->invalidate(key);
+  return is_removed;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::RemoveEntry(
+  const KeyT &key, const ValueT &value) {
+  auto write_scope = buffer_pool_.write_scope();
   KVType kv(key, value);
-  std::unique_lock root_lock(root_latch_);
+  {
+    Writer leaf_writer = FindLeafOptim(kv);
+    if(!leaf_writer.is_valid())
+      return false;
+    Leaf *leaf = leaf_writer.template as<Leaf>();
+    int pos = leaf->locate_key(kv, kv_compare_);
+    if(pos == leaf->size() || !kv_equal_(leaf->key(pos), kv))
+      return false;
+    if(leaf->is_remove_safe()) {
+      leaf->remove(pos);
+      return true;
+    }
+    if(compact_after_ != 0) {
+      leaf->remove(pos);
+      leaf_writer.drop();
+      NoteUnderfull();
+      return true;
+    }
+  }
+  RootLock root_lock(root_latch_);
   if(root_ == nullpos)
     return false;
-  vector<Writer> writers;
-  writers.push_back(buffer_pool_.get_writer(root_));
-  while(!writers.back().template as<Base>()->is_leaf()) {
-    Internal *internal = writers.back().template as<Internal>();
-    int pos = internal->locate_key(kv, kv_compare_);
-    index_t index = internal->value(pos);
-    Writer writer = buffer_pool_.get_writer(index);
-    if(writer.template as<Base>()->is_remove_safe())
-      writers.clear();
-    writers.push_back(std::move(writer));
-  }
-  Writer leaf_writer = std::move(writers.back());
-  writers.pop_back();
-  Leaf *leaf = leaf_writer.template as<Leaf>();
-  {
+  vector<Writer> writers = FindLeafPessi(root_lock, kv, false);
+  return RemovePessi(writers, kv, [&] (Leaf *leaf) {
     int pos = leaf->locate_key(kv, kv_compare_);
     if(pos == leaf->size() || !kv_equal_(leaf->key(pos), kv))
       return false;
     leaf->remove(pos);
-  }
-  if(!leaf->is_too_small())
     return true;
+  });
+}
 
-  {
-    if(writers.empty()) {
-      if(leaf->size() == 0) {
-        leaf_writer.drop();
-        buffer_pool_.dealloc(root_);
-        root_ = nullpos;
-      }
-      return true;
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::defer_rebalance(size_t compact_after) {
+  compact_after_ = compact_after;
+  if(compact_after_ != 0 && !compactor_)
+    compactor_ = std::make_unique<TaskScheduler>(1);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::enable_cache(size_t byte_budget)
+requires is_cacheable {
+  if(byte_budget == 0)
+    cache_.reset();
+  else
+    cache_ = std::make_unique<Cache>(byte_budget);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::InvalidateBatch(const vector<KVType> &batch) {
+  if(!cache_)
+    return;
+  for(size_t i = 0; i < batch.size(); ++i)
+    if(i == 0 || !key_equal_(batch[i - 1].key, batch[i].key))
+      cache_->invalidate(batch[i].key);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::NoteUnderfull() {
+  if(underfull_.fetch_add(1) + 1 < compact_after_)
+    return;
+  // one compaction in flight at a time. Leaves left underfull meanwhile wait for the next one.
+  if(is_compacting_.exchange(true))
+    return;
+  compactor_->schedule(0, [this] {
+    // cleared however compact() leaves: a failed compaction must not stop the later ones.
+    struct Reset {
+      std::atomic<bool> &flag;
+      ~Reset() { flag = false; }
+    } reset{is_compacting_};
+    compact();
+  });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+std::future<size_t> MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::compact_async() {
+  if(!compactor_)
+    compactor_ = std::make_unique<TaskScheduler>(1);
+  return compactor_->schedule(0, [this] { return compact(); });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::compact() {
+  auto write_scope = buffer_pool_.write_scope();
+  RootLock root_lock(root_latch_);
+  underfull_ = 0;
+  if(root_ == nullpos)
+    return 0;
+  size_t merged = 0;
+  Writer root_writer = buffer_pool_.get_writer(root_);
+  if(root_writer.template as<Base>()->is_leaf()) {
+    // deferred removes may have emptied the root leaf.
+    if(root_writer.template as<Leaf>()->size() == 0) {
+      root_writer.drop();
+      buffer_pool_.dealloc(root_);
+      root_ = nullpos;
+      height_ = 0;
+      SaveRoot();
     }
-    Writer &parent_writer = writers.back();
-    Internal *parent = parent_writer.template as<Internal>();
-    int pos = parent->locate_key(leaf->key(0), kv_compare_);
-    if(pos > 0) {
-      Writer lft_leaf_writer = buffer_pool_.get_writer(parent->value(pos - 1));
-      Leaf *lft_leaf = lft_leaf_writer.template as<Leaf>();
-      if(lft_leaf->size() + leaf->size() <= leaf->merge_bound()) {
-        lft_leaf->merge(leaf);
-        leaf_writer.drop();
-        buffer_pool_.dealloc(parent->value(pos));
-        parent->remove(pos);
-      } else {
-        lft_leaf->redistribute(leaf);
-        parent->write_key(pos, leaf->key(0));
+    return 0;
+  }
+  merged += CompactChildren(root_writer.template as<Internal>(), height_ - 1);
+  while(height_ > 1 && root_writer.template as<Internal>()->size() == 1) {
+    Internal *root_internal = root_writer.template as<Internal>();
+    index_t new_root = root_internal->value(0);
+    root_internal->remove(0);
+    root_writer.drop();
+    buffer_pool_.dealloc(root_);
+    root_ = new_root;
+    --height_;
+    SaveRoot();
+    root_writer = buffer_pool_.get_writer(root_);
+  }
+  return merged;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::CompactChildren(Internal *parent, int level) {
+  size_t merged = 0;
+  if(level > 1) {
+    for(int pos = 0; pos < parent->size(); ++pos) {
+      Writer writer = buffer_pool_.get_writer(parent->value(pos));
+      merged += CompactChildren(writer.template as<Internal>(), level - 1);
+    }
+  }
+  // a merged pair stays at pos, so that a run of sparse siblings folds into one node.
+  int pos = 0;
+  while(pos + 1 < parent->size()) {
+    // latched from left to right, as in RemovePessi.
+    Writer lft_writer = buffer_pool_.get_writer(parent->value(pos));
+    Writer rht_writer = buffer_pool_.get_writer(parent->value(pos + 1));
+    if(level == 1) {
+      Leaf *lft_leaf = lft_writer.template as<Leaf>();
+      Leaf *rht_leaf = rht_writer.template as<Leaf>();
+      if(!lft_leaf->is_too_small() && !rht_leaf->is_too_small()) {
+        ++pos;
+        continue;
       }
-    } else {
-      Writer rht_leaf_writer = buffer_pool_.get_writer(parent->value(pos + 1));
-      Leaf *rht_leaf = rht_leaf_writer.template as<Leaf>();
-      if(leaf->size() + rht_leaf->size() <= leaf->merge_bound()) {
-        leaf->merge(rht_leaf);
-        rht_leaf_writer.drop();
+      if(lft_leaf->is_merge_safe(*rht_leaf)) {
+        lft_leaf->merge(rht_leaf);
+        rht_writer.drop();
         buffer_pool_.dealloc(parent->value(pos + 1));
         parent->remove(pos + 1);
-      } else {
-        leaf->redistribute(rht_leaf);
-        parent->write_key(pos + 1, rht_leaf->key(0));
+        ++merged;
+        continue;
       }
-    }
-  }
-  leaf_writer.drop();
-  while(writers.size() > 1) {
-    Writer internal_writer = std::move(writers.back());
-    writers.pop_back();
-    Internal *internal = internal_writer.template as<Internal>();
-    if(!internal->is_too_small())
-      return true;
-    Writer &parent_writer = writers.back();
-    Internal *parent = parent_writer.template as<Internal>();
-    int pos = parent->locate_key(internal->key(0), kv_compare_);
-    if(pos > 0) {
-      Writer lft_writer = buffer_pool_.get_writer(parent->value(pos - 1));
-      Internal *lft_internal = lft_writer.template as<Internal>();
-      if(lft_internal->size() + internal->size() <= internal->merge_bound()) {
-        lft_internal->merge(internal);
-        internal_writer.drop();
-        buffer_pool_.dealloc(parent->value(pos));
-        parent->remove(pos);
-      } else {
-        lft_internal->redistribute(internal);
-        parent->write_key(pos, internal->key(0));
+      if(parent->is_rewrite_safe()) {
+        lft_leaf->redistribute(rht_leaf);
+        parent->write_key(pos + 1, Separator(lft_leaf->key(lft_leaf->size() - 1), rht_leaf->key(0)));
       }
     } else {
-      Writer rht_writer = buffer_pool_.get_writer(parent->value(pos + 1));
+      Internal *lft_internal = lft_writer.template as<Internal>();
       Internal *rht_internal = rht_writer.template as<Internal>();
-      if(internal->size() + rht_internal->size() <= internal->merge_bound()) {
-        internal->merge(rht_internal);
+      if(!lft_internal->is_too_small() && !rht_internal->is_too_small()) {
+        ++pos;
+        continue;
+      }
+      if(lft_internal->is_merge_safe(*rht_internal)) {
+        lft_internal->merge(rht_internal);
         rht_writer.drop();
         buffer_pool_.dealloc(parent->value(pos + 1));
         parent->remove(pos + 1);
-      } else {
-        internal->redistribute(rht_internal);
+        ++merged;
+        continue;
+      }
+      if(parent->is_rewrite_safe()) {
+        lft_internal->redistribute(rht_internal);
         parent->write_key(pos + 1, rht_internal->key(0));
       }
     }
+    ++pos;
   }
-  // If not root, it must be safe.
-  Writer root_writer = std::move(writers.back());
-  writers.pop_back();
-  Internal *root_internal = root_writer.template as<Internal>();
-  if(root_internal->size() > 1)
-    return true;
-  index_t new_root = root_internal->value(0);
-  root_internal->remove(0);
-  root_writer.drop();
-  buffer_pool_.dealloc(root_);
-  root_ = new_root;
-  return true;
+  return merged;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Stats
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::stats() {
+  Stats stats;
+  stats.page_capacity = buffer_pool_.page_capacity();
+  stats.free_pages = buffer_pool_.free_pages();
+  if(cache_) {
+    stats.cache_bytes = cache_->bytes();
+    stats.cache_hits = cache_->hits();
+    stats.cache_misses = cache_->misses();
+  }
+  std::shared_lock root_lock(root_latch_);
+  if(root_ == nullpos)
+    return stats;
+  index_t root = root_;
+  stats.height = height_;
+  // root_ can't be replaced while its page is latched.
+  Reader root_reader = buffer_pool_.get_reader(root);
+  root_lock.unlock();
+  stats.level_pages.resize(stats.height);
+  for(int i = 0; i < stats.height; ++i)
+    stats.level_pages[i] = 0;
+  InspectState state;
+  state.is_seen.resize(stats.page_capacity + 1);
+  for(size_t i = 0; i <= stats.page_capacity; ++i)
+    state.is_seen[i] = 0;
+  Inspect(std::move(root_reader), root, stats.height, nullptr, nullptr, stats, state);
+  if(stats.error.empty() && state.next_leaf != nullpos)
+    stats.error = "the last leaf links to page " + std::to_string(state.next_leaf);
+  return stats;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Inspect(
+  Reader reader, index_t index, int level,
+  const KVType *lower, const KVType *upper, Stats &stats, InspectState &state) {
+  if(!stats.error.empty())
+    return;
+  const std::string where = "page " + std::to_string(index) + ": ";
+  // writers working below a node latched earlier may have allocated pages since.
+  if(index > stats.page_capacity)
+    stats.page_capacity = buffer_pool_.page_capacity();
+  if(index == nullpos || index > stats.page_capacity) {
+    stats.error = where + "not an allocated page";
+    return;
+  }
+  if(state.is_seen.size() <= index) {
+    size_t old_size = state.is_seen.size();
+    state.is_seen.resize(stats.page_capacity + 1);
+    for(size_t i = old_size; i <= stats.page_capacity; ++i)
+      state.is_seen[i] = 0;
+  }
+  if(state.is_seen[index]) {
+    stats.error = where + "reached twice";
+    return;
+  }
+  state.is_seen[index] = 1;
+  ++stats.level_pages[stats.height - level];
+  bool is_root = level == stats.height;
+  auto is_in_bounds = [this, lower, upper] (const KVType &kv) {
+    return (!lower || !kv_compare_(kv, *lower)) && (!upper || kv_compare_(kv, *upper));
+  };
+  const Base *base = reader.template as<Base>();
+  if(base->is_leaf() != (level == 1)) {
+    stats.error = where + (level == 1 ? "internal node on the leaf level" : "leaf above the leaf level");
+    return;
+  }
+  if(level == 1) {
+    const Leaf *leaf = reader.template as<Leaf>();
+    if(!leaf->self_check()) {
+      stats.error = where + "malformed leaf";
+      return;
+    }
+    for(int i = 0; i < leaf->size(); ++i) {
+      if(i > 0 && !kv_compare_(leaf->key(i - 1), leaf->key(i))) {
+        stats.error = where + "keys out of order at " + std::to_string(i);
+        return;
+      }
+      if(!is_in_bounds(leaf->key(i))) {
+        stats.error = where + "key " + std::to_string(i) + " outside the separators above";
+        return;
+      }
+    }
+    if(state.last_leaf != nullpos) {
+      if(state.next_leaf != index) {
+        stats.error = "page " + std::to_string(state.last_leaf) + ": links to page "
+          + std::to_string(state.next_leaf) + " instead of " + std::to_string(index);
+        return;
+      }
+      if(index == state.last_leaf + 1)
+        ++stats.contiguous_links;
+    }
+    state.last_leaf = index;
+    state.next_leaf = leaf->rht_index();
+    stats.entries += leaf->size();
+    ++stats.fill_histogram[std::min(9, static_cast<int>(leaf->fill() * 10))];
+    if(!is_root && leaf->is_too_small())
+      ++stats.underfull_nodes;
+    return;
+  }
+  const Internal *internal = reader.template as<Internal>();
+  if(!internal->self_check() || internal->size() < (is_root ? 2 : 1)) {
+    stats.error = where + "malformed internal node";
+    return;
+  }
+  // key(0) of a leftmost node may be stale: only the separators are checked.
+  for(int i = 1; i < internal->size(); ++i) {
+    if(i > 1 && !kv_compare_(internal->key(i - 1), internal->key(i))) {
+      stats.error = where + "separators out of order at " + std::to_string(i);
+      return;
+    }
+    if(!is_in_bounds(internal->key(i))) {
+      stats.error = where + "separator " + std::to_string(i) + " outside the separators above";
+      return;
+    }
+  }
+  if(!is_root && internal->is_too_small())
+    ++stats.underfull_nodes;
+  for(int i = 0; i < internal->size(); ++i) {
+    KVType child_lower, child_upper;
+    if(i > 0)
+      child_lower = internal->key(i);
+    if(i + 1 < internal->size())
+      child_upper = internal->key(i + 1);
+    // the node stays latched over its subtree, so no split or merge below it slips past the walk.
+    Inspect(buffer_pool_.get_reader(internal->value(i)), internal->value(i), level - 1,
+      i > 0 ? &child_lower : lower, i + 1 < internal->size() ? &child_upper : upper, stats, state);
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class InputIt>
+vector<typename MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::KVType>
+MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::SortedBatch(InputIt first, InputIt last) {
+  vector<KVType> batch;
+  for(; first != last; ++first) {
+    const auto &[key, value] = *first;
+    batch.push_back(KVType(key, value));
+  }
+  sort(batch.data(), batch.data() + batch.size(), kv_compare_);
+  return batch;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class InputIt>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::insert_batch(
+  InputIt first, InputIt last) {
+  auto write_scope = buffer_pool_.write_scope();
+  vector<KVType> batch = SortedBatch(first, last);
+  size_t count = 0, i = 0;
+  LeafBound bound;
+  while(i < batch.size()) {
+    Writer leaf_writer = FindLeafOptim(batch[i], &bound);
+    if(!leaf_writer.is_valid()) {
+      count += InsertEntry(batch[i].key, batch[i].value);
+      ++i;
+      continue;
+    }
+    Leaf *leaf = leaf_writer.template as<Leaf>();
+    bool is_full = false;
+    for(; i < batch.size() && (!bound.bounded || kv_compare_(batch[i], bound.upper)); ++i) {
+      int pos = leaf->locate_key(batch[i], kv_compare_);
+      if(pos != leaf->size() && kv_equal_(leaf->key(pos), batch[i]))
+        continue;
+      if(!leaf->is_insert_safe()) {
+        is_full = true;
+        break;
+      }
+      leaf->insert(pos, batch[i], batch[i].value);
+      ++count;
+    }
+    leaf_writer.drop();
+    if(is_full) {
+      // the split happens here; the rest of the run goes into the two halves.
+      count += InsertEntry(batch[i].key, batch[i].value);
+      ++i;
+    }
+  }
+  InvalidateBatch(batch);
+  return count;
 }
 
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class InputIt>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::remove_batch(
+  InputIt first, InputIt last) {
+  auto write_scope = buffer_pool_.write_scope();
+  vector<KVType> batch = SortedBatch(first, last);
+  size_t count = 0, i = 0;
+  LeafBound bound;
+  while(i < batch.size()) {
+    Writer leaf_writer = FindLeafOptim(batch[i], &bound);
+    if(!leaf_writer.is_valid())
+      break;
+    Leaf *leaf = leaf_writer.template as<Leaf>();
+    bool is_lean = false;
+    for(; i < batch.size() && (!bound.bounded || kv_compare_(batch[i], bound.upper)); ++i) {
+      int pos = leaf->locate_key(batch[i], kv_compare_);
+      if(pos == leaf->size() || !kv_equal_(leaf->key(pos), batch[i]))
+        continue;
+      if(!leaf->is_remove_safe() && compact_after_ == 0) {
+        is_lean = true;
+        break;
+      }
+      leaf->remove(pos);
+      ++count;
+    }
+    bool is_underfull = compact_after_ != 0 && leaf->is_too_small();
+    leaf_writer.drop();
+    if(is_underfull)
+      NoteUnderfull();
+    if(is_lean) {
+      // the merge or redistribution happens here.
+      count += RemoveEntry(batch[i].key, batch[i].value);
+      ++i;
+    }
+  }
+  InvalidateBatch(batch);
+  return count;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class InputIt>
+size_t MultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::bulk_load(
+  InputIt first, InputIt last, double fill_factor) {
+  struct Entry {
+    KVType kv;     // lower bound of the subtree
+    index_t index;
+  };
+  auto write_scope = buffer_pool_.write_scope();
+  RootLock root_lock(root_latch_);
+  if(root_ != nullpos)
+    throw database_exception("Bulk loading into a non-empty tree");
+  vector<index_t> allocated;
+  vector<Entry> level;
+  size_t count = 0;
+  int height = 1;
+  try {
+    // Two nodes of a level are kept latched: the last one may borrow from its left neighbour.
+    // Older nodes are final and written back right away, so pages hit the disk in order.
+    Writer prev_writer, cur_writer;
+    Leaf *prev_leaf = nullptr, *cur_leaf = nullptr;
+    for(; first != last; ++first) {
+      const auto &[key, value] = *first;
+      KVType kv(key, value);
+      if(cur_leaf) {
+        const KVType &last_kv = cur_leaf->key(cur_leaf->size() - 1);
+        if(kv_equal_(kv, last_kv))
+          continue;
+        if(kv_compare_(kv, last_kv))
+          throw database_exception("Bulk loading unsorted input");
+      }
+      if(!cur_leaf || cur_leaf->is_filled(fill_factor)) {
+        index_t index = buffer_pool_.alloc();
+        allocated.push_back(index);
+        Writer writer = buffer_pool_.get_writer(index);
+        Leaf *leaf = writer.template as<Leaf>();
+        leaf->init();
+        if(cur_leaf) {
+          cur_leaf->write_rht_index(index);
+          level.push_back(Entry(Separator(cur_leaf->key(cur_leaf->size() - 1), kv), index));
+        } else {
+          level.push_back(Entry(kv, index));
+        }
+        if(prev_writer.is_valid())
+          prev_writer.flush();
+        prev_writer = std::move(cur_writer);
+        cur_writer = std::move(writer);
+        prev_leaf = cur_leaf;
+        cur_leaf = leaf;
+      }
+      cur_leaf->insert(cur_leaf->size(), kv, value);
+      ++count;
+    }
+    if(count == 0)
+      return 0;
+    if(prev_leaf && cur_leaf->is_too_small()) {
+      if(prev_leaf->is_merge_safe(*cur_leaf)) {
+        prev_leaf->merge(cur_leaf);
+        cur_writer.drop();
+        buffer_pool_.dealloc(level.back().index);
+        allocated.pop_back();
+        level.pop_back();
+      } else {
+        prev_leaf->redistribute(cur_leaf);
+        level.back().kv = Separator(prev_leaf->key(prev_leaf->size() - 1), cur_leaf->key(0));
+      }
+    }
+    if(prev_writer.is_valid())
+      prev_writer.flush();
+    if(cur_writer.is_valid())
+      cur_writer.flush();
+    prev_writer.drop();
+    cur_writer.drop();
+
+    while(level.size() > 1) {
+      vector<Entry> upper_level;
+      Internal *prev_internal = nullptr, *cur_internal = nullptr;
+      for(const Entry &entry : level) {
+        if(!cur_internal || cur_internal->is_filled(fill_factor)) {
+          index_t index = buffer_pool_.alloc();
+          allocated.push_back(index);
+          Writer writer = buffer_pool_.get_writer(index);
+          Internal *internal = writer.template as<Internal>();
+          internal->init();
+          if constexpr(is_prefixed) {
+            // the upper fence of a node is the lower bound of the next one.
+            if(cur_internal) {
+              cur_internal->set_fences(prev_internal != nullptr, &entry.kv);
+              internal->set_fences(true, nullptr);
+            }
+          }
+          if(prev_writer.is_valid())
+            prev_writer.flush();
+          prev_writer = std::move(cur_writer);
+          cur_writer = std::move(writer);
+          prev_internal = cur_internal;
+          cur_internal = internal;
+          upper_level.push_back(Entry(entry.kv, index));
+        }
+        cur_internal->insert(cur_internal->size(), entry.kv, entry.index);
+      }
+      if(prev_internal && cur_internal->is_too_small()) {
+        if(prev_internal->is_merge_safe(*cur_internal)) {
+          prev_internal->merge(cur_internal);
+          cur_writer.drop();
+          buffer_pool_.dealloc(upper_level.back().index);
+          allocated.pop_back();
+          upper_level.pop_back();
+        } else {
+          prev_internal->redistribute(cur_internal);
+          upper_level.back().kv = cur_internal->key(0);
+        }
+      }
+      if(prev_writer.is_valid())
+        prev_writer.flush();
+      if(cur_writer.is_valid())
+        cur_writer.flush();
+      prev_writer.drop();
+      cur_writer.drop();
+      level = std::move(upper_level);
+      ++height;
+    }
+  } catch(...) {
+    // writers are released during unwinding.
+    for(index_t index : allocated)
+      buffer_pool_.dealloc(index);
+    throw;
+  }
+  root_ = level[0].index;
+  height_ = height;
+  SaveRoot();
+  if(cache_)
+    cache_->clear();
+  return count;
+}
 
 }
 
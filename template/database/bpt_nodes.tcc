@@ -1,6 +1,12 @@
 #ifndef INSOMNIA_BPT_NODES_TCC
 #define INSOMNIA_BPT_NODES_TCC
 
+#include <cstdlib>
+#include <cstring>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
 #include "bpt_nodes.h"
 
 namespace insomnia {
@@ -98,25 +104,455 @@ void BptInternalNode<KeyT, ValueT>::redistribute(BptInternalNode *rhs) {
 /*****************************************************************************/
 
 template <Trivial KeyT, Trivial ValueT>
-void BptLeafNode<KeyT, ValueT>::insert(
+requires is_char_array_v<decltype(KeyT::key)>
+int BptPrefixInternalNode<KeyT, ValueT>::common_prefix(const char *lhs, const char *rhs) {
+  int len = 0;
+  while(lhs[len] != '\0' && lhs[len] == rhs[len])
+    ++len;
+  return len;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+KeyT BptPrefixInternalNode<KeyT, ValueT>::key(int pos) const {
+  KeyT key;
+  copy_str(pos, key.key.data());
+  key.value = slots()[pos].pair_value;
+  return key;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+int BptPrefixInternalNode<KeyT, ValueT>::copy_str(int pos, char *str) const {
+  memcpy(str, high(), prefix_len_);
+  memcpy(str + prefix_len_, suffix(pos), slots()[pos].length + 1);
+  return prefix_len_ + slots()[pos].length;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::insert_str(
+  int pos, const char *str, const PairValueT &pair_value, const ValueT &value) {
+  // only a new leftmost key, below the lower fence, can miss the prefix.
+  int shared = 0;
+  while(shared < prefix_len_ && str[shared] == high()[shared])
+    ++shared;
+  if(shared < prefix_len_)
+    repack(shared, has_high_ ? high() : nullptr);
+  str += prefix_len_;
+  int length = std::strlen(str);
+  assert((size() + 1) * SLOT_SIZE + length + 1 <= heap_begin_);
+  heap_begin_ -= length + 1;
+  memcpy(data_ + heap_begin_, str, length + 1);
+  memmove(slots() + pos + 1, slots() + pos, (size() - pos) * SLOT_SIZE);
+  Slot &slot = slots()[pos];
+  slot.value = value;
+  slot.pair_value = pair_value;
+  slot.offset = heap_begin_;
+  slot.length = length;
+  change_size_by(1);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::erase_suffix(int pos) {
+  int offset = slots()[pos].offset, gap = slots()[pos].length + 1;
+  // the suffixes below it move up; the fence lies above all of them.
+  memmove(data_ + heap_begin_ + gap, data_ + heap_begin_, offset - heap_begin_);
+  for(int i = 0; i < size(); ++i)
+    if(slots()[i].offset < offset)
+      slots()[i].offset += gap;
+  heap_begin_ += gap;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::repack(int prefix_len, const char *high) {
+  char fence[FENCE_SIZE];
+  int fence_len = 0;
+  if(high) {
+    fence_len = std::strlen(high);
+    memcpy(fence, high, fence_len + 1);
+  }
+  // built aside: the old prefix is still read from the old fence.
+  char heap[DATA_SIZE];
+  int top = DATA_SIZE;
+  if(high) {
+    top -= fence_len + 1;
+    memcpy(heap + top, fence, fence_len + 1);
+  }
+  const char *old_high = this->high();
+  for(int i = 0; i < size(); ++i) {
+    Slot &slot = slots()[i];
+    const char *str = suffix(i);
+    int length;
+    if(prefix_len <= prefix_len_) {
+      // the chars dropped from the prefix go back in front of the suffix.
+      int gap = prefix_len_ - prefix_len;
+      length = slot.length + gap;
+      top -= length + 1;
+      memcpy(heap + top, old_high + prefix_len, gap);
+      memcpy(heap + top + gap, str, slot.length + 1);
+    } else {
+      int gap = prefix_len - prefix_len_;
+      assert(strncmp(str, fence + prefix_len_, gap) == 0);
+      length = slot.length - gap;
+      top -= length + 1;
+      memcpy(heap + top, str + gap, length + 1);
+    }
+    slot.offset = top;
+    slot.length = length;
+  }
+  assert(top >= size() * SLOT_SIZE);
+  memcpy(data_ + top, heap + top, DATA_SIZE - top);
+  heap_begin_ = top;
+  high_len_ = fence_len;
+  prefix_len_ = prefix_len;
+  has_high_ = high != nullptr;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::write_key(int pos, const KeyT &key) {
+  ValueT value = slots()[pos].value;
+  remove(pos);
+  insert_str(pos, key.key.c_str(), key.value, value);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+template <class KeyCompare>
+int BptPrefixInternalNode<KeyT, ValueT>::locate_key(
+  const KeyT &key, const KeyCompare &key_compare) const {
+  int lft = 1, rht = size() - 1;
+  if(rht < lft)
+    return 0;
+  // keys routed here share the prefix; the check only guards against strays.
+  const char *str = key.key.c_str();
+  int res = strncmp(str, high(), prefix_len_);
+  if(res != 0)
+    return res < 0 ? 0 : rht;
+  str += prefix_len_;
+  auto is_less = [&] (int pos) {
+    int res = strcmp(str, suffix(pos));
+    if(res != 0)
+      return res < 0;
+    return key_compare.value_compare(key.value, slots()[pos].pair_value);
+  };
+  if(is_less(lft))
+    return lft - 1;
+  if(!is_less(rht))
+    return rht;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2 + 1;
+    if(is_less(mid))
+      rht = mid - 1;
+    else
+      lft = mid;
+  }
+  return rht;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+template <class T, class Compare>
+requires requires(const T &t, const KeyT &key, const Compare &compare) {
+  { compare(t, key) } -> std::convertible_to<bool>;
+}
+int BptPrefixInternalNode<KeyT, ValueT>::locate_any(const T &t, const Compare &compare) const {
+  int lft = 1, rht = size() - 1;
+  if(rht < lft)
+    return 0;
+  // the prefix is copied once, suffixes are swapped in per probe.
+  KeyT probe;
+  memcpy(probe.key.data(), high(), prefix_len_);
+  auto is_less = [&] (int pos) {
+    memcpy(probe.key.data() + prefix_len_, suffix(pos), slots()[pos].length + 1);
+    probe.value = slots()[pos].pair_value;
+    return compare(t, probe);
+  };
+  if(is_less(lft))
+    return lft - 1;
+  if(!is_less(rht))
+    return rht;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2 + 1;
+    if(is_less(mid))
+      rht = mid - 1;
+    else
+      lft = mid;
+  }
+  return rht;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::insert(
   int pos, const KeyT &key, const ValueT &value) {
-  memmove(storage_ + pos + 1, storage_ + pos, (size() - pos) * sizeof(Storage));
+  insert_str(pos, key.key.c_str(), key.value, value);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::remove(int pos) {
+  erase_suffix(pos);
+  memmove(slots() + pos, slots() + pos + 1, (size() - pos - 1) * SLOT_SIZE);
+  change_size_by(-1);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::split(BptPrefixInternalNode *rhs) {
+  int tot_size = size();
+  // halve the bytes, not the entries.
+  int half_bytes = (bytes() - (has_high_ ? high_len_ + 1 : 0)) / 2;
+  int lft_size = 0, lft_bytes = 0;
+  while(lft_size < tot_size - 1 && (lft_size == 0 || lft_bytes < half_bytes)) {
+    lft_bytes += SLOT_SIZE + slots()[lft_size].length + 1;
+    ++lft_size;
+  }
+  char low[FENCE_SIZE], sep[FENCE_SIZE], str[FENCE_SIZE];
+  copy_str(0, low);
+  copy_str(lft_size, sep);
+  // the right half keeps the upper fence, and its first key is the lower one.
+  rhs->set_size(0);
+  rhs->has_low_ = true;
+  rhs->repack(has_high_ ? common_prefix(sep, high()) : 0, has_high_ ? high() : nullptr);
+  for(int i = lft_size; i < tot_size; ++i) {
+    copy_str(i, str);
+    rhs->insert_str(i - lft_size, str, slots()[i].pair_value, slots()[i].value);
+  }
+  set_size(lft_size);
+  repack(has_low_ ? common_prefix(low, sep) : 0, sep);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+bool BptPrefixInternalNode<KeyT, ValueT>::is_merge_safe(const BptPrefixInternalNode &rhs) const {
+  int tot_size = size() + rhs.size();
+  int prefix_len = 0;
+  if(has_low_ && rhs.has_high_)
+    prefix_len = common_prefix(key(0).key.c_str(), rhs.high());
+  int merged_bytes = rhs.has_high_ ? rhs.high_len_ + 1 : 0;
+  merged_bytes += tot_size * (SLOT_SIZE + 1 - prefix_len);
+  merged_bytes += size() * prefix_len_ + rhs.size() * rhs.prefix_len_;
+  for(int i = 0; i < size(); ++i)
+    merged_bytes += slots()[i].length;
+  for(int i = 0; i < rhs.size(); ++i)
+    merged_bytes += rhs.slots()[i].length;
+  return merged_bytes <= MERGE_BOUND;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::merge(BptPrefixInternalNode *rhs) {
+  char fence[FENCE_SIZE], str[FENCE_SIZE];
+  const char *high = nullptr;
+  if(rhs->has_high_) {
+    memcpy(fence, rhs->high(), rhs->high_len_ + 1);
+    high = fence;
+  }
+  int prefix_len = 0;
+  if(has_low_ && high && size() + rhs->size() > 0) {
+    if(size() > 0)
+      copy_str(0, str);
+    else
+      rhs->copy_str(0, str);
+    prefix_len = common_prefix(str, high);
+  }
+  repack(prefix_len, high);
+  for(int i = 0; i < rhs->size(); ++i) {
+    rhs->copy_str(i, str);
+    insert_str(size(), str, rhs->slots()[i].pair_value, rhs->slots()[i].value);
+  }
+  rhs->set_size(0);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::redistribute(BptPrefixInternalNode *rhs) {
+  int lft_old_size = size(), rht_old_size = rhs->size();
+  int tot_size = lft_old_size + rht_old_size;
+  char fence[FENCE_SIZE], low[FENCE_SIZE], sep[FENCE_SIZE], str[FENCE_SIZE];
+  const char *high = nullptr;
+  int high_len = 0;
+  if(rhs->has_high_) {
+    high_len = rhs->high_len_;
+    memcpy(fence, rhs->high(), high_len + 1);
+    high = fence;
+  }
+  // the whole key string of entry i of the two nodes together.
+  auto copy_str_of = [this, rhs, lft_old_size] (int i, char *str) {
+    return i < lft_old_size ? copy_str(i, str) : rhs->copy_str(i - lft_old_size, str);
+  };
+  int tot_len = 0;
+  for(int i = 0; i < lft_old_size; ++i)
+    tot_len += prefix_len_ + slots()[i].length;
+  for(int i = 0; i < rht_old_size; ++i)
+    tot_len += rhs->prefix_len_ + rhs->slots()[i].length;
+  // the most even split with both halves within capacity. The current one qualifies.
+  int lft_size = lft_old_size, best_diff = -1;
+  int lft_len = copy_str_of(0, low); // total length of the first i keys.
+  for(int i = 1; i < tot_size; ++i) {
+    int sep_len = copy_str_of(i, sep);
+    int lft_prefix = has_low_ ? common_prefix(low, sep) : 0;
+    int rht_prefix = high ? common_prefix(sep, high) : 0;
+    int lft_bytes = i * (SLOT_SIZE + 1 - lft_prefix) + lft_len + sep_len + 1;
+    int rht_bytes = (tot_size - i) * (SLOT_SIZE + 1 - rht_prefix) + tot_len - lft_len
+      + (high ? high_len + 1 : 0);
+    lft_len += sep_len;
+    if(lft_bytes > BYTE_CAPACITY || rht_bytes > BYTE_CAPACITY)
+      continue;
+    int diff = std::abs(lft_bytes - rht_bytes);
+    if(best_diff < 0 || diff < best_diff) {
+      best_diff = diff;
+      lft_size = i;
+    }
+  }
+  // entries move one by one, and each side is repacked once for its new fences.
+  if(lft_size > lft_old_size) {
+    int diff = lft_size - lft_old_size;
+    rhs->copy_str(diff, sep);
+    repack(has_low_ ? common_prefix(low, sep) : 0, sep);
+    for(int i = 0; i < diff; ++i) {
+      rhs->copy_str(i, str);
+      insert_str(size(), str, rhs->slots()[i].pair_value, rhs->slots()[i].value);
+    }
+    memmove(rhs->slots(), rhs->slots() + diff, (rht_old_size - diff) * SLOT_SIZE);
+    rhs->set_size(rht_old_size - diff);
+    rhs->has_low_ = true;
+    rhs->repack(high ? common_prefix(sep, high) : 0, high);
+  } else if(lft_size < lft_old_size) {
+    copy_str(lft_size, sep);
+    rhs->has_low_ = true;
+    rhs->repack(high ? common_prefix(sep, high) : 0, high);
+    for(int i = lft_size; i < lft_old_size; ++i) {
+      copy_str(i, str);
+      rhs->insert_str(i - lft_size, str, slots()[i].pair_value, slots()[i].value);
+    }
+    set_size(lft_size);
+    repack(has_low_ ? common_prefix(low, sep) : 0, sep);
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptPrefixInternalNode<KeyT, ValueT>::set_fences(bool has_low, const KeyT *high) {
+  char str[FENCE_SIZE];
+  int prefix_len = 0;
+  if(has_low && high && size() > 0) {
+    copy_str(0, str);
+    prefix_len = common_prefix(str, high->key.c_str());
+  }
+  has_low_ = has_low;
+  repack(prefix_len, high ? high->key.c_str() : nullptr);
+}
+
+/*****************************************************************************/
+
+inline void BptStrHead::count(
+  const uint64_t *heads, int size, uint64_t head, int &less, int &not_greater) {
+#if defined(__AVX2__) || defined(__SSE4_2__)
+  int greater = 0;
+  less = 0;
+  int i = 0;
+#if defined(__AVX2__)
+  // no unsigned 64-bit compare: flip the sign bits and compare signed.
+  const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(head), bias);
+  for(; i + 4 <= size; i += 4) {
+    __m256i block = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(heads + i)), bias);
+    less += __builtin_popcount(_mm256_movemask_pd(
+      _mm256_castsi256_pd(_mm256_cmpgt_epi64(target, block))));
+    greater += __builtin_popcount(_mm256_movemask_pd(
+      _mm256_castsi256_pd(_mm256_cmpgt_epi64(block, target))));
+  }
+#else
+  const __m128i bias = _mm_set1_epi64x(INT64_MIN);
+  const __m128i target = _mm_xor_si128(_mm_set1_epi64x(head), bias);
+  for(; i + 2 <= size; i += 2) {
+    __m128i block = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(heads + i)), bias);
+    less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, block))));
+    greater += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(block, target))));
+  }
+#endif
+  for(; i < size; ++i) {
+    less += heads[i] < head;
+    greater += heads[i] > head;
+  }
+  not_greater = size - greater;
+#else
+  // no vector compares to count with: two binary searches over the sorted heads instead.
+  int lft = 0, rht = size;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(heads[mid] < head)
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  less = lft;
+  rht = size;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(heads[mid] <= head)
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  not_greater = lft;
+#endif
+}
+
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::move_entries(
+  BptLeafNode *dst, int dst_pos, const BptLeafNode *src, int src_pos, int count) {
+  memmove(dst->storage_ + dst_pos, src->storage_ + src_pos, count * sizeof(Storage));
+  if constexpr(has_heads)
+    memmove(dst->heads_ + dst_pos, src->heads_ + src_pos, count * sizeof(uint64_t));
+}
+
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::head_range(uint64_t head, int &lft, int &rht) const {
+  HeadT::count(heads_, size(), head, lft, rht);
+}
+
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::insert(
+  int pos, const KeyT &key, const ValueT &value) {
+  move_entries(this, pos + 1, this, pos, size() - pos);
   memcpy(&storage_[pos].key, &key, sizeof(KeyT));
   memcpy(&storage_[pos].value, &value, sizeof(ValueT));
+  if constexpr(has_heads)
+    heads_[pos] = HeadT::of(key);
   change_size_by(1);
 }
 
-template <Trivial KeyT, Trivial ValueT>
-void BptLeafNode<KeyT, ValueT>::remove(int pos) {
-  memmove(storage_ + pos, storage_ + pos + 1, (size() - pos - 1) * sizeof(Storage));
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::remove(int pos) {
+  move_entries(this, pos, this, pos + 1, size() - pos - 1);
   change_size_by(-1);
 }
 
-template <Trivial KeyT, Trivial ValueT>
+template <Trivial KeyT, Trivial ValueT, class HeadT>
 template <class KeyCompare>
-int BptLeafNode<KeyT, ValueT>::locate_key(
+int BptLeafNode<KeyT, ValueT, HeadT>::locate_key(
   const KeyT &key, const KeyCompare &key_compare) const {
   int lft = 0, rht = size() - 1;
+  if constexpr(has_heads) {
+    head_range(HeadT::of(key), lft, rht);
+    // the answer lies in [lft, rht].
+    while(lft < rht) {
+      int mid = (lft + rht) / 2;
+      if(key_compare(storage_[mid].key, key))
+        lft = mid + 1;
+      else
+        rht = mid;
+    }
+    return rht;
+  }
   if(key_compare(storage_[rht].key, key))
     return rht + 1;
   while(lft < rht) {
@@ -129,13 +565,24 @@ int BptLeafNode<KeyT, ValueT>::locate_key(
   return rht;
 }
 
-template <Trivial KeyT, Trivial ValueT>
+template <Trivial KeyT, Trivial ValueT, class HeadT>
 template <class T, class Compare>
 requires requires(const T &t, const KeyT &key, const Compare &compare) {
   { compare(key, t) } -> std::convertible_to<bool>;
 }
-int BptLeafNode<KeyT, ValueT>::locate_any(const T &t, const Compare &compare) const {
+int BptLeafNode<KeyT, ValueT, HeadT>::locate_any(const T &t, const Compare &compare) const {
   int lft = 0, rht = size() - 1;
+  if constexpr(has_heads && requires { HeadT::of(t); }) {
+    head_range(HeadT::of(t), lft, rht);
+    while(lft < rht) {
+      int mid = (lft + rht) / 2;
+      if(compare(storage_[mid].key, t))
+        lft = mid + 1;
+      else
+        rht = mid;
+    }
+    return rht;
+  }
   if(compare(storage_[rht].key, t))
     return rht + 1;
   while(lft < rht) {
@@ -149,45 +596,247 @@ int BptLeafNode<KeyT, ValueT>::locate_any(const T &t, const Compare &compare) co
 }
 
 
-template <Trivial KeyT, Trivial ValueT>
-void BptLeafNode<KeyT, ValueT>::merge(BptLeafNode *rhs) {
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::merge(BptLeafNode *rhs) {
   int lft_old_size = size(), rht_old_size = rhs->size();
   int tot_size = lft_old_size + rht_old_size;
-  memcpy(storage_ + lft_old_size, rhs->storage_, rht_old_size * sizeof(Storage));
+  move_entries(this, lft_old_size, rhs, 0, rht_old_size);
   set_size(tot_size);
   rhs->set_size(0);
   rht_index_ = rhs->rht_index_;
   rhs->rht_index_ = nullpos;
 }
 
-template <Trivial KeyT, Trivial ValueT>
-void BptLeafNode<KeyT, ValueT>::split(BptLeafNode *rhs, index_t rht_index) {
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::split(BptLeafNode *rhs, index_t rht_index) {
   int lft_size = size() / 2, rht_size = size() - lft_size;
-  memcpy(rhs->storage_, storage_ + lft_size, rht_size * sizeof(Storage));
+  move_entries(rhs, 0, this, lft_size, rht_size);
   set_size(lft_size);
   rhs->set_size(rht_size);
   rhs->rht_index_ = rht_index_;
   rht_index_ = rht_index;
 }
 
-template <Trivial KeyT, Trivial ValueT>
-void BptLeafNode<KeyT, ValueT>::redistribute(BptLeafNode *rhs) {
+template <Trivial KeyT, Trivial ValueT, class HeadT>
+void BptLeafNode<KeyT, ValueT, HeadT>::redistribute(BptLeafNode *rhs) {
   int lft_old_size = size(), rht_old_size = rhs->size();
   int tot_size = lft_old_size + rht_old_size;
   int lft_size = tot_size / 2, rht_size = tot_size - lft_size;
   if(lft_old_size < lft_size) {
     int diff = lft_size - lft_old_size;
-    memcpy(storage_ + lft_old_size, rhs->storage_, diff * sizeof(Storage));
-    memmove(rhs->storage_, rhs->storage_ + diff, rht_size * sizeof(Storage));
+    move_entries(this, lft_old_size, rhs, 0, diff);
+    move_entries(rhs, 0, rhs, diff, rht_size);
   } else {
     int diff = lft_old_size - lft_size;
-    memmove(rhs->storage_ + diff, rhs->storage_, rht_old_size * sizeof(Storage));
-    memcpy(rhs->storage_, storage_ + lft_size, diff * sizeof(Storage));
+    move_entries(rhs, diff, rhs, 0, rht_old_size);
+    move_entries(rhs, 0, this, lft_size, diff);
   }
   set_size(lft_size);
   rhs->set_size(rht_size);
 }
 
+
+/*****************************************************************************/
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+KeyT BptSlottedLeafNode<KeyT, ValueT>::key(int pos) const {
+  KeyT key;
+  char *str = key.key.data();
+  uint64_t head = this->head(pos);
+  int head_len = 0;
+  while(head_len < HEAD_LEN && (str[head_len] = static_cast<char>(head >> (56 - 8 * head_len))) != '\0')
+    ++head_len;
+  memcpy(str + head_len, suffix(pos), slots()[pos].length + 1);
+  key.value = slots()[pos].pair_value;
+  return key;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+template <class KeyCompare>
+int BptSlottedLeafNode<KeyT, ValueT>::locate_key(
+  const KeyT &key, const KeyCompare &key_compare) const {
+  // keys are compared in place, without decoding. Tied on the head, they differ past it if at all.
+  const char *target = key.key.c_str();
+  int lft, rht;
+  head_range(BptStrHead::of(target), lft, rht);
+  const char *target_suffix = target + strnlen(target, HEAD_LEN);
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    int res = strcmp(suffix(mid), target_suffix);
+    if(res < 0 || (res == 0 && key_compare.value_compare(slots()[mid].pair_value, key.value)))
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  return lft;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+template <class T, class Compare>
+requires requires(const T &t, const KeyT &key, const Compare &compare) {
+  { compare(key, t) } -> std::convertible_to<bool>;
+}
+int BptSlottedLeafNode<KeyT, ValueT>::locate_any(const T &t, const Compare &compare) const {
+  KeyT probe;
+  int lft = 0, rht = size();
+  if constexpr(requires { BptStrHead::of(t); })
+    head_range(BptStrHead::of(t), lft, rht);
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    probe = key(mid);
+    if(compare(probe, t))
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  return lft;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::head_range(uint64_t head, int &lft, int &rht) const {
+  // heads are sorted with the keys: two binary searches over the slots, without touching the key bytes.
+  lft = 0;
+  rht = size();
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(this->head(mid) < head)
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  int end = size();
+  rht = lft;
+  while(rht < end) {
+    int mid = (rht + end) / 2;
+    if(this->head(mid) <= head)
+      rht = mid + 1;
+    else
+      end = mid;
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::insert(
+  int pos, const KeyT &key, const ValueT &value) {
+  const char *str = key.key.c_str();
+  int head_len = strnlen(str, HEAD_LEN);
+  int length = std::strlen(str + head_len);
+  if((size() + 1) * SLOT_SIZE + length + 1 > heap_begin_)
+    compact();
+  heap_begin_ -= length + 1;
+  memcpy(data_ + heap_begin_, str + head_len, length + 1);
+  memmove(slots() + pos + 1, slots() + pos, (size() - pos) * SLOT_SIZE);
+  Slot &slot = slots()[pos];
+  uint64_t head = BptStrHead::of(str);
+  slot.value = value;
+  slot.pair_value = key.value;
+  slot.head_hi = static_cast<uint32_t>(head >> 32);
+  slot.head_lo = static_cast<uint32_t>(head);
+  slot.offset = heap_begin_;
+  slot.length = length;
+  key_bytes_ += length + 1;
+  change_size_by(1);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::remove(int pos) {
+  const Slot &slot = slots()[pos];
+  key_bytes_ -= slot.length + 1;
+  // the newest key can be given back right away.
+  if(slot.offset == heap_begin_)
+    heap_begin_ += slot.length + 1;
+  memmove(slots() + pos, slots() + pos + 1, (size() - pos - 1) * SLOT_SIZE);
+  change_size_by(-1);
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::remove_range(int pos, int count) {
+  for(int i = pos; i < pos + count; ++i)
+    key_bytes_ -= slots()[i].length + 1;
+  memmove(slots() + pos, slots() + pos + count, (size() - pos - count) * SLOT_SIZE);
+  change_size_by(-count);
+  compact();
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::compact() {
+  char heap[DATA_SIZE];
+  int heap_begin = DATA_SIZE;
+  for(int i = 0; i < size(); ++i) {
+    Slot &slot = slots()[i];
+    heap_begin -= slot.length + 1;
+    memcpy(heap + heap_begin, data_ + slot.offset, slot.length + 1);
+    slot.offset = heap_begin;
+  }
+  memcpy(data_ + heap_begin, heap + heap_begin, DATA_SIZE - heap_begin);
+  heap_begin_ = heap_begin;
+  key_bytes_ = DATA_SIZE - heap_begin;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::split(BptSlottedLeafNode *rhs, index_t rht_index) {
+  int tot_size = size();
+  // halve the bytes, not the entries.
+  int half_bytes = bytes() / 2;
+  int lft_size = 0, lft_bytes = 0;
+  while(lft_size < tot_size - 1 && (lft_size == 0 || lft_bytes < half_bytes)) {
+    lft_bytes += entry_bytes(lft_size);
+    ++lft_size;
+  }
+  for(int i = lft_size; i < tot_size; ++i)
+    rhs->insert(i - lft_size, key(i), value(i));
+  remove_range(lft_size, tot_size - lft_size);
+  rhs->rht_index_ = rht_index_;
+  rht_index_ = rht_index;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::merge(BptSlottedLeafNode *rhs) {
+  for(int i = 0; i < rhs->size(); ++i)
+    insert(size(), rhs->key(i), rhs->value(i));
+  rhs->remove_range(0, rhs->size());
+  rht_index_ = rhs->rht_index_;
+  rhs->rht_index_ = nullpos;
+}
+
+template <Trivial KeyT, Trivial ValueT>
+requires is_char_array_v<decltype(KeyT::key)>
+void BptSlottedLeafNode<KeyT, ValueT>::redistribute(BptSlottedLeafNode *rhs) {
+  int lft_old_size = size(), rht_old_size = rhs->size();
+  int tot_size = lft_old_size + rht_old_size;
+  int tot_bytes = bytes() + rhs->bytes();
+  auto bytes_of = [this, rhs, lft_old_size] (int i) {
+    return i < lft_old_size ? entry_bytes(i) : rhs->entry_bytes(i - lft_old_size);
+  };
+  // the most even split, both halves non-empty.
+  int lft_size = 1, lft_bytes = bytes_of(0);
+  while(lft_size < tot_size - 1 && lft_bytes + bytes_of(lft_size) / 2 < tot_bytes / 2) {
+    lft_bytes += bytes_of(lft_size);
+    ++lft_size;
+  }
+  if(lft_size > lft_old_size) {
+    int diff = lft_size - lft_old_size;
+    for(int i = 0; i < diff; ++i)
+      insert(size(), rhs->key(i), rhs->value(i));
+    rhs->remove_range(0, diff);
+  } else if(lft_size < lft_old_size) {
+    int diff = lft_old_size - lft_size;
+    for(int i = lft_old_size - 1; i >= lft_size; --i)
+      rhs->insert(0, key(i), value(i));
+    remove_range(lft_size, diff);
+  }
+}
+
 }
 
 #endif
\ No newline at end of file
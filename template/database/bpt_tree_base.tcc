@@ -0,0 +1,299 @@
+#ifndef INSOMNIA_BPT_TREE_BASE_TCC
+#define INSOMNIA_BPT_TREE_BASE_TCC
+
+#include "bpt_tree_base.h"
+
+namespace insomnia {
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+template <class... Args>
+BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::BptTreeBase(Args &&...args)
+    : buffer_pool_(std::forward<Args>(args)...) {
+  LoadRoot();
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+void BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::LoadRoot() {
+  RootHolder root_holder;
+  if(buffer_pool_.read_meta(&root_holder))
+    root_ = root_holder.root;
+  else
+    root_ = nullpos;
+  for(index_t index = root_; index != nullpos; ++height_) {
+    Reader reader = buffer_pool_.get_reader(index);
+    if(reader.template as<Base>()->is_leaf())
+      index = nullpos;
+    else
+      index = reader.template as<Internal>()->value(0);
+  }
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+void BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::SaveRoot() {
+  RootHolder root_holder;
+  root_holder.root = root_;
+  buffer_pool_.write_meta(&root_holder);
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+typename BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::Writer
+BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::FindLeafOptim(
+  const SepT &sep, LeafBound *bound) {
+  std::shared_lock root_lock(root_latch_);
+  if(root_ == nullpos)
+    return Writer();
+  if(bound)
+    bound->bounded = false;
+  if(height_ == 1)
+    return buffer_pool_.get_writer(root_);
+  int level = height_;
+  Reader reader = buffer_pool_.get_reader(root_);
+  root_lock.unlock();
+  while(true) {
+    const Internal *internal = reader.template as<Internal>();
+    int pos = internal->locate_key(sep, sep_compare_);
+    index_t index = internal->value(pos);
+    // separators deeper down are tighter.
+    if(bound && pos + 1 < internal->size()) {
+      bound->bounded = true;
+      bound->upper = internal->key(pos + 1);
+    }
+    if(--level == 1)
+      return buffer_pool_.get_writer(index); // parent released after the leaf is latched.
+    reader = buffer_pool_.get_reader(index);
+  }
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+vector<typename BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::Writer>
+BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::FindLeafPessi(
+  RootLock &root_lock, const SepT &sep, bool is_insert) {
+  vector<Writer> writers;
+  writers.push_back(buffer_pool_.get_writer(root_));
+  // looked at, not written: a node is written only once the path below it turns out unsafe.
+  while(!std::as_const(writers.back()).template as<Base>()->is_leaf()) {
+    const Internal *internal = std::as_const(writers.back()).template as<Internal>();
+    int pos = internal->locate_key(sep, sep_compare_);
+    index_t index = internal->value(pos);
+    Writer writer = buffer_pool_.get_writer(index);
+    if(IsSafe(writer, is_insert)) {
+      writers.clear();
+      if(root_lock.owns_lock())
+        root_lock.unlock();
+    }
+    writers.push_back(std::move(writer));
+  }
+  return writers;
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+bool BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::IsSafe(const Writer &writer, bool is_insert) {
+  // Internal may measure fullness its own way.
+  if(writer.template as<Base>()->is_leaf()) {
+    const Leaf *leaf = writer.template as<Leaf>();
+    return is_insert ? leaf->is_insert_safe() : leaf->is_remove_safe();
+  }
+  const Internal *internal = writer.template as<Internal>();
+  return is_insert ? internal->is_insert_safe() : internal->is_remove_safe();
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+SepT BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::Separator(const SepT &lhs, const SepT &rhs) {
+  SepT sep = rhs;
+  if constexpr(is_prefixed) {
+    const char *lft = lhs.key.c_str();
+    char *str = sep.key.data();
+    int len = 0;
+    while(str[len] != '\0' && str[len] == lft[len])
+      ++len;
+    // equal keys are told apart by the rest of the separator, if any.
+    if(str[len] != '\0')
+      str[len + 1] = '\0';
+  }
+  return sep;
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+template <class LeafStep>
+bool BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::InsertPessi(
+  vector<Writer> &writers, const SepT &sep, LeafStep &&leaf_step) {
+  Writer leaf_writer = std::move(writers.back());
+  writers.pop_back();
+  Leaf *leaf = leaf_writer.template as<Leaf>();
+  if(!leaf_step(leaf))
+    return false;
+  if(!leaf->is_too_large())
+    return true;
+  {
+    index_t rhs_index = buffer_pool_.alloc();
+    Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
+    Leaf *rhs_leaf = rhs_writer.template as<Leaf>();
+    rhs_leaf->init();
+    leaf->split(rhs_leaf, rhs_index);
+    SepT rhs_sep = Separator(SepT(leaf->key(leaf->size() - 1)), SepT(rhs_leaf->key(0)));
+    if(writers.empty()) {
+      index_t root_index = buffer_pool_.alloc();
+      Writer root_writer = buffer_pool_.get_writer(root_index);
+      Internal *root_internal = root_writer.template as<Internal>();
+      root_internal->init();
+      root_internal->insert(0, SepT(leaf->key(0)), root_);
+      root_internal->insert(1, rhs_sep, rhs_index);
+      root_ = root_index;
+      ++height_;
+      SaveRoot();
+      return true;
+    }
+    Internal *parent = writers.back().template as<Internal>();
+    // key(0) of a leftmost node may be stale; sep is what the path was found by.
+    int lft_pos = parent->locate_key(sep, sep_compare_);
+    parent->insert(lft_pos + 1, rhs_sep, rhs_index);
+  }
+  leaf_writer.drop();
+  while(writers.size() > 1) {
+    Writer internal_writer = std::move(writers.back());
+    writers.pop_back();
+    Internal *internal = internal_writer.template as<Internal>();
+    if(!internal->is_too_large())
+      return true;
+    index_t rhs_index = buffer_pool_.alloc();
+    Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
+    Internal *rhs_internal = rhs_writer.template as<Internal>();
+    rhs_internal->init();
+    internal->split(rhs_internal);
+    Internal *parent = writers.back().template as<Internal>();
+    int lft_pos = parent->locate_key(sep, sep_compare_);
+    parent->insert(lft_pos + 1, rhs_internal->key(0), rhs_index);
+  }
+  // if not root, it must be safe.
+  Writer root_writer = std::move(writers.back());
+  writers.pop_back();
+  Internal *root_internal = root_writer.template as<Internal>();
+  if(!root_internal->is_too_large())
+    return true;
+  index_t rhs_index = buffer_pool_.alloc();
+  Writer rhs_writer = buffer_pool_.get_writer(rhs_index);
+  Internal *rhs_internal = rhs_writer.template as<Internal>();
+  rhs_internal->init();
+  root_internal->split(rhs_internal);
+  index_t new_root_index = buffer_pool_.alloc();
+  Writer new_root_writer = buffer_pool_.get_writer(new_root_index);
+  Internal *new_root_internal = new_root_writer.template as<Internal>();
+  new_root_internal->init();
+  new_root_internal->insert(0, root_internal->key(0), root_);
+  new_root_internal->insert(1, rhs_internal->key(0), rhs_index);
+  root_ = new_root_index;
+  ++height_;
+  SaveRoot();
+  return true;
+}
+
+template <class SepT, class SepCompare, class LeafT, bool is_prefixed>
+template <class LeafStep>
+bool BptTreeBase<SepT, SepCompare, LeafT, is_prefixed>::RemovePessi(
+  vector<Writer> &writers, const SepT &sep, LeafStep &&leaf_step) {
+  Writer leaf_writer = std::move(writers.back());
+  writers.pop_back();
+  Leaf *leaf = leaf_writer.template as<Leaf>();
+  if(!leaf_step(leaf))
+    return false;
+  if(!leaf->is_too_small())
+    return true;
+  {
+    if(writers.empty()) {
+      if(leaf->size() == 0) {
+        leaf_writer.drop();
+        buffer_pool_.dealloc(root_);
+        root_ = nullpos;
+        height_ = 0;
+        SaveRoot();
+      }
+      return true;
+    }
+    Internal *parent = writers.back().template as<Internal>();
+    // the leaf may be empty by now, and key(0) of a leftmost node may be stale.
+    int pos = parent->locate_key(sep, sep_compare_);
+    if(pos > 0) {
+      // Leaves are latched from left to right, the same order cursors walk the chain.
+      // Nobody else reaches this leaf while the parent is write-latched, so it is safe to let it go.
+      leaf_writer.drop();
+      Writer lft_leaf_writer = buffer_pool_.get_writer(parent->value(pos - 1));
+      leaf_writer = buffer_pool_.get_writer(parent->value(pos));
+      leaf = leaf_writer.template as<Leaf>();
+      Leaf *lft_leaf = lft_leaf_writer.template as<Leaf>();
+      if(lft_leaf->is_merge_safe(*leaf)) {
+        lft_leaf->merge(leaf);
+        leaf_writer.drop();
+        buffer_pool_.dealloc(parent->value(pos));
+        parent->remove(pos);
+      } else if(parent->is_rewrite_safe()) {
+        lft_leaf->redistribute(leaf);
+        parent->write_key(pos, Separator(SepT(lft_leaf->key(lft_leaf->size() - 1)), SepT(leaf->key(0))));
+      }
+    } else {
+      Writer rht_leaf_writer = buffer_pool_.get_writer(parent->value(pos + 1));
+      Leaf *rht_leaf = rht_leaf_writer.template as<Leaf>();
+      if(leaf->is_merge_safe(*rht_leaf)) {
+        leaf->merge(rht_leaf);
+        rht_leaf_writer.drop();
+        buffer_pool_.dealloc(parent->value(pos + 1));
+        parent->remove(pos + 1);
+      } else if(parent->is_rewrite_safe()) {
+        leaf->redistribute(rht_leaf);
+        parent->write_key(pos + 1, Separator(SepT(leaf->key(leaf->size() - 1)), SepT(rht_leaf->key(0))));
+      }
+    }
+  }
+  leaf_writer.drop();
+  while(writers.size() > 1) {
+    Writer internal_writer = std::move(writers.back());
+    writers.pop_back();
+    Internal *internal = internal_writer.template as<Internal>();
+    if(!internal->is_too_small())
+      return true;
+    Internal *parent = writers.back().template as<Internal>();
+    int pos = parent->locate_key(sep, sep_compare_);
+    if(pos > 0) {
+      Writer lft_writer = buffer_pool_.get_writer(parent->value(pos - 1));
+      Internal *lft_internal = lft_writer.template as<Internal>();
+      if(lft_internal->is_merge_safe(*internal)) {
+        lft_internal->merge(internal);
+        internal_writer.drop();
+        buffer_pool_.dealloc(parent->value(pos));
+        parent->remove(pos);
+      } else if(parent->is_rewrite_safe()) {
+        lft_internal->redistribute(internal);
+        parent->write_key(pos, internal->key(0));
+      }
+    } else {
+      Writer rht_writer = buffer_pool_.get_writer(parent->value(pos + 1));
+      Internal *rht_internal = rht_writer.template as<Internal>();
+      if(internal->is_merge_safe(*rht_internal)) {
+        internal->merge(rht_internal);
+        rht_writer.drop();
+        buffer_pool_.dealloc(parent->value(pos + 1));
+        parent->remove(pos + 1);
+      } else if(parent->is_rewrite_safe()) {
+        internal->redistribute(rht_internal);
+        parent->write_key(pos + 1, rht_internal->key(0));
+      }
+    }
+  }
+  // If not root, it must be safe.
+  Writer root_writer = std::move(writers.back());
+  writers.pop_back();
+  Internal *root_internal = root_writer.template as<Internal>();
+  if(root_internal->size() > 1)
+    return true;
+  index_t new_root = root_internal->value(0);
+  root_internal->remove(0);
+  root_writer.drop();
+  buffer_pool_.dealloc(root_);
+  root_ = new_root;
+  --height_;
+  SaveRoot();
+  return true;
+}
+
+}
+
+#endif
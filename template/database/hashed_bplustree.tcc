@@ -0,0 +1,108 @@
+#ifndef INSOMNIA_HASHED_BPLUSTREE_TCC
+#define INSOMNIA_HASHED_BPLUSTREE_TCC
+
+#include "hashed_bplustree.h"
+
+namespace insomnia {
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::HashedMultiBPlusTree(
+  const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, size_t thread_num)
+    : tree_(name, k_param, buffer_capacity, thread_num),
+      dict_(std::filesystem::path(name).concat(".dict"), k_param, buffer_capacity, thread_num) {}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+bool HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::FindSalt(
+  const KeyT &key, const HashT &hash, bool create, unsigned &salt) {
+  for(const DictEntry &entry : dict_.search(hash))
+    if(entry.key == key) {
+      salt = entry.salt;
+      return true;
+    }
+  if(!create)
+    return false;
+  std::lock_guard lock(dict_latch_);
+  // someone may have registered it in the meantime.
+  vector<DictEntry> entries = dict_.search(hash);
+  for(const DictEntry &entry : entries)
+    if(entry.key == key) {
+      salt = entry.salt;
+      return true;
+    }
+  // entries come ordered by salt.
+  salt = entries.empty() ? 0 : entries.back().salt + 1;
+  dict_.insert(hash, DictEntry(key, salt));
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+vector<ValueT> HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::search(const KeyT &key) {
+  HashT hash(key.c_str());
+  unsigned salt;
+  if(!FindSalt(key, hash, false, salt))
+    return vector<ValueT>();
+  return tree_.search(HashKey(hash, salt));
+}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+bool HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::insert(
+  const KeyT &key, const ValueT &value) {
+  HashT hash(key.c_str());
+  unsigned salt;
+  FindSalt(key, hash, true, salt);
+  return tree_.insert(HashKey(hash, salt), value);
+}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+bool HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::remove(
+  const KeyT &key, const ValueT &value) {
+  HashT hash(key.c_str());
+  unsigned salt;
+  if(!FindSalt(key, hash, false, salt))
+    return false;
+  return tree_.remove(HashKey(hash, salt), value);
+}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+template <class InputIt>
+size_t HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::insert_batch(
+  InputIt first, InputIt last) {
+  vector<std::pair<HashKey, ValueT>> batch;
+  for(; first != last; ++first) {
+    const auto &[key, value] = *first;
+    const KeyT &str = key;
+    HashT hash(str.c_str());
+    unsigned salt;
+    FindSalt(str, hash, true, salt);
+    batch.push_back({HashKey(hash, salt), value});
+  }
+  return tree_.insert_batch(batch.begin(), batch.end());
+}
+
+template <Trivial KeyT, Trivial ValueT, class ValueCompare, Trivial HashT>
+requires is_char_array_v<KeyT>
+template <class InputIt>
+size_t HashedMultiBPlusTree<KeyT, ValueT, ValueCompare, HashT>::remove_batch(
+  InputIt first, InputIt last) {
+  vector<std::pair<HashKey, ValueT>> batch;
+  for(; first != last; ++first) {
+    const auto &[key, value] = *first;
+    const KeyT &str = key;
+    HashT hash(str.c_str());
+    unsigned salt;
+    if(FindSalt(str, hash, false, salt))
+      batch.push_back({HashKey(hash, salt), value});
+  }
+  return tree_.remove_batch(batch.begin(), batch.end());
+}
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef INSOMNIA_INDEXED_TABLE_TCC
+#define INSOMNIA_INDEXED_TABLE_TCC
+
+#include "indexed_table.h"
+
+namespace insomnia {
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+IndexedTable<RecordT, Indexes...>::IndexedTable(
+  const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, size_t thread_num)
+    : scheduler_(thread_num),
+      store_(std::filesystem::path(name).concat(".records"),
+        k_param, buffer_capacity / (1 + sizeof...(Indexes)), scheduler_) {
+  size_t share = buffer_capacity / (1 + sizeof...(Indexes));
+  [&]<size_t ...I>(std::index_sequence<I...>) {
+    ((std::get<I>(indexes_) = std::make_unique<Tree<Indexes>>(
+      std::filesystem::path(name).concat(".index" + std::to_string(I)), k_param, share, scheduler_)), ...);
+  }(std::index_sequence_for<Indexes...>());
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+template <class F>
+void IndexedTable<RecordT, Indexes...>::ForEachIndex(const RecordT &record, F &&f) {
+  [&]<size_t ...I>(std::index_sequence<I...>) {
+    (f(*std::get<I>(indexes_), typename Indexes::key_type(Indexes::key_of(record))), ...);
+  }(std::index_sequence_for<Indexes...>());
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+RID IndexedTable<RecordT, Indexes...>::insert(const RecordT &record) {
+  RID rid = store_.insert(record);
+  ForEachIndex(record, [&rid] (auto &tree, const auto &key) { tree.insert(key, rid); });
+  return rid;
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+bool IndexedTable<RecordT, Indexes...>::read(const RID &rid, RecordT &record) {
+  return store_.read(rid, record);
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+bool IndexedTable<RecordT, Indexes...>::update(const RID &rid, const RecordT &record) {
+  RecordT old_record;
+  if(!store_.read(rid, old_record))
+    return false;
+  store_.update(rid, record);
+  [&]<size_t ...I>(std::index_sequence<I...>) {
+    auto reindex = [&rid] (auto &tree, const auto &old_key, const auto &new_key) {
+      std::less<std::remove_cvref_t<decltype(old_key)>> less;
+      if(!less(old_key, new_key) && !less(new_key, old_key))
+        return;
+      tree.remove(old_key, rid);
+      tree.insert(new_key, rid);
+    };
+    (reindex(*std::get<I>(indexes_),
+      typename Indexes::key_type(Indexes::key_of(old_record)),
+      typename Indexes::key_type(Indexes::key_of(record))), ...);
+  }(std::index_sequence_for<Indexes...>());
+  return true;
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+bool IndexedTable<RecordT, Indexes...>::remove(const RID &rid) {
+  RecordT record;
+  if(!store_.read(rid, record))
+    return false;
+  ForEachIndex(record, [&rid] (auto &tree, const auto &key) { tree.remove(key, rid); });
+  return store_.remove(rid);
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+template <class Visitor>
+bool IndexedTable<RecordT, Indexes...>::Visit(const RID &rid, Visitor &visitor, size_t &visited) {
+  RecordT record;
+  if(!store_.read(rid, record))
+    return true;
+  ++visited;
+  auto call = [&visitor, &rid] (const RecordT &record) {
+    if constexpr(std::invocable<Visitor&, const RID&, const RecordT&>)
+      return visitor(rid, record);
+    else
+      return visitor(record);
+  };
+  if constexpr(std::is_convertible_v<decltype(call(record)), bool>)
+    return call(record);
+  else {
+    call(record);
+    return true;
+  }
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+template <class Index>
+vector<RecordT> IndexedTable<RecordT, Indexes...>::search(const typename Index::key_type &key) {
+  vector<RecordT> result;
+  search<Index>(key, [&result] (const RecordT &record) { result.push_back(record); });
+  return result;
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+template <class Index, class Visitor>
+requires TableVisitor<Visitor, RecordT>
+size_t IndexedTable<RecordT, Indexes...>::search(const typename Index::key_type &key, Visitor &&visitor) {
+  size_t visited = 0;
+  // records are read under the leaf latch of the index; the store never waits on index latches.
+  IndexTree<Index>().search(key, [this, &visitor, &visited] (const RID &rid) {
+    return Visit(rid, visitor, visited);
+  });
+  return visited;
+}
+
+template <Trivial RecordT, class ...Indexes>
+requires (TableIndex<Indexes, RecordT> && ...)
+template <class Index, class Visitor>
+requires TableVisitor<Visitor, RecordT>
+size_t IndexedTable<RecordT, Indexes...>::range(
+  const typename Index::key_type &lower, const typename Index::key_type &upper, Visitor &&visitor) {
+  size_t visited = 0;
+  for(auto cursor = IndexTree<Index>().range(lower, upper); cursor.valid(); cursor.next())
+    if(!Visit(cursor.value(), visitor, visited))
+      break;
+  return visited;
+}
+
+}
+
+#endif
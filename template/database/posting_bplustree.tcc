@@ -0,0 +1,284 @@
+#ifndef INSOMNIA_POSTING_BPLUSTREE_TCC
+#define INSOMNIA_POSTING_BPLUSTREE_TCC
+
+#include <cstring>
+
+#include "posting_bplustree.h"
+
+namespace insomnia {
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::PostingMultiBPlusTree(
+  const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, size_t thread_num)
+    : tree_(name, k_param, buffer_capacity, thread_num),
+      buffer_pool_(std::filesystem::path(name).concat(".posting"), k_param, buffer_capacity, thread_num) {}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+int PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::LowerBound(
+  const ValueT *values, int size, const ValueT &value) const {
+  int lft = 0, rht = size;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(value_compare_(values[mid], value))
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  return lft;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+vector<ValueT> PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(const KeyT &key) {
+  vector<ValueT> result;
+  search(key, [&result] (const ValueT &value) { result.push_back(value); });
+  return result;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+template <class Visitor>
+requires std::invocable<Visitor&, const ValueT&>
+size_t PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::search(
+  const KeyT &key, Visitor &&visitor, size_t limit) {
+  constexpr bool can_stop = std::is_convertible_v<std::invoke_result_t<Visitor&, const ValueT&>, bool>;
+  size_t visited = 0;
+  // false once the search should stop.
+  auto visit_run = [&visitor, &visited, limit] (const ValueT *values, int size) {
+    for(int i = 0; i < size; ++i) {
+      ++visited;
+      if constexpr(can_stop) {
+        if(!visitor(values[i]))
+          return false;
+      } else
+        visitor(values[i]);
+      if(visited == limit)
+        return false;
+    }
+    return true;
+  };
+  if(limit == 0)
+    return 0;
+  tree_.visit(key, [this, &visit_run] (const PostingHead &head) {
+    if(head.head_index == nullpos) {
+      visit_run(head.values, head.size);
+      return;
+    }
+    for(index_t index = head.head_index; index != nullpos; ) {
+      Reader reader = buffer_pool_.get_reader(index);
+      const PostingPage *page = reader.as();
+      if(!visit_run(page->values, page->size))
+        return;
+      index = page->rht_index;
+    }
+  });
+  return visited;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+size_t PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::count(const KeyT &key) {
+  size_t result = 0;
+  tree_.visit(key, [&result] (const PostingHead &head) { result = head.size; });
+  return result;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(
+  const KeyT &key, const ValueT &value) {
+  while(true) {
+    bool inserted = false;
+    if(tree_.update(key, [this, &value, &inserted] (PostingHead &head) { inserted = InsertValue(head, value); }))
+      return inserted;
+    PostingHead head;
+    head.size = 1;
+    head.head_index = head.tail_index = nullpos;
+    head.values[0] = value;
+    if(tree_.insert(key, head))
+      return true;
+    // the key showed up in between. Rare.
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::remove(
+  const KeyT &key, const ValueT &value) {
+  bool removed = false;
+  if(!tree_.update(key, [this, &value, &removed] (PostingHead &head) { removed = RemoveValue(head, value); }))
+    return false;
+  // the key may have got a value again in the meantime.
+  if(removed)
+    tree_.remove_if(key, [] (const PostingHead &head) { return head.size == 0; });
+  return removed;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::InsertValue(
+  PostingHead &head, const ValueT &value) {
+  if(head.head_index == nullpos) {
+    int size = head.size;
+    int pos = LowerBound(head.values, size, value);
+    if(pos != size && !value_compare_(value, head.values[pos]))
+      return false;
+    if(size == PostingHead::INLINE_CAPACITY) {
+      Spill(head, value);
+      return true;
+    }
+    memmove(head.values + pos + 1, head.values + pos, (size - pos) * sizeof(ValueT));
+    head.values[pos] = value;
+    ++head.size;
+    return true;
+  }
+  // runs mostly grow at the end: try the tail before walking the chain.
+  index_t index = head.tail_index;
+  {
+    Reader tail_reader = buffer_pool_.get_reader(index);
+    if(value_compare_(value, tail_reader.as()->values[0])) {
+      tail_reader.drop();
+      // the first page whose last value is not less than value, or the tail.
+      index = head.head_index;
+      while(true) {
+        Reader reader = buffer_pool_.get_reader(index);
+        const PostingPage *page = reader.as();
+        if(page->rht_index == nullpos || !value_compare_(page->values[page->size - 1], value))
+          break;
+        index = page->rht_index;
+      }
+    }
+  }
+  Writer writer = buffer_pool_.get_writer(index);
+  PostingPage *page = writer.as();
+  int pos = LowerBound(page->values, page->size, value);
+  if(pos != page->size && !value_compare_(value, page->values[pos]))
+    return false;
+  Writer rhs_writer;
+  if(page->size == PostingPage::CAPACITY) {
+    index_t rhs_index = buffer_pool_.alloc();
+    rhs_writer = buffer_pool_.get_writer(rhs_index);
+    PostingPage *rhs_page = rhs_writer.as();
+    // growing at either end of the run leaves a full page behind instead of two halves.
+    int keep = page->size / 2;
+    if(pos == page->size && page->rht_index == nullpos)
+      keep = page->size;
+    else if(pos == 0 && index == head.head_index)
+      keep = 0;
+    rhs_page->size = page->size - keep;
+    rhs_page->rht_index = page->rht_index;
+    memcpy(rhs_page->values, page->values + keep, rhs_page->size * sizeof(ValueT));
+    page->size = keep;
+    page->rht_index = rhs_index;
+    if(head.tail_index == index)
+      head.tail_index = rhs_index;
+    if(pos > keep || rhs_page->size == 0) {
+      page = rhs_page;
+      pos -= keep;
+    }
+  }
+  memmove(page->values + pos + 1, page->values + pos, (page->size - pos) * sizeof(ValueT));
+  page->values[pos] = value;
+  ++page->size;
+  ++head.size;
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+bool PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::RemoveValue(
+  PostingHead &head, const ValueT &value) {
+  if(head.head_index == nullpos) {
+    int size = head.size;
+    int pos = LowerBound(head.values, size, value);
+    if(pos == size || value_compare_(value, head.values[pos]))
+      return false;
+    memmove(head.values + pos, head.values + pos + 1, (size - pos - 1) * sizeof(ValueT));
+    --head.size;
+    return true;
+  }
+  // the first page whose last value is not less than value. Its left neighbour is kept for unlinking.
+  index_t lft_index = nullpos, index = head.head_index;
+  while(true) {
+    Reader reader = buffer_pool_.get_reader(index);
+    const PostingPage *page = reader.as();
+    if(!value_compare_(page->values[page->size - 1], value))
+      break;
+    if(page->rht_index == nullpos)
+      return false;
+    lft_index = index;
+    index = page->rht_index;
+  }
+  {
+    Writer writer = buffer_pool_.get_writer(index);
+    PostingPage *page = writer.as();
+    int pos = LowerBound(page->values, page->size, value);
+    if(pos == page->size || value_compare_(value, page->values[pos]))
+      return false;
+    memmove(page->values + pos, page->values + pos + 1, (page->size - pos - 1) * sizeof(ValueT));
+    --page->size;
+    if(page->size == 0) {
+      index_t rht_index = page->rht_index;
+      writer.drop();
+      if(lft_index == nullpos)
+        head.head_index = rht_index;
+      else
+        buffer_pool_.get_writer(lft_index).as()->rht_index = rht_index;
+      if(head.tail_index == index)
+        head.tail_index = lft_index;
+      buffer_pool_.dealloc(index);
+    } else if(page->rht_index != nullpos) {
+      Writer rht_writer = buffer_pool_.get_writer(page->rht_index);
+      PostingPage *rht_page = rht_writer.as();
+      // neighbours that fit in half a page are merged.
+      if(page->size + rht_page->size <= PostingPage::CAPACITY / 2) {
+        index_t rht_index = page->rht_index;
+        memcpy(page->values + page->size, rht_page->values, rht_page->size * sizeof(ValueT));
+        page->size += rht_page->size;
+        page->rht_index = rht_page->rht_index;
+        rht_writer.drop();
+        if(head.tail_index == rht_index)
+          head.tail_index = index;
+        buffer_pool_.dealloc(rht_index);
+      }
+    }
+  }
+  --head.size;
+  // half the inline capacity, so that a run at the border doesn't move back and forth.
+  if(head.size <= PostingHead::INLINE_CAPACITY / 2)
+    Unspill(head);
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Spill(
+  PostingHead &head, const ValueT &value) {
+  index_t index = buffer_pool_.alloc();
+  Writer writer = buffer_pool_.get_writer(index);
+  PostingPage *page = writer.as();
+  int size = head.size;
+  int pos = LowerBound(head.values, size, value);
+  memcpy(page->values, head.values, pos * sizeof(ValueT));
+  page->values[pos] = value;
+  memcpy(page->values + pos + 1, head.values + pos, (size - pos) * sizeof(ValueT));
+  page->size = size + 1;
+  page->rht_index = nullpos;
+  head.head_index = head.tail_index = index;
+  ++head.size;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare>
+void PostingMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare>::Unspill(PostingHead &head) {
+  int size = 0;
+  for(index_t index = head.head_index; index != nullpos; ) {
+    index_t rht_index;
+    {
+      Reader reader = buffer_pool_.get_reader(index);
+      const PostingPage *page = reader.as();
+      memcpy(head.values + size, page->values, page->size * sizeof(ValueT));
+      size += page->size;
+      rht_index = page->rht_index;
+    }
+    buffer_pool_.dealloc(index);
+    index = rht_index;
+  }
+  head.head_index = head.tail_index = nullpos;
+}
+
+}
+
+#endif
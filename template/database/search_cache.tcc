@@ -0,0 +1,118 @@
+#ifndef INSOMNIA_SEARCH_CACHE_TCC
+#define INSOMNIA_SEARCH_CACHE_TCC
+
+#include "search_cache.h"
+
+namespace insomnia {
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+SearchCache<KeyT, ValueT, Hash, KeyEqual>::SearchCache(size_t byte_budget)
+  : shard_budget_(byte_budget / SHARD_COUNT) {}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+SearchCache<KeyT, ValueT, Hash, KeyEqual>::~SearchCache() {
+  for(Shard &shard : shards_)
+    for(Entry *entry = shard.head, *nxt; entry != nullptr; entry = nxt) {
+      nxt = entry->nxt;
+      delete entry;
+    }
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+size_t SearchCache<KeyT, ValueT, Hash, KeyEqual>::Stripe(const KeyT &key) const {
+  // std::hash of an integer is the integer itself: spread it before taking the top bits.
+  uint64_t mixed = static_cast<uint64_t>(hash_(key)) * 0x9e3779b97f4a7c15ull;
+  return (mixed >> 32) % STRIPE_COUNT;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::Link(Shard &shard, Entry *entry) {
+  entry->prv = nullptr;
+  entry->nxt = shard.head;
+  if(shard.head)
+    shard.head->prv = entry;
+  else
+    shard.tail = entry;
+  shard.head = entry;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::Unlink(Shard &shard, Entry *entry) {
+  (entry->prv ? entry->prv->nxt : shard.head) = entry->nxt;
+  (entry->nxt ? entry->nxt->prv : shard.tail) = entry->prv;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::Drop(Shard &shard, Entry *entry) {
+  Unlink(shard, entry);
+  shard.entries.erase(entry->key);
+  shard.bytes -= entry->bytes;
+  bytes_ -= entry->bytes;
+  delete entry;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+typename SearchCache<KeyT, ValueT, Hash, KeyEqual>::Values
+SearchCache<KeyT, ValueT, Hash, KeyEqual>::lookup(const KeyT &key) {
+  Shard &shard = ShardOf(key);
+  std::unique_lock lock(shard.latch);
+  auto it = shard.entries.find(key);
+  if(it == shard.entries.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  Entry *entry = it->second;
+  Unlink(shard, entry);
+  Link(shard, entry);
+  return entry->values;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::store(
+  const KeyT &key, uint64_t generation, vector<ValueT> &&values) {
+  // the entry, its map node and the values.
+  size_t bytes = sizeof(Entry) + sizeof(KeyT) + 4 * sizeof(void*) + values.size() * sizeof(ValueT);
+  if(bytes > shard_budget_)
+    return;
+  size_t stripe = Stripe(key);
+  Shard &shard = shards_[stripe % SHARD_COUNT];
+  std::unique_lock lock(shard.latch);
+  if(generations_[stripe].load() != generation)
+    return;
+  if(auto it = shard.entries.find(key); it != shard.entries.end())
+    Drop(shard, it->second);
+  while(shard.bytes + bytes > shard_budget_)
+    Drop(shard, shard.tail);
+  Entry *entry = new Entry(key, std::make_shared<const vector<ValueT>>(std::move(values)), bytes);
+  Link(shard, entry);
+  shard.entries.insert({key, entry});
+  shard.bytes += bytes;
+  bytes_ += bytes;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::invalidate(const KeyT &key) {
+  size_t stripe = Stripe(key);
+  Shard &shard = shards_[stripe % SHARD_COUNT];
+  std::unique_lock lock(shard.latch);
+  ++generations_[stripe];
+  if(auto it = shard.entries.find(key); it != shard.entries.end())
+    Drop(shard, it->second);
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void SearchCache<KeyT, ValueT, Hash, KeyEqual>::clear() {
+  for(size_t s = 0; s < SHARD_COUNT; ++s) {
+    Shard &shard = shards_[s];
+    std::unique_lock lock(shard.latch);
+    for(size_t stripe = s; stripe < STRIPE_COUNT; stripe += SHARD_COUNT)
+      ++generations_[stripe];
+    while(shard.tail)
+      Drop(shard, shard.tail);
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef INSOMNIA_SHARDED_BPLUSTREE_TCC
+#define INSOMNIA_SHARDED_BPLUSTREE_TCC
+
+#include "sharded_bplustree.h"
+
+namespace insomnia {
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::ShardedMultiBPlusTree(
+  const std::filesystem::path &name, size_t shard_count,
+  size_t k_param, size_t buffer_capacity, size_t thread_num, LogMode log_mode)
+    : scheduler_(thread_num) {
+  if(shard_count == 0)
+    throw database_exception("A sharded tree needs at least one shard");
+  for(size_t i = 0; i < shard_count; ++i)
+    shards_.push_back(std::make_unique<Tree>(std::filesystem::path(name).concat(".shard" + std::to_string(i)),
+      k_param, buffer_capacity / shard_count, scheduler_, log_mode));
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+size_t ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::ShardIndex(const KeyT &key) const {
+  // std::hash of an integer is the integer itself: spread it before taking the top bits.
+  uint64_t mixed = static_cast<uint64_t>(key_hash_(key)) * 0x9e3779b97f4a7c15ull;
+  return (mixed >> 32) % shards_.size();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+template <class InputIt, class F>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::SplitBatch(
+  InputIt first, InputIt last, F &&f) {
+  vector<vector<std::pair<KeyT, ValueT>>> batches(shards_.size());
+  for(; first != last; ++first) {
+    const auto &[key, value] = *first;
+    batches[ShardIndex(key)].push_back({key, value});
+  }
+  for(size_t i = 0; i < shards_.size(); ++i)
+    if(!batches[i].empty())
+      f(*shards_[i], batches[i]);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+template <class InputIt>
+size_t ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::insert_batch(
+  InputIt first, InputIt last) {
+  size_t count = 0;
+  SplitBatch(first, last, [&count] (Tree &shard, auto &batch) {
+    count += shard.insert_batch(batch.begin(), batch.end());
+  });
+  return count;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+template <class InputIt>
+size_t ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::remove_batch(
+  InputIt first, InputIt last) {
+  size_t count = 0;
+  SplitBatch(first, last, [&count] (Tree &shard, auto &batch) {
+    count += shard.remove_batch(batch.begin(), batch.end());
+  });
+  return count;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+template <class InputIt>
+size_t ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::bulk_load(
+  InputIt first, InputIt last, double fill_factor) {
+  vector<vector<std::pair<KeyT, ValueT>>> batches(shards_.size());
+  KeyCompare key_compare;
+  ValueCompare value_compare;
+  std::pair<KeyT, ValueT> prev;
+  for(InputIt it = first; it != last; ++it) {
+    const auto &[key, value] = *it;
+    // each shard only sees its own part of the input, so the order across shards is checked here.
+    if(it != first && (key_compare(key, prev.first) ||
+      (!key_compare(prev.first, key) && value_compare(value, prev.second))))
+      throw database_exception("Bulk loading unsorted input");
+    prev = {key, value};
+    batches[ShardIndex(key)].push_back(prev);
+  }
+  size_t count = 0;
+  for(size_t i = 0; i < shards_.size(); ++i)
+    count += shards_[i]->bulk_load(batches[i].begin(), batches[i].end(), fill_factor);
+  return count;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+template <class F>
+typename ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::MergeCursors(F &&make) {
+  Cursor cursor;
+  for(auto &shard : shards_)
+    cursor.cursors_.push_back(make(*shard));
+  cursor.settle();
+  return cursor;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+typename ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::lower_bound(const KeyT &lower) {
+  return MergeCursors([&lower] (Tree &shard) { return shard.lower_bound(lower); });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+typename ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::range(
+  const KeyT &lower, const KeyT &upper) {
+  return MergeCursors([&lower, &upper] (Tree &shard) { return shard.range(lower, upper); });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+typename ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::prefix_range(const KeyT &prefix)
+requires requires(const KeyT &key, KeyT &bound) {
+  { key.prefix_successor(bound) } -> std::convertible_to<bool>;
+} {
+  return MergeCursors([&prefix] (Tree &shard) { return shard.prefix_range(prefix); });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor::Cursor(Cursor &&other) noexcept
+    : cursors_(std::move(other.cursors_)), current_(std::exchange(other.current_, 0)) {
+  // an empty cursor list is the end state, with current_ 0.
+  other.cursors_.clear();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+typename ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor&
+ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor::operator=(
+  Cursor &&other) noexcept {
+  if(this == &other) return *this;
+  cursors_ = std::move(other.cursors_);
+  current_ = std::exchange(other.current_, 0);
+  other.cursors_.clear();
+  return *this;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor::settle() {
+  // a key lives in one shard only, so the shards never tie and comparing keys alone is enough.
+  // shard counts are small: a linear pick beats keeping a heap.
+  current_ = cursors_.size();
+  KeyT least;
+  for(size_t i = 0; i < cursors_.size(); ++i) {
+    if(!cursors_[i].valid())
+      continue;
+    KeyT key = cursors_[i].key();
+    if(current_ == cursors_.size() || key_compare_(key, least)) {
+      current_ = i;
+      least = key;
+    }
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor::next() {
+  if(!valid()) return;
+  // stays on the same shard while its run of one key lasts.
+  KeyT key = cursors_[current_].key();
+  cursors_[current_].next();
+  if(cursors_[current_].valid() &&
+    !key_compare_(key, cursors_[current_].key()) && !key_compare_(cursors_[current_].key(), key))
+    return;
+  settle();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::Cursor::reset() {
+  for(auto &cursor : cursors_)
+    cursor.reset();
+  current_ = cursors_.size();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::defer_rebalance(
+  size_t compact_after) {
+  for(auto &shard : shards_)
+    shard->defer_rebalance(compact_after);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+size_t ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::compact() {
+  size_t merged = 0;
+  for(auto &shard : shards_)
+    merged += shard->compact();
+  return merged;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare, class ValueCompare, class KeyHash>
+void ShardedMultiBPlusTree<KeyT, ValueT, KeyCompare, ValueCompare, KeyHash>::enable_cache(size_t byte_budget)
+requires requires(Tree &tree, size_t budget) { tree.enable_cache(budget); } {
+  for(auto &shard : shards_)
+    shard->enable_cache(byte_budget / shards_.size());
+}
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef INSOMNIA_UNIQUE_BPLUSTREE_TCC
+#define INSOMNIA_UNIQUE_BPLUSTREE_TCC
+
+#include "unique_bplustree.h"
+
+namespace insomnia {
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+BPlusTree<KeyT, ValueT, KeyCompare>::BPlusTree(
+  const std::filesystem::path &name,
+  size_t k_param, size_t buffer_capacity, size_t thread_num)
+    : TreeBase(name, k_param, buffer_capacity, thread_num) {}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+BPlusTree<KeyT, ValueT, KeyCompare>::~BPlusTree() {
+  SaveRoot();
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+typename BPlusTree<KeyT, ValueT, KeyCompare>::Reader
+BPlusTree<KeyT, ValueT, KeyCompare>::FindLeaf(const KeyT &key) {
+  std::shared_lock root_lock(root_latch_);
+  if(root_ == nullpos)
+    return Reader();
+  Reader reader = buffer_pool_.get_reader(root_);
+  root_lock.unlock();
+  SepType sep(key);
+  while(!reader.template as<Base>()->is_leaf()) {
+    const Internal *internal = reader.template as<Internal>();
+    int pos = internal->locate_key(sep, sep_compare_);
+    reader = buffer_pool_.get_reader(internal->value(pos));
+  }
+  return reader;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::find(const KeyT &key, ValueT &value) {
+  Reader reader = FindLeaf(key);
+  if(!reader.is_valid())
+    return false;
+  const Leaf *leaf = reader.template as<Leaf>();
+  int pos = leaf->locate_key(key, key_compare_);
+  if(pos == leaf->size() || key_compare_(key, leaf->key(pos)))
+    return false;
+  value = leaf->value(pos);
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::contains(const KeyT &key) {
+  ValueT value;
+  return find(key, value);
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::insert(const KeyT &key, const ValueT &value) {
+  SepType sep(key);
+  {
+    Writer leaf_writer = FindLeafOptim(sep);
+    if(leaf_writer.is_valid()) {
+      Leaf *leaf = leaf_writer.template as<Leaf>();
+      int pos = leaf->locate_key(key, key_compare_);
+      if(pos != leaf->size() && !key_compare_(key, leaf->key(pos)))
+        return false;
+      if(leaf->is_insert_safe()) {
+        leaf->insert(pos, key, value);
+        return true;
+      }
+    }
+  }
+  RootLock root_lock(root_latch_);
+  if(root_ == nullpos) {
+    root_ = buffer_pool_.alloc();
+    height_ = 1;
+    SaveRoot();
+    Writer writer = buffer_pool_.get_writer(root_);
+    Leaf *leaf = writer.template as<Leaf>();
+    leaf->init();
+    leaf->insert(0, key, value);
+    return true;
+  }
+  vector<Writer> writers = FindLeafPessi(root_lock, sep, true);
+  return InsertPessi(writers, sep, [&] (Leaf *leaf) {
+    int pos = leaf->locate_key(key, key_compare_);
+    if(pos != leaf->size() && !key_compare_(key, leaf->key(pos)))
+      return false;
+    leaf->insert(pos, key, value);
+    return true;
+  });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::insert_or_assign(const KeyT &key, const ValueT &value) {
+  while(true) {
+    if(update(key, value))
+      return false;
+    if(insert(key, value))
+      return true;
+    // removed and inserted again in between. Rare.
+  }
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::update(const KeyT &key, const ValueT &value) {
+  return update(key, [&value] (ValueT &old_value) { old_value = value; });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+template <class Modifier>
+requires std::invocable<Modifier, ValueT&>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::update(const KeyT &key, Modifier &&modifier) {
+  Writer leaf_writer = FindLeafOptim(SepType(key));
+  if(!leaf_writer.is_valid())
+    return false;
+  Leaf *leaf = leaf_writer.template as<Leaf>();
+  int pos = leaf->locate_key(key, key_compare_);
+  if(pos == leaf->size() || key_compare_(key, leaf->key(pos)))
+    return false;
+  ValueT value = leaf->value(pos);
+  modifier(value);
+  leaf->write_value(pos, value);
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+template <class Visitor>
+requires std::invocable<Visitor, const ValueT&>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::visit(const KeyT &key, Visitor &&visitor) {
+  Reader reader = FindLeaf(key);
+  if(!reader.is_valid())
+    return false;
+  const Leaf *leaf = reader.template as<Leaf>();
+  int pos = leaf->locate_key(key, key_compare_);
+  if(pos == leaf->size() || key_compare_(key, leaf->key(pos)))
+    return false;
+  visitor(leaf->value(pos));
+  return true;
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::remove(const KeyT &key) {
+  return remove_if(key, [] (const ValueT&) { return true; });
+}
+
+template <Trivial KeyT, Trivial ValueT, class KeyCompare>
+template <class Predicate>
+requires std::predicate<Predicate, const ValueT&>
+bool BPlusTree<KeyT, ValueT, KeyCompare>::remove_if(const KeyT &key, Predicate &&predicate) {
+  SepType sep(key);
+  {
+    Writer leaf_writer = FindLeafOptim(sep);
+    if(!leaf_writer.is_valid())
+      return false;
+    Leaf *leaf = leaf_writer.template as<Leaf>();
+    int pos = leaf->locate_key(key, key_compare_);
+    if(pos == leaf->size() || key_compare_(key, leaf->key(pos)) || !predicate(leaf->value(pos)))
+      return false;
+    if(leaf->is_remove_safe()) {
+      leaf->remove(pos);
+      return true;
+    }
+  }
+  RootLock root_lock(root_latch_);
+  if(root_ == nullpos)
+    return false;
+  vector<Writer> writers = FindLeafPessi(root_lock, sep, false);
+  return RemovePessi(writers, sep, [&] (Leaf *leaf) {
+    int pos = leaf->locate_key(key, key_compare_);
+    // the value may have changed while no latch was held.
+    if(pos == leaf->size() || key_compare_(key, leaf->key(pos)) || !predicate(leaf->value(pos)))
+      return false;
+    leaf->remove(pos);
+    return true;
+  });
+}
+
+}
+
+#endif
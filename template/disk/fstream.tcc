@@ -69,6 +69,13 @@ void fstream<T, Meta>::reserve(size_t file_size) {
   file_size_ = file_size;
 }
 
+template <class T, class Meta>
+void fstream<T, Meta>::flush() {
+  std::unique_lock lock(disk_io_latch_);
+  basic_fstream_.flush();
+  index_pool_.flush();
+}
+
 template <class T, class Meta>
 void fstream<T, Meta>::close_locked() {
   if(!is_open()) return;
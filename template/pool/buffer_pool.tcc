@@ -9,7 +9,7 @@ template <Trivial T, Trivial Meta, size_t align>
 BufferPool<T, Meta, align>::Writer::Writer(page_id_t page_id, Frame *frame,
   LruKReplacer *replacer, std::mutex *bp_latch, TaskScheduler *scheduler,
   fstream<AlignedPage, Meta> *fstream, std::condition_variable *replacer_cv,
-  std::unique_lock<std::mutex> lock)
+  std::unique_lock<std::mutex> lock, bool is_logged)
     : is_valid_(true),
       page_id_(page_id),
       frame_(frame),
@@ -17,25 +17,29 @@ BufferPool<T, Meta, align>::Writer::Writer(page_id_t page_id, Frame *frame,
       bp_latch_(bp_latch),
       scheduler_(scheduler),
       fstream_(fstream),
-      replacer_cv_(replacer_cv) {
+      replacer_cv_(replacer_cv),
+      is_logged_(is_logged) {
   if (frame_->pin_count_.fetch_add(1) == 0) {
-    replacer_->pin(frame_->frame_id_);
+    replacer_->pin(frame_->slot_id_);
   }
-  replacer_->access(frame_->frame_id_);
+  replacer_->access(frame_->slot_id_);
   lock.unlock();              // locked at get_writer.
   frame_->page_latch_.lock(); // should it be outside the buffer pool latch?
 }
 
 template <Trivial T, Trivial Meta, size_t align>
 BufferPool<T, Meta, align>::Writer::Writer(Writer &&other) noexcept
-    : is_valid_(true),
+    : is_valid_(other.is_valid_),
       page_id_(other.page_id_),
       frame_(other.frame_),
       replacer_(other.replacer_),
       bp_latch_(other.bp_latch_),
       scheduler_(other.scheduler_),
       fstream_(other.fstream_),
-      replacer_cv_(other.replacer_cv_) {
+      replacer_cv_(other.replacer_cv_),
+      pool_(other.pool_),
+      is_logged_(other.is_logged_),
+      is_touched_(other.is_touched_) {
   other.is_valid_ = false;
   other.frame_ = nullptr;
   other.replacer_ = nullptr;
@@ -43,6 +47,7 @@ BufferPool<T, Meta, align>::Writer::Writer(Writer &&other) noexcept
   other.scheduler_ = nullptr;
   other.fstream_ = nullptr;
   other.replacer_cv_ = nullptr;
+  other.pool_ = nullptr;
 }
 
 template <Trivial T, Trivial Meta, size_t align>
@@ -58,6 +63,9 @@ typename BufferPool<T, Meta, align>::Writer&
   scheduler_ = other.scheduler_;
   fstream_ = other.fstream_;
   replacer_cv_ = other.replacer_cv_;;
+  pool_ = other.pool_;
+  is_logged_ = other.is_logged_;
+  is_touched_ = other.is_touched_;
 
   other.is_valid_ = false;
   other.frame_ = nullptr;
@@ -66,13 +74,15 @@ typename BufferPool<T, Meta, align>::Writer&
   other.scheduler_ = nullptr;
   other.fstream_ = nullptr;
   other.replacer_cv_ = nullptr;
+  other.pool_ = nullptr;
   return *this;
 }
 
 template <Trivial T, Trivial Meta, size_t align>
 void BufferPool<T, Meta, align>::Writer::flush() {
-  if (!frame_->is_dirty_) return;
-  auto future = scheduler_->schedule(page_id_, fstream_->write, page_id_, &frame_->page_);
+  if (!frame_->is_dirty_ || is_logged_) return;
+  auto future = scheduler_->schedule(page_id_,
+    [this] { fstream_->write(page_id_, &frame_->page_); });
   future.get();  // optimize later
   frame_->is_dirty_ = false;
 }
@@ -85,7 +95,7 @@ void BufferPool<T, Meta, align>::Writer::drop() {
     std::unique_lock lock(*bp_latch_);
     frame_->page_latch_.unlock();  // should it be outside the bpm latch?
     if (frame_->pin_count_.fetch_sub(1) == 1) {
-      replacer_->unpin(frame_->frame_id_);
+      replacer_->unpin(frame_->slot_id_);
       replacer_cv_->notify_one();
     }
   }
@@ -95,7 +105,9 @@ void BufferPool<T, Meta, align>::Writer::drop() {
   scheduler_ = nullptr;
   fstream_ = nullptr;
   replacer_cv_ = nullptr;
+  pool_ = nullptr;
   is_valid_ = false;
+  is_touched_ = false;
 }
 
 /*******************************************************************************************************************/
@@ -104,7 +116,7 @@ template <Trivial T, Trivial Meta, size_t align>
 BufferPool<T, Meta, align>::Reader::Reader(page_id_t page_id, Frame *frame,
   LruKReplacer *replacer, std::mutex *bp_latch, TaskScheduler *scheduler,
   fstream<AlignedPage, Meta> *fstream, std::condition_variable *replacer_cv,
-  std::unique_lock<std::mutex> lock)
+  std::unique_lock<std::mutex> lock, bool is_logged)
     : is_valid_(true),
       page_id_(page_id),
       frame_(frame),
@@ -112,25 +124,27 @@ BufferPool<T, Meta, align>::Reader::Reader(page_id_t page_id, Frame *frame,
       bp_latch_(bp_latch),
       scheduler_(scheduler),
       fstream_(fstream),
-      replacer_cv_(replacer_cv) {
+      replacer_cv_(replacer_cv),
+      is_logged_(is_logged) {
   if (frame_->pin_count_.fetch_add(1) == 0) {
-    replacer_->pin(frame_->frame_id_);
+    replacer_->pin(frame_->slot_id_);
   }
-  replacer_->access(frame_->frame_id_);
+  replacer_->access(frame_->slot_id_);
   lock.unlock();                      // locked at get_reader.
   frame_->page_latch_.lock_shared();  // should it be outside the buffer pool latch?
 }
 
 template <Trivial T, Trivial Meta, size_t align>
 BufferPool<T, Meta, align>::Reader::Reader(Reader &&other) noexcept
-    : is_valid_(true),
+    : is_valid_(other.is_valid_),
       page_id_(other.page_id_),
       frame_(other.frame_),
       replacer_(other.replacer_),
       bp_latch_(other.bp_latch_),
       scheduler_(other.scheduler_),
       fstream_(other.fstream_),
-      replacer_cv_(other.replacer_cv_) {
+      replacer_cv_(other.replacer_cv_),
+      is_logged_(other.is_logged_) {
   other.is_valid_ = false;
   other.frame_ = nullptr;
   other.replacer_ = nullptr;
@@ -153,6 +167,7 @@ typename BufferPool<T, Meta, align>::Reader&
   scheduler_ = other.scheduler_;
   fstream_ = other.fstream_;
   replacer_cv_ = other.replacer_cv_;
+  is_logged_ = other.is_logged_;
 
   other.is_valid_ = false;
   other.frame_ = nullptr;
@@ -166,8 +181,9 @@ typename BufferPool<T, Meta, align>::Reader&
 
 template <Trivial T, Trivial Meta, size_t align>
 void BufferPool<T, Meta, align>::Reader::flush() {
-  if (!frame_->is_dirty_) return;
-  auto future = scheduler_->schedule(page_id_, fstream_->write, page_id_, &frame_->page_);
+  if (!frame_->is_dirty_ || is_logged_) return;
+  auto future = scheduler_->schedule(page_id_,
+    [this] { fstream_->write(page_id_, &frame_->page_); });
   future.get();  // optimize later
   frame_->is_dirty_ = false;
 }
@@ -180,7 +196,7 @@ void BufferPool<T, Meta, align>::Reader::drop() {
     std::unique_lock lock(*bp_latch_);
     frame_->page_latch_.unlock_shared();  // should it be outside the bpm latch?
     if (frame_->pin_count_.fetch_sub(1) == 1) {
-      replacer_->unpin(frame_->frame_id_);
+      replacer_->unpin(frame_->slot_id_);
       replacer_cv_->notify_one();
     }
   }
@@ -197,155 +213,1015 @@ void BufferPool<T, Meta, align>::Reader::drop() {
 
 template <Trivial T, Trivial Meta, size_t align>
 BufferPool<T, Meta, align>::BufferPool(
-  const std::string &file_prefix, size_t k_param, size_t frame_num, size_t thread_num)
+  const std::string &file_prefix, size_t k_param, size_t frame_num, size_t thread_num, LogMode log_mode)
+    : frame_num_(frame_num),
+      k_param_(k_param),
+      clean_reserve_(frame_num / 16),
+      own_scheduler_(std::make_unique<TaskScheduler>(thread_num)),
+      scheduler_(own_scheduler_.get()),
+      fstream_(file_prefix + ".dat") {
+  InitFrames();
+  InitLog(file_prefix, log_mode);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+BufferPool<T, Meta, align>::BufferPool(
+  const std::string &file_prefix, size_t k_param, size_t frame_num, TaskScheduler &scheduler, LogMode log_mode)
     : frame_num_(frame_num),
-      replacer_(k_param, frame_num),
-      scheduler_(thread_num),
+      k_param_(k_param),
+      clean_reserve_(frame_num / 16),
+      scheduler_(&scheduler),
       fstream_(file_prefix + ".dat") {
-  frames_.reserve(frame_num);
-  free_frames_.reserve(frame_num);
-  page_map_.reserve(frame_num);
-  for (frame_id_t i = 0; i < frame_num; i++) {
-    frames_.push_back(Frame(i));
-    free_frames_.push_back(i);
+  InitFrames();
+  InitLog(file_prefix, log_mode);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+BufferPool<T, Meta, align>::~BufferPool() {
+  if(log_writer_.joinable()) {
+    {
+      std::unique_lock lock(durable_latch_);
+      is_closing_ = true;
+    }
+    durable_cv_.notify_all();
+    log_writer_.join();
+  }
+  // background write-backs and reads still hold frames of the pool.
+  for(auto &shard : shards_) {
+    std::unique_lock lock(shard->latch);
+    shard->load_cv.wait(lock, [&shard] { return shard->cleanings == 0 && shard->prefetches == 0; });
+  }
+  flush_all();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::InitFrames() {
+  size_t shard_num = std::clamp<size_t>(frame_num_ / SHARD_FRAMES, 1, MAX_SHARDS);
+  for (size_t i = 0; i < shard_num; i++)
+    shards_.push_back(std::make_unique<Shard>(i, k_param_, (frame_num_ + shard_num - 1) / shard_num));
+  frames_.reserve(frame_num_);
+  for (frame_id_t i = 0; i < frame_num_; i++) {
+    frames_.push_back(Frame(i, i / shard_num));
+    ShardOfFrame(i).free_frames.push_back(i);
   }
 }
 
+template <Trivial T, Trivial Meta, size_t align>
+vector<std::unique_lock<std::mutex>> BufferPool<T, Meta, align>::LockShards() {
+  vector<std::unique_lock<std::mutex>> locks;
+  for (auto &shard : shards_)
+    locks.push_back(std::unique_lock(shard->latch));
+  return locks;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::InitLog(const std::string &file_prefix, LogMode log_mode) {
+  std::filesystem::path file(file_prefix + ".wal");
+  if(std::filesystem::exists(file) && std::filesystem::file_size(file) != 0) {
+    WriteAheadLog log(file);
+    log.replay([this] (const WriteAheadLog::RecordHeader &header, const char *data) {
+      switch(header.type) {
+      case WriteAheadLog::RecordType::Page:
+      case WriteAheadLog::RecordType::Restore: {
+        AlignedPage page;
+        memcpy(page.data_, data, PAGE_SIZE);
+        fstream_.write(header.index, &page);
+        break;
+      }
+      case WriteAheadLog::RecordType::Meta:
+        if constexpr(!std::is_same_v<Meta, monometa>) {
+          Meta meta;
+          memcpy(static_cast<void*>(&meta), data, sizeof(Meta));
+          fstream_.write_meta(&meta);
+        }
+        break;
+      case WriteAheadLog::RecordType::Alloc:
+        fstream_.alloc_at(header.index);
+        break;
+      case WriteAheadLog::RecordType::Dealloc:
+        fstream_.dealloc(header.index);
+        break;
+      default:
+        break;
+      }
+    });
+    fstream_.flush();
+    log.truncate();
+  }
+  log_mode_ = log_mode;
+  if(log_mode_ == LogMode::off) {
+    std::filesystem::remove(file);
+    return;
+  }
+  log_ = std::make_unique<WriteAheadLog>(file);
+  if constexpr(!std::is_same_v<Meta, monometa>) {
+    meta_ = std::make_unique<Meta>();
+    if(!fstream_.read_meta(meta_.get()))
+      meta_.reset();
+  }
+  log_writer_ = std::thread([this] { LogWriter(); });
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::page_id_t BufferPool<T, Meta, align>::alloc() {
+  if(!log_)
+    return fstream_.alloc();
+  // recorded under the same latch as deallocations, so the log replays them in the order they happened.
+  std::unique_lock lock(log_latch_);
+  page_id_t page_id = fstream_.alloc();
+  page_events_.push_back({page_id, true});
+  return page_id;
+}
+
 template <Trivial T, Trivial Meta, size_t align>
 bool BufferPool<T, Meta, align>::dealloc(page_id_t page_id) {
-  std::unique_lock lock(bp_latch_);
-  if (auto it = page_map_.find(page_id); it != page_map_.end()) {
-    if (frames_[it->second].pin_count_.load() > 0) {
+  Shard &shard = ShardOf(page_id);
+  std::unique_lock lock(shard.latch);
+  // a page being read in or written back is settled first.
+  auto is_busy = [this] (frame_id_t frame_id) {
+    return frames_[frame_id].is_loading_ || frames_[frame_id].is_cleaning_;
+  };
+  for(frame_id_t frame_id = shard.page_map.find(page_id);
+    frame_id != PageTable::npos && is_busy(frame_id); frame_id = shard.page_map.find(page_id))
+    shard.load_cv.wait(lock, [&is_busy, frame_id] { return !is_busy(frame_id); });
+  if (frame_id_t frame_id = shard.page_map.find(page_id); frame_id != PageTable::npos) {
+    if (frames_[frame_id].pin_count_.load() > 0) {
       throw disk_exception("Erasing pages under use");
       // return false;
     }
+    // snapshots may still read it.
+    PreserveVersion(page_id, frames_[frame_id]);
     // memory erasure / eviction
     // no need to write the data back.
-    frames_[it->second].drop();
-    free_frames_.push_back(it->second);
-    replacer_.remove(it->second);
-    page_map_.erase(it);
+    frames_[frame_id].drop();
+    shard.free_frames.push_back(frame_id);
+    shard.replacer.remove(frames_[frame_id].slot_id_);
+    shard.page_map.erase(page_id);
   }
   // disk erasure
+  if(!log_) {
+    fstream_.dealloc(page_id);
+    return true;
+  }
+  std::unique_lock log_lock(log_latch_);
   fstream_.dealloc(page_id);
+  page_events_.push_back({page_id, false});
   return true;
 }
 
 template <Trivial T, Trivial Meta, size_t align>
-typename BufferPool<T, Meta, align>::Reader
-BufferPool<T, Meta, align>::get_reader(page_id_t page_id) {
-  if(page_id == IndexPool::nullpos)
-    throw segmentation_fault("Reading nullpos");
+typename BufferPool<T, Meta, align>::frame_id_t
+BufferPool<T, Meta, align>::FetchFrame(Shard &shard, page_id_t page_id, std::unique_lock<std::mutex> &lock) {
+  while(true) {
+    frame_id_t frame_id = shard.page_map.find(page_id);
+    if(frame_id == PageTable::npos)
+      break;
+    if(!frames_[frame_id].is_loading_)
+      return frame_id;
+    // the page is on its way in, or on its way out of a victim frame: look again once it is settled.
+    shard.load_cv.wait(lock, [this, frame_id] { return !frames_[frame_id].is_loading_; });
+  }
   frame_id_t frame_id;
-  std::unique_lock lock(bp_latch_);
-  if (auto it = page_map_.find(page_id); it != page_map_.end()) {
-    frame_id = it->second;
+  bool has_victim = false;
+  page_id_t victim_id = 0;
+  uint64_t victim_group = 0;
+  if (!shard.free_frames.empty()) {
+    frame_id = shard.free_frames.back();
+    shard.free_frames.pop_back();
   } else {
-    if (!free_frames_.empty()) {
-      frame_id = free_frames_.back();
-      free_frames_.pop_back();
-    } else {
-      // HDD time delay
+    // HDD time delay
 
-      if(!replacer_cv_.wait_for(lock, std::chrono::milliseconds(20), [this] { return replacer_.has_evictable_frame(); }))
-        // return Reader(); // empty vessel.
-        throw pool_overflow("Buffer pool frames full for 20ms."); // Yes I prefer exception more than optional right
+    if(!shard.replacer_cv.wait_for(lock, std::chrono::milliseconds(20), [&shard] { return shard.replacer.has_evictable_frame(); }))
+      // return Reader(); // empty vessel.
+      throw pool_overflow("Buffer pool frames full for 20ms."); // Yes I prefer exception more than optional right
 
-      // replacer_cv_.wait(lock, [this] { return replacer_.has_evictable_frame(); });
-      frame_id = replacer_.evict();
+    // shard.replacer_cv.wait(lock, [&shard] { return shard.replacer.has_evictable_frame(); });
+    frame_id = FrameOfSlot(shard, shard.replacer.evict());
 
-      // flush old data
-      if (frames_[frame_id].is_dirty_) {
-        auto future = scheduler_.schedule(
-          frames_[frame_id].page_id_,
-          [this, frame_id] { fstream_.write(frames_[frame_id].page_id_, &frames_[frame_id].page_); });
-        future.get();  // optimize later
-      }
-
-      page_map_.erase(frames_[frame_id].page_id_);
-      frames_[frame_id].drop();  // redundant
+    // flush old data
+    if (frames_[frame_id].is_dirty_) {
+      // the old page stays mapped to the frame until it is written back, so nobody reads it stale from the disk.
+      has_victim = true;
+      victim_id = frames_[frame_id].page_id_;
+      if(log_)
+        victim_group = HoldEviction(frames_[frame_id]);
+      ++shard.write_backs;
+    } else {
+      shard.page_map.erase(frames_[frame_id].page_id_);
     }
-    page_map_.emplace(page_id, frame_id);
-    frames_[frame_id].page_id_ = page_id;
-    frames_[frame_id].is_valid_ = true;
+    KeepStamp(shard, frames_[frame_id]);
+    frames_[frame_id].drop();
+    // this miss pays a write; see that the next few don't.
+    if(has_victim && clean_reserve_ != 0 && shard.cleanings == 0)
+      ScheduleCleaning(shard);
+  }
+  Frame &frame = frames_[frame_id];
+  shard.page_map.insert(page_id, frame_id);
+  frame.page_id_ = page_id;
+  frame.is_valid_ = true;
+  frame.is_loading_ = true;
+  frame.version_.store(TakeStamp(shard, page_id));
 
+  // out of the replacer and marked loading, the frame is ours: other threads hit and miss meanwhile.
+  lock.unlock();
+  try {
+    if(has_victim) {
+      if(victim_group != 0)
+        LogEviction(victim_id, victim_group, frame.data());
+      auto future = scheduler_->schedule(victim_id,
+        [this, victim_id, &frame] { fstream_.write(victim_id, &frame.page_); });
+      future.get();
+    }
     // fetch new data
-    auto future = scheduler_.schedule(page_id,
-      [this, page_id, frame_id] {
+    auto future = scheduler_->schedule(page_id,
+      [this, page_id, &frame] {
         // might be ignored if page_id is new
-        fstream_.read(page_id, &frames_[frame_id].page_);
+        fstream_.read(page_id, &frame.page_);
       });
-    future.get();  // optimize later
+    future.get();
+  } catch(...) {
+    lock.lock();
+    shard.page_map.erase(page_id);
+    if(has_victim) {
+      shard.page_map.erase(victim_id);
+      --shard.write_backs;
+    }
+    KeepStamp(shard, frame);
+    frame.drop();
+    frame.is_loading_ = false;
+    shard.free_frames.push_back(frame_id);
+    shard.load_cv.notify_all();
+    throw;
   }
-  // bp_latch_ unlock in Reader page constructor.
-  return Reader(page_id, &frames_[frame_id], &replacer_, &bp_latch_, &scheduler_, &fstream_, &replacer_cv_,
-    std::move(lock));
+  lock.lock();
+  if(has_victim) {
+    shard.page_map.erase(victim_id);
+    --shard.write_backs;
+  }
+  frame.is_loading_ = false;
+  shard.load_cv.notify_all();
+  return frame_id;
 }
 
 template <Trivial T, Trivial Meta, size_t align>
-typename BufferPool<T, Meta, align>::Writer BufferPool<T, Meta, align>::get_writer(page_id_t page_id) {
+void BufferPool<T, Meta, align>::ScheduleCleaning(Shard &shard) {
+  size_t reserve = (clean_reserve_ + shards_.size() - 1) / shards_.size();
+  for(frame_id_t slot_id : shard.replacer.coldest(reserve)) {
+    frame_id_t frame_id = FrameOfSlot(shard, slot_id);
+    Frame &frame = frames_[frame_id];
+    // pages of a group not yet in the log go out on eviction, after the log.
+    if(!frame.is_dirty_ || (log_ && frame.log_group_ > durable_group_.load()))
+      continue;
+    // pinned, so it is not evicted under the write. Hits still find it.
+    frame.pin_count_.fetch_add(1);
+    shard.replacer.pin(slot_id);
+    frame.is_cleaning_ = true;
+    ++shard.cleanings;
+    scheduler_->schedule(frame.page_id_, [this, &shard, frame_id] { CleanFrame(shard, frame_id); });
+  }
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::CleanFrame(Shard &shard, frame_id_t frame_id) {
+  Frame &frame = frames_[frame_id];
+  bool is_latched = false;
+  {
+    std::unique_lock lock(shard.latch);
+    // a Writer got to the page since it was picked: it is not that cold. Nor is a page it left to a later group.
+    if(frame.page_latch_.try_lock_shared()) {
+      is_latched = true;
+      if(log_ && frame.log_group_ > durable_group_.load()) {
+        frame.page_latch_.unlock_shared();
+        is_latched = false;
+      }
+    }
+  }
+  if(is_latched) {
+    try {
+      if(frame.is_dirty_) {
+        fstream_.write(frame.page_id_, &frame.page_);
+        frame.is_dirty_ = false;
+      }
+    } catch(...) {
+      // left dirty, for its eviction to write back.
+    }
+    frame.page_latch_.unlock_shared();
+  }
+  std::unique_lock lock(shard.latch);
+  frame.is_cleaning_ = false;
+  if(frame.pin_count_.fetch_sub(1) == 1) {
+    shard.replacer.unpin(frame.slot_id_);
+    shard.replacer_cv.notify_one();
+  }
+  --shard.cleanings;
+  shard.load_cv.notify_all();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::prefetch(page_id_t page_id) {
   if(page_id == IndexPool::nullpos)
-    throw segmentation_fault("Writing nullpos");
+    return;
+  Shard &shard = ShardOf(page_id);
+  std::unique_lock lock(shard.latch);
+  if(shard.page_map.contains(page_id))
+    return;
   frame_id_t frame_id;
-  std::unique_lock lock(bp_latch_);
-  if (auto it = page_map_.find(page_id); it != page_map_.end()) {
-    frame_id = it->second;
+  if(!shard.free_frames.empty()) {
+    frame_id = shard.free_frames.back();
+    shard.free_frames.pop_back();
   } else {
-    if (!free_frames_.empty()) {
-      frame_id = free_frames_.back();
-      free_frames_.pop_back();
-    } else {
-      // HDD time delay
+    // a dirty victim would cost the caller a write, or a wait for the log: clean some for next time instead.
+    auto coldest = shard.replacer.coldest(1);
+    if(coldest.empty())
+      return;
+    frame_id = FrameOfSlot(shard, coldest[0]);
+    if(frames_[frame_id].is_dirty_) {
+      if(clean_reserve_ != 0 && shard.cleanings == 0)
+        ScheduleCleaning(shard);
+      return;
+    }
+    shard.replacer.evict();
+    shard.page_map.erase(frames_[frame_id].page_id_);
+    KeepStamp(shard, frames_[frame_id]);
+    frames_[frame_id].drop();
+  }
+  Frame &frame = frames_[frame_id];
+  shard.page_map.insert(page_id, frame_id);
+  frame.page_id_ = page_id;
+  frame.is_valid_ = true;
+  frame.is_loading_ = true;
+  frame.version_.store(TakeStamp(shard, page_id));
+  ++shard.prefetches;
+  try {
+    scheduler_->schedule(page_id, [this, &shard, frame_id] { PrefetchFrame(shard, frame_id); });
+  } catch(...) {
+    // the scheduler is closing. Nobody waits on a prefetch, and nobody else saw the frame: it is simply let go.
+    shard.page_map.erase(page_id);
+    KeepStamp(shard, frame);
+    frame.drop();
+    frame.is_loading_ = false;
+    shard.free_frames.push_back(frame_id);
+    --shard.prefetches;
+  }
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::PrefetchFrame(Shard &shard, frame_id_t frame_id) {
+  Frame &frame = frames_[frame_id];
+  bool is_read = true;
+  try {
+    // read in place: waiting on the scheduler from inside it might wait on this very queue.
+    fstream_.read(frame.page_id_, &frame.page_);
+  } catch(...) {
+    is_read = false;
+  }
+  std::unique_lock lock(shard.latch);
+  if(is_read) {
+    // evictable from now on. The read ahead counts as no access: a page scanned once stays cold.
+    shard.replacer.admit(frame.slot_id_);
+    shard.replacer_cv.notify_one();
+  } else {
+    shard.page_map.erase(frame.page_id_);
+    KeepStamp(shard, frame);
+    frame.drop();
+    shard.free_frames.push_back(frame_id);
+  }
+  frame.is_loading_ = false;
+  --shard.prefetches;
+  shard.load_cv.notify_all();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::Reader
+BufferPool<T, Meta, align>::get_reader(page_id_t page_id) {
+  if(page_id == IndexPool::nullpos)
+    throw segmentation_fault("Reading nullpos");
+  Shard &shard = ShardOf(page_id);
+  std::unique_lock lock(shard.latch);
+  frame_id_t frame_id = FetchFrame(shard, page_id, lock);
+  // the shard latch is unlocked in Reader page constructor.
+  return Reader(page_id, &frames_[frame_id], &shard.replacer, &shard.latch, scheduler_, &fstream_,
+    &shard.replacer_cv, std::move(lock), log_ != nullptr);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::Writer BufferPool<T, Meta, align>::get_writer(page_id_t page_id) {
+  if(page_id == IndexPool::nullpos)
+    throw segmentation_fault("Writing nullpos");
+  Shard &shard = ShardOf(page_id);
+  std::unique_lock lock(shard.latch);
+  frame_id_t frame_id = FetchFrame(shard, page_id, lock);
+  if(log_) {
+    ++writes_;
+    if(frames_[frame_id].log_group_ != open_group_) {
+      frames_[frame_id].log_group_ = open_group_;
+      std::unique_lock log_lock(log_latch_);
+      logged_frames_.push_back(frame_id);
+    }
+  }
+  // the shard latch is unlocked in Writer page constructor.
+  Writer writer(page_id, &frames_[frame_id], &shard.replacer, &shard.latch, scheduler_, &fstream_,
+    &shard.replacer_cv, std::move(lock), log_ != nullptr);
+  // versions are saved by the first write through it, if any.
+  writer.pool_ = this;
+  return writer;
+}
 
-      if(!replacer_cv_.wait_for(lock, std::chrono::milliseconds(20), [this] { return replacer_.has_evictable_frame(); }))
-        // return Writer(); // empty vessel
-        throw pool_overflow("Buffer pool frames full for 20ms."); // Yes I prefer exception more than optional right
+/*******************************************************************************************************************/
+
+template <Trivial T, Trivial Meta, size_t align>
+BufferPool<T, Meta, align>::WriteScope::WriteScope(WriteScope &&other) noexcept
+    : pool_(other.pool_), writes_(other.writes_), epoch_(other.epoch_) {
+  other.pool_ = nullptr;
+}
 
-      // replacer_cv_.wait(lock, [this] { return replacer_.has_evictable_frame(); });
-      frame_id = replacer_.evict();
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::WriteScope&
+  BufferPool<T, Meta, align>::WriteScope::operator=(WriteScope &&other) noexcept {
+  if(this == &other) return *this;
+  release();
+  pool_ = other.pool_;
+  writes_ = other.writes_;
+  epoch_ = other.epoch_;
+  other.pool_ = nullptr;
+  return *this;
+}
 
-      // flush old data
-      if (frames_[frame_id].is_dirty_) {
-        auto future = scheduler_.schedule(
-          frames_[frame_id].page_id_,
-          [this, frame_id] { fstream_.write(frames_[frame_id].page_id_, &frames_[frame_id].page_); });
-        future.get();  // optimize later
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::WriteScope::release() {
+  if(!pool_) return;
+  BufferPool *pool = pool_;
+  pool_ = nullptr;
+  pool->CloseScope(writes_, epoch_);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::CloseScope(size_t writes, uint64_t epoch) {
+  for(size_t i = open_scopes_.size(); i-- > 0; )
+    if(open_scopes_[i].first == this) {
+      open_scopes_[i] = open_scopes_.back();
+      open_scopes_.pop_back();
+      break;
+    }
+  uint64_t group;
+  {
+    std::unique_lock gate_lock(gate_latch_);
+    // no commit can close the open group while this scope is open.
+    group = open_group_;
+    --active_writes_;
+    for(size_t i = 0; i < open_epochs_.size(); ++i)
+      if(open_epochs_[i].first == epoch) {
+        // snapshots wait for the oldest epochs to close.
+        if(--open_epochs_[i].second == 0) {
+          open_epochs_.erase(i);
+          gate_cv_.notify_all();
+        }
+        break;
       }
+  }
+  if(log_mode_ == LogMode::sync && writes_ != writes)
+    WaitDurable(group);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+BufferPool<T, Meta, align>::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : pool_(other.pool_), epoch_(other.epoch_) {
+  other.pool_ = nullptr;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::Snapshot&
+  BufferPool<T, Meta, align>::Snapshot::operator=(Snapshot &&other) noexcept {
+  if(this == &other) return *this;
+  release();
+  pool_ = other.pool_;
+  epoch_ = other.epoch_;
+  other.pool_ = nullptr;
+  return *this;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::Snapshot::release() {
+  if(!pool_) return;
+  pool_->ReleaseSnapshot(epoch_);
+  pool_ = nullptr;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::WriteScope BufferPool<T, Meta, align>::write_scope() {
+  for(const auto &[pool, epoch] : open_scopes_)
+    if(pool == this)
+      return WriteScope();
+  std::unique_lock gate_lock(gate_latch_);
+  // pending snapshots and commits go first, or a steady stream of writes would starve them.
+  gate_cv_.wait(gate_lock, [this] { return !snapshot_pending_ && !quiesce_pending_; });
+  ++active_writes_;
+  uint64_t epoch = epoch_.load();
+  if(open_epochs_.empty() || open_epochs_.back().first != epoch)
+    open_epochs_.push_back({epoch, 0});
+  ++open_epochs_.back().second;
+  open_scopes_.push_back({this, epoch});
+  return WriteScope(this, writes_, epoch);
+}
 
-      page_map_.erase(frames_[frame_id].page_id_);
-      frames_[frame_id].drop();  // redundant
+template <Trivial T, Trivial Meta, size_t align>
+template <class F>
+void BufferPool<T, Meta, align>::Quiesce(F &&f) {
+  std::unique_lock gate_lock(gate_latch_);
+  gate_cv_.wait(gate_lock, [this] { return !quiesce_pending_; });
+  quiesce_pending_ = true;
+  gate_cv_.wait(gate_lock, [this] { return active_writes_ == 0; });
+  f();
+  quiesce_pending_ = false;
+  gate_cv_.notify_all();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+typename BufferPool<T, Meta, align>::Snapshot BufferPool<T, Meta, align>::snapshot() {
+  uint64_t epoch;
+  {
+    std::unique_lock gate_lock(gate_latch_);
+    epoch = OpenSnapshot();
+    gate_cv_.wait(gate_lock, [this, epoch] { return open_epochs_.empty() || open_epochs_[0].first >= epoch; });
+  }
+  bool is_broken = false;
+  {
+    std::unique_lock snapshot_lock(snapshot_latch_);
+    for(size_t i = 0; i < broken_snapshots_.size(); ++i)
+      if(broken_snapshots_[i] == epoch) {
+        broken_snapshots_[i] = broken_snapshots_.back();
+        broken_snapshots_.pop_back();
+        is_broken = true;
+        break;
+      }
+  }
+  if(!is_broken)
+    return Snapshot(this, epoch);
+  ReleaseSnapshot(epoch);
+  // again with no scope open, which nothing can break.
+  std::unique_lock gate_lock(gate_latch_);
+  gate_cv_.wait(gate_lock, [this] { return !snapshot_pending_; });
+  snapshot_pending_ = true;
+  gate_cv_.wait(gate_lock, [this] { return active_writes_ == 0; });
+  epoch = OpenSnapshot();
+  snapshot_pending_ = false;
+  gate_cv_.notify_all();
+  return Snapshot(this, epoch);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+uint64_t BufferPool<T, Meta, align>::OpenSnapshot() {
+  std::unique_lock snapshot_lock(snapshot_latch_);
+  uint64_t epoch = epoch_.load() + 1;
+  snapshots_.push_back(epoch);
+  // known to the writers before any scope takes the epoch.
+  newest_snapshot_.store(epoch);
+  epoch_.store(epoch);
+  return epoch;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+uint64_t BufferPool<T, Meta, align>::ScopeEpoch() const {
+  for(const auto &[pool, epoch] : open_scopes_)
+    if(pool == this)
+      return epoch;
+  return epoch_.load();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+bool BufferPool<T, Meta, align>::NeedsVersion(uint64_t stamp, uint64_t epoch) {
+  if(newest_snapshot_.load() <= stamp)
+    return false;
+  std::shared_lock snapshot_lock(snapshot_latch_);
+  for(uint64_t snapshot : snapshots_)
+    if(stamp < snapshot && snapshot <= epoch)
+      return true;
+  return false;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::BreakSnapshots(uint64_t epoch, uint64_t stamp) {
+  std::unique_lock snapshot_lock(snapshot_latch_);
+  // only pending snapshots lie in between: a live one has seen every scope before it close.
+  for(uint64_t snapshot : snapshots_) {
+    if(snapshot <= epoch || stamp < snapshot)
+      continue;
+    bool is_known = false;
+    for(uint64_t broken : broken_snapshots_)
+      is_known |= broken == snapshot;
+    if(!is_known)
+      broken_snapshots_.push_back(snapshot);
+  }
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::PreserveVersion(page_id_t page_id, Frame &frame) {
+  uint64_t epoch = ScopeEpoch();
+  uint64_t stamp = frame.version_.load();
+  if(stamp > epoch)
+    BreakSnapshots(epoch, stamp);
+  // some snapshot sees the current content: keep a copy before it changes.
+  if(NeedsVersion(stamp, epoch)) {
+    Shard &shard = ShardOf(page_id);
+    std::unique_lock version_lock(shard.version_latch);
+    vector<Version> &list = shard.versions[page_id];
+    list.emplace_back();
+    Version &version = list.back();
+    version.end_ = epoch;
+    memcpy(version.data_, frame.data(), PAGE_SIZE);
+    shard.version_queue.push_back({epoch, page_id});
+    std::push_heap(shard.version_queue.data(), shard.version_queue.data() + shard.version_queue.size(),
+      std::greater<>());
+    frame.version_.store(epoch);
+    return;
+  }
+  if(epoch > stamp)
+    frame.version_.store(epoch);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+uint64_t BufferPool<T, Meta, align>::TakeStamp(Shard &shard, page_id_t page_id) {
+  if(shard.stamps.empty())
+    return 0;
+  auto it = shard.stamps.find(page_id);
+  if(it == shard.stamps.end())
+    return 0;
+  uint64_t stamp = it->second;
+  shard.stamps.erase(it);
+  return stamp;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::KeepStamp(Shard &shard, const Frame &frame) {
+  // with no snapshot around, whatever wrote the page is older than every snapshot to come.
+  uint64_t stamp = frame.version_.load();
+  if(stamp == 0 || newest_snapshot_.load() == 0)
+    return;
+  shard.stamps[frame.page_id_] = stamp;
+  vector<std::pair<uint64_t, page_id_t>> &queue = shard.stamp_queue;
+  if(queue.size() >= 2 * shard.stamps.size() + SHARD_FRAMES) {
+    // mostly stamps taken back: keep the live ones only.
+    queue.clear();
+    for(auto it = shard.stamps.begin(); it != shard.stamps.end(); ++it)
+      queue.push_back({it->second, it->first});
+    std::make_heap(queue.data(), queue.data() + queue.size(), std::greater<>());
+    return;
+  }
+  queue.push_back({stamp, frame.page_id_});
+  std::push_heap(queue.data(), queue.data() + queue.size(), std::greater<>());
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+const typename BufferPool<T, Meta, align>::Version*
+BufferPool<T, Meta, align>::FindVersion(Shard &shard, page_id_t page_id, uint64_t epoch) {
+  if(shard.versions.empty())
+    return nullptr;
+  auto it = shard.versions.find(page_id);
+  if(it == shard.versions.end())
+    return nullptr;
+  // the first one overwritten by a scope the snapshot doesn't see.
+  for(const Version &version : it->second)
+    if(version.end_ >= epoch)
+      return &version;
+  return nullptr;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::ReadVersion(page_id_t page_id, uint64_t epoch, char *data) {
+  if(page_id == IndexPool::nullpos)
+    throw segmentation_fault("Reading nullpos");
+  Shard &shard = ShardOf(page_id);
+  {
+    std::shared_lock version_lock(shard.version_latch);
+    if(const Version *version = FindVersion(shard, page_id, epoch)) {
+      memcpy(data, version->data_, align);
+      return;
+    }
+  }
+  // the frame can't be evicted or deallocated under the shard latch, so no pin is needed.
+  std::unique_lock lock(shard.latch);
+  frame_id_t frame_id = FetchFrame(shard, page_id, lock);
+  Frame &frame = frames_[frame_id];
+  shard.replacer.access(frame.slot_id_);
+  if(frame.pin_count_.load() == 0) {
+    shard.replacer.unpin(frame.slot_id_);
+    shard.replacer_cv.notify_one();
+  }
+  // a writer saves a version before writing what the snapshot sees, which it can't while version_latch is held.
+  std::shared_lock version_lock(shard.version_latch);
+  const Version *version = FindVersion(shard, page_id, epoch);
+  memcpy(data, version ? version->data_ : frame.data(), align);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+bool BufferPool<T, Meta, align>::ReadMetaVersion(uint64_t epoch, Meta *meta)
+  requires (!std::is_same_v<Meta, monometa>) {
+  std::unique_lock meta_lock(meta_version_latch_);
+  for(const MetaVersion &version : meta_versions_)
+    if(version.end_ >= epoch) {
+      *meta = version.meta_;
+      return version.has_meta_;
     }
-    page_map_.emplace(page_id, frame_id);
-    frames_[frame_id].page_id_ = page_id;
-    frames_[frame_id].is_valid_ = true;
+  return read_meta(meta);
+}
 
-    // fetch new data
-    auto future = scheduler_.schedule(page_id,
-      [this, page_id, frame_id] {
-        // might be ignored if page_id is new
-        fstream_.read(page_id, &frames_[frame_id].page_);
-      });
-    future.get();  // optimize later
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::ReleaseSnapshot(uint64_t epoch) {
+  uint64_t oldest;
+  {
+    std::unique_lock snapshot_lock(snapshot_latch_);
+    for(size_t i = 0; i < snapshots_.size(); ++i)
+      if(snapshots_[i] == epoch) {
+        snapshots_[i] = snapshots_.back();
+        snapshots_.pop_back();
+        break;
+      }
+    // a snapshot taken from now on is newer than the current epoch.
+    oldest = epoch_.load() + 1;
+    uint64_t newest = 0;
+    for(uint64_t snapshot : snapshots_) {
+      oldest = std::min(oldest, snapshot);
+      newest = std::max(newest, snapshot);
+    }
+    newest_snapshot_.store(newest);
   }
-  // bp_latch_ unlock in Writer page constructor.
-  return Writer(page_id, &frames_[frame_id], &replacer_, &bp_latch_, &scheduler_, &fstream_, &replacer_cv_,
-    std::move(lock));
+  // versions overwritten before the oldest snapshot was taken are of no use, nor are the stamps older than it.
+  // Both are popped from their queues earliest first, so only what is freed is touched.
+  for(auto &shard : shards_) {
+    {
+      std::unique_lock version_lock(shard->version_latch);
+      vector<std::pair<uint64_t, page_id_t>> &queue = shard->version_queue;
+      while(!queue.empty() && queue[0].first < oldest) {
+        page_id_t page_id = queue[0].second;
+        std::pop_heap(queue.data(), queue.data() + queue.size(), std::greater<>());
+        queue.pop_back();
+        auto it = shard->versions.find(page_id);
+        // trimmed along with an earlier version of the page.
+        if(it == shard->versions.end())
+          continue;
+        vector<Version> &list = it->second;
+        size_t stale = 0;
+        while(stale < list.size() && list[stale].end_ < oldest)
+          ++stale;
+        // the page's latest version is popped last, so the list empties then.
+        if(stale == list.size())
+          shard->versions.erase(it);
+        else
+          list.erase(0, stale);
+      }
+    }
+    std::unique_lock lock(shard->latch);
+    vector<std::pair<uint64_t, page_id_t>> &queue = shard->stamp_queue;
+    while(!queue.empty() && queue[0].first < oldest) {
+      page_id_t page_id = queue[0].second;
+      std::pop_heap(queue.data(), queue.data() + queue.size(), std::greater<>());
+      queue.pop_back();
+      // the stamp may have been taken back, or kept again since.
+      auto it = shard->stamps.find(page_id);
+      if(it != shard->stamps.end() && it->second < oldest)
+        shard->stamps.erase(it);
+    }
+  }
+  std::unique_lock meta_lock(meta_version_latch_);
+  size_t stale = 0;
+  while(stale < meta_versions_.size() && meta_versions_[stale].end_ < oldest)
+    ++stale;
+  meta_versions_.erase(0, stale);
 }
 
 template <Trivial T, Trivial Meta, size_t align>
 void BufferPool<T, Meta, align>::flush_all() {
+  if(log_) {
+    Checkpoint();
+    return;
+  }
   for (auto &frame : frames_) {
-    if (!frame.is_valid_ || !frame.is_dirty_)
+    std::unique_lock bp_lock(ShardOfFrame(frame.frame_id_).latch);
+    // a frame under I/O is written back by its loader, or holds nothing yet.
+    if (!frame.is_valid_ || !frame.is_dirty_ || frame.is_loading_)
       continue;
-    std::unique_lock bp_lock(bp_latch_);
     std::unique_lock frame_lock(frame.page_latch_);
-    auto future = scheduler_.schedule(frame.page_id_,
-      [this, &frame] { fstream_.write(frame.page_id_, &frame.page_); });
-    future.get();
+    // written in place: a background write-back on the scheduler may be waiting for the shard latch.
+    fstream_.write(frame.page_id_, &frame.page_);
     frame.is_dirty_ = false;
   }
 }
 
+/*******************************************************************************************************************/
+
+template <Trivial T, Trivial Meta, size_t align>
+bool BufferPool<T, Meta, align>::read_meta(Meta *meta) requires (!std::is_same_v<Meta, monometa>) {
+  if(log_) {
+    std::unique_lock lock(log_latch_);
+    if(!meta_)
+      return false;
+    *meta = *meta_;
+    return true;
+  }
+  return fstream_.read_meta(meta);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::write_meta(const Meta *meta) requires (!std::is_same_v<Meta, monometa>) {
+  // saved for the snapshots as a page would be, and written under the same latch as they read it.
+  uint64_t epoch = ScopeEpoch();
+  std::unique_lock meta_lock(meta_version_latch_);
+  if(meta_version_ > epoch)
+    BreakSnapshots(epoch, meta_version_);
+  if(NeedsVersion(meta_version_, epoch)) {
+    meta_versions_.emplace_back();
+    MetaVersion &version = meta_versions_.back();
+    version.end_ = epoch;
+    version.has_meta_ = read_meta(&version.meta_);
+  }
+  meta_version_ = std::max(meta_version_, epoch);
+  if(log_) {
+    std::unique_lock lock(log_latch_);
+    if(!meta_)
+      meta_ = std::make_unique<Meta>();
+    *meta_ = *meta;
+    is_meta_dirty_ = true;
+    return;
+  }
+  fstream_.write_meta(meta);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::LogWriter() {
+  std::unique_lock lock(durable_latch_);
+  while(!is_closing_) {
+    if(log_mode_ == LogMode::async)
+      durable_cv_.wait_for(lock, COMMIT_INTERVAL, [this] { return is_commit_requested_ || is_closing_; });
+    else
+      durable_cv_.wait(lock, [this] { return is_commit_requested_ || is_closing_; });
+    if(is_closing_)
+      break;
+    // the scopes closing while this commit is written wait for the next one, and share it.
+    is_commit_requested_ = false;
+    lock.unlock();
+    Commit();
+    lock.lock();
+  }
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::WaitDurable(uint64_t group) {
+  std::unique_lock lock(durable_latch_);
+  if(durable_group_.load() >= group)
+    return;
+  is_commit_requested_ = true;
+  durable_cv_.notify_all();
+  durable_cv_.wait(lock, [this, group] { return durable_group_.load() >= group || is_closing_; });
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::Commit() {
+  {
+    std::unique_lock lock(log_latch_);
+    if(logged_frames_.empty() && page_events_.empty() && !is_meta_dirty_)
+      return;
+  }
+  uint64_t group = 0;
+  Quiesce([this, &group] {
+    auto locks = LockShards();
+    group = CaptureGroup();
+  });
+  SyncLog(group);
+  if(log_->size() > CHECKPOINT_BYTES)
+    Checkpoint();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::Checkpoint() {
+  Quiesce([this] {
+    // victims written back by the threads that evicted them, and background write-backs, land before the log
+    // is truncated. Each shard is waited for alone: a write-back may queue behind one that needs another shard.
+    auto is_settled = [] (Shard &shard) { return shard.write_backs == 0 && shard.cleanings == 0; };
+    auto locks = LockShards();
+    for(size_t i = 0; i < shards_.size(); ) {
+      Shard &shard = *shards_[i];
+      if(is_settled(shard)) {
+        ++i;
+        continue;
+      }
+      locks.clear();
+      {
+        std::unique_lock lock(shard.latch);
+        shard.load_cv.wait(lock, [&is_settled, &shard] { return is_settled(shard); });
+      }
+      locks = LockShards();
+      i = 0;
+    }
+    SyncLog(CaptureGroup());
+    // the latest image of every page is now in its frame or on disk.
+    for(Frame &frame : frames_) {
+      if(!frame.is_valid_ || !frame.is_dirty_ || frame.is_loading_)
+        continue;
+      fstream_.write(frame.page_id_, &frame.page_);
+      frame.is_dirty_ = false;
+    }
+    std::unique_lock log_lock(log_latch_);
+    if constexpr(!std::is_same_v<Meta, monometa>) {
+      if(meta_)
+        fstream_.write_meta(meta_.get());
+    }
+    fstream_.flush();
+    log_->truncate();
+    is_logged_page_.clear();
+  });
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+uint64_t BufferPool<T, Meta, align>::CaptureGroup() {
+  std::unique_lock lock(log_latch_);
+  // victims of the group evicted before the shard latches were taken are appended first.
+  eviction_cv_.wait(lock, [this] { return held_evictions_ == 0; });
+  uint64_t group = open_group_++;
+  for(frame_id_t frame_id : logged_frames_) {
+    Frame &frame = frames_[frame_id];
+    // the frame may have been evicted, its image logged on the way out, or taken by another page since.
+    if(!frame.is_valid_ || frame.log_group_ != group)
+      continue;
+    if(frame.is_dirty_) {
+      log_->append(WriteAheadLog::RecordType::Page, group, frame.page_id_, frame.data(), PAGE_SIZE);
+      MarkLogged(frame.page_id_);
+    }
+  }
+  for(const auto &[page_id, is_alloc] : page_events_)
+    log_->append(is_alloc ? WriteAheadLog::RecordType::Alloc : WriteAheadLog::RecordType::Dealloc, group, page_id);
+  if constexpr(!std::is_same_v<Meta, monometa>) {
+    if(is_meta_dirty_)
+      log_->append(WriteAheadLog::RecordType::Meta, group, 0, meta_.get(), sizeof(Meta));
+  }
+  log_->append(WriteAheadLog::RecordType::Commit, group, 0);
+  logged_frames_.clear();
+  page_events_.clear();
+  is_meta_dirty_ = false;
+  return group;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::SyncLog(uint64_t group) {
+  log_->sync();
+  {
+    std::unique_lock lock(durable_latch_);
+    if(durable_group_.load() < group)
+      durable_group_.store(group);
+  }
+  durable_cv_.notify_all();
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+uint64_t BufferPool<T, Meta, align>::HoldEviction(const Frame &frame) {
+  if(frame.log_group_ <= durable_group_.load())
+    return 0;
+  if(frame.log_group_ == open_group_) {
+    // CaptureGroup waits for it: the group would otherwise commit without the page.
+    std::unique_lock lock(log_latch_);
+    ++held_evictions_;
+  }
+  return frame.log_group_;
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::LogEviction(page_id_t page_id, uint64_t group, const char *data) {
+  std::unique_lock lock(log_latch_);
+  // a held group is still open.
+  if(group == open_group_) {
+    // written by a scope that may still be open. Should the group never commit, the log takes the page back.
+    // The page is the victim of a loading frame, so nobody else logs or writes it meanwhile.
+    if(!IsLogged(page_id)) {
+      lock.unlock();
+      AlignedPage committed;
+      try {
+        fstream_.read(page_id, &committed);
+      } catch(...) {
+        lock.lock();
+        --held_evictions_;
+        eviction_cv_.notify_all();
+        throw;
+      }
+      lock.lock();
+      log_->append(WriteAheadLog::RecordType::Restore, 0, page_id, committed.data_, PAGE_SIZE);
+      MarkLogged(page_id);
+    }
+    log_->append(WriteAheadLog::RecordType::Page, group, page_id, data, PAGE_SIZE);
+    --held_evictions_;
+    eviction_cv_.notify_all();
+  }
+  // every group closed so far has been appended.
+  uint64_t closed_group = open_group_ - 1;
+  lock.unlock();
+  SyncLog(closed_group);
+}
+
+template <Trivial T, Trivial Meta, size_t align>
+void BufferPool<T, Meta, align>::MarkLogged(page_id_t page_id) {
+  if(page_id >= is_logged_page_.size())
+    is_logged_page_.resize(std::max<size_t>(page_id + 1, is_logged_page_.size() * 2));
+  is_logged_page_[page_id] = 1;
+}
+
 }
 
-#endif
\ No newline at end of file
+#endif
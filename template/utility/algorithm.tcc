@@ -0,0 +1,95 @@
+#ifndef INSOMNIA_ALGORITHM_TCC
+#define INSOMNIA_ALGORITHM_TCC
+
+#include "algorithm.h"
+
+namespace insomnia {
+
+namespace algorithm_detail {
+
+template <class T, class Compare>
+void insertion_sort(T *first, T *last, const Compare &compare) {
+  for(T *cur = first + 1; cur < last; ++cur) {
+    T val = std::move(*cur);
+    T *pos = cur;
+    for(; pos != first && compare(val, *(pos - 1)); --pos)
+      *pos = std::move(*(pos - 1));
+    *pos = std::move(val);
+  }
+}
+
+template <class T, class Compare>
+void sift_down(T *first, size_t pos, size_t size, const Compare &compare) {
+  T val = std::move(first[pos]);
+  while(true) {
+    size_t child = pos * 2 + 1;
+    if(child >= size) break;
+    if(child + 1 < size && compare(first[child], first[child + 1]))
+      ++child;
+    if(!compare(val, first[child])) break;
+    first[pos] = std::move(first[child]);
+    pos = child;
+  }
+  first[pos] = std::move(val);
+}
+
+template <class T, class Compare>
+void heap_sort(T *first, T *last, const Compare &compare) {
+  size_t size = last - first;
+  for(size_t pos = size / 2; pos-- > 0; )
+    sift_down(first, pos, size, compare);
+  for(size_t end = size; end-- > 1; ) {
+    std::swap(first[0], first[end]);
+    sift_down(first, 0, end, compare);
+  }
+}
+
+template <class T, class Compare>
+void intro_sort(T *first, T *last, int depth, const Compare &compare) {
+  while(last - first > 16) {
+    if(depth-- == 0) {
+      heap_sort(first, last, compare);
+      return;
+    }
+    T *mid = first + (last - first) / 2;
+    // median of three moved to *first, used as the pivot.
+    if(compare(*mid, *first)) std::swap(*mid, *first);
+    if(compare(*(last - 1), *mid)) std::swap(*(last - 1), *mid);
+    if(compare(*mid, *first)) std::swap(*mid, *first);
+    std::swap(*first, *mid);
+    T *lft = first + 1, *rht = last - 1;
+    while(true) {
+      while(compare(*lft, *first)) ++lft;
+      while(compare(*first, *rht)) --rht;
+      if(lft >= rht) break;
+      std::swap(*lft, *rht);
+      ++lft;
+      --rht;
+    }
+    std::swap(*first, *rht);
+    // recurse into the smaller half.
+    if(rht - first < last - rht - 1) {
+      intro_sort(first, rht, depth, compare);
+      first = rht + 1;
+    } else {
+      intro_sort(rht + 1, last, depth, compare);
+      last = rht;
+    }
+  }
+  insertion_sort(first, last, compare);
+}
+
+}
+
+template <class T, class Compare>
+void sort(T *first, T *last, const Compare &compare) {
+  if(last - first < 2) return;
+  int depth = 0;
+  for(size_t size = last - first; size > 1; size >>= 1)
+    depth += 2;
+  algorithm_detail::intro_sort(first, last, depth, compare);
+}
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include "array.h"
+#include "hashed_bplustree.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+// collides for every pair of strings of the same length.
+struct LengthHash {
+  size_t len;
+  LengthHash() = default;
+  LengthHash(std::string_view str) : len(str.length()) {}
+  bool operator<(const LengthHash &other) const { return len < other.len; }
+};
+
+class HashedBptFixture : public ::testing::Test {
+protected:
+  using str_t = array<char, 64>;
+  using HashedBpt = HashedMultiBPlusTree<str_t, int>;
+  using CollidingBpt = HashedMultiBPlusTree<str_t, int, std::less<int>, LengthHash>;
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "hashed_bpt_test"};
+  const size_t buffer_capa{1024}, k_dist{3}, thread_cnt{6};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+};
+
+TEST_F(HashedBptFixture, ExampleTest) {
+  HashedBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  ASSERT_TRUE(bpt.insert("FlowersForAlgernon", 1966));
+  ASSERT_TRUE(bpt.insert("CppPrimer", 2012));
+  ASSERT_TRUE(bpt.insert("Dune", 2021));
+  ASSERT_TRUE(bpt.insert("CppPrimer", 2001));
+  ASSERT_FALSE(bpt.insert("CppPrimer", 2001));
+  auto list1 = bpt.search("CppPrimer");
+  ASSERT_EQ(list1.size(), 2);
+  ASSERT_EQ(list1[0], 2001);
+  ASSERT_EQ(list1[1], 2012);
+  ASSERT_EQ(bpt.search("Java").size(), 0);
+  ASSERT_FALSE(bpt.remove("Java", 1995));
+  ASSERT_TRUE(bpt.remove("Dune", 2021));
+  ASSERT_EQ(bpt.search("Dune").size(), 0);
+  ASSERT_TRUE(bpt.insert("Dune", 1965));
+  ASSERT_EQ(bpt.search("Dune")[0], 1965);
+}
+
+TEST_F(HashedBptFixture, CollisionTest) {
+  const int range = 2000;
+  auto key_of = [] (int i) {
+    std::string key = std::to_string(i);
+    return std::string(6 - key.length(), '0') + key;
+  };
+  {
+    CollidingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i) {
+      ASSERT_TRUE(bpt.insert(key_of(i), i));
+      ASSERT_TRUE(bpt.insert(key_of(i), i + range));
+    }
+    for(int i = 0; i < range; i += 2)
+      ASSERT_TRUE(bpt.remove(key_of(i), i));
+    ASSERT_FALSE(bpt.remove(key_of(range), range));
+  }
+  CollidingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; ++i) {
+    auto list = bpt.search(key_of(i));
+    if(i % 2 == 0) {
+      ASSERT_EQ(list.size(), 1);
+      ASSERT_EQ(list[0], i + range);
+    } else {
+      ASSERT_EQ(list.size(), 2);
+      ASSERT_EQ(list[0], i);
+      ASSERT_EQ(list[1], i + range);
+    }
+  }
+  ASSERT_EQ(bpt.search(key_of(range)).size(), 0);
+  // the only string of its length: a stranger with the same hash must not read its values.
+  ASSERT_TRUE(bpt.insert("loneliest", 7));
+  ASSERT_EQ(bpt.search("loneliest").size(), 1);
+  ASSERT_EQ(bpt.search("strangers").size(), 0);
+}
+
+TEST_F(HashedBptFixture, BatchTest) {
+  HashedBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int range = 30000;
+  vector<std::pair<str_t, int>> batch;
+  for(int i = 0; i < range; ++i)
+    batch.push_back({"user_" + std::to_string(i % 500), i});
+  ASSERT_EQ(bpt.insert_batch(batch.begin(), batch.end()), range);
+  ASSERT_EQ(bpt.insert_batch(batch.begin(), batch.end()), 0);
+  ASSERT_EQ(bpt.remove_batch(batch.begin(), batch.begin() + range / 2), range / 2);
+  for(int i = 0; i < 500; ++i) {
+    auto list = bpt.search("user_" + std::to_string(i));
+    ASSERT_EQ(list.size(), range / 1000);
+    for(int j = 0; j < list.size(); ++j)
+      ASSERT_EQ(list[j], range / 2 + i + 500 * j);
+  }
+}
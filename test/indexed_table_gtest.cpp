@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "array.h"
+#include "indexed_table.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+class IndexedTableFixture : public ::testing::Test {
+protected:
+  struct Order {
+    array<char, 20> user;
+    array<char, 20> train;
+    int timestamp;
+    int amount;
+  };
+  struct ByUser {
+    using key_type = array<char, 20>;
+    static key_type key_of(const Order &order) { return order.user; }
+  };
+  struct ByTrain {
+    using key_type = array<char, 20>;
+    static key_type key_of(const Order &order) { return order.train; }
+  };
+  struct ByTime {
+    using key_type = int;
+    static key_type key_of(const Order &order) { return order.timestamp; }
+  };
+  using OrderTable = IndexedTable<Order, ByUser, ByTrain, ByTime>;
+
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "indexed_table_test"};
+  const size_t buffer_capa{1024}, k_dist{3}, thread_cnt{4};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+
+  static Order MakeOrder(int i) {
+    return Order{"user" + std::to_string(i % 50), "train" + std::to_string(i % 7), i, i * 10};
+  }
+};
+
+TEST_F(IndexedTableFixture, ExampleTest) {
+  OrderTable table(base_fname, k_dist, buffer_capa, thread_cnt);
+  RID rid1 = table.insert(Order{"alice", "G1", 1, 100});
+  RID rid2 = table.insert(Order{"alice", "G2", 2, 200});
+  table.insert(Order{"bob", "G1", 3, 300});
+  auto alice = table.search<ByUser>("alice");
+  ASSERT_EQ(alice.size(), 2);
+  ASSERT_EQ(alice[0].amount, 100);
+  ASSERT_EQ(alice[1].amount, 200);
+  ASSERT_EQ(table.search<ByTrain>("G1").size(), 2);
+  ASSERT_EQ(table.search<ByTime>(3)[0].user, "bob");
+
+  ASSERT_TRUE(table.update(rid1, Order{"alice", "G3", 1, 150}));
+  ASSERT_EQ(table.search<ByTrain>("G1").size(), 1);
+  ASSERT_EQ(table.search<ByTrain>("G3")[0].amount, 150);
+  ASSERT_TRUE(table.remove(rid2));
+  ASSERT_FALSE(table.remove(rid2));
+  ASSERT_EQ(table.search<ByUser>("alice").size(), 1);
+  ASSERT_EQ(table.search<ByTime>(2).size(), 0);
+  Order order;
+  ASSERT_TRUE(table.read(rid1, order));
+  ASSERT_EQ(order.train, "G3");
+}
+
+TEST_F(IndexedTableFixture, RangeTest) {
+  const int count = 5000;
+  std::vector<RID> rids;
+  {
+    OrderTable table(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < count; ++i)
+      rids.push_back(table.insert(MakeOrder(i)));
+  }
+  OrderTable table(base_fname, k_dist, buffer_capa, thread_cnt);
+  int expected = 1000;
+  ASSERT_EQ(table.range<ByTime>(1000, 2000, [&expected] (const Order &order) {
+    EXPECT_EQ(order.timestamp, expected++);
+  }), 1000);
+  ASSERT_EQ(table.search<ByTrain>("train3", [] (const Order &order) { return order.timestamp < 100; }), 15);
+  for(int i = 0; i < count; i += 2)
+    ASSERT_TRUE(table.remove(rids[i]));
+  ASSERT_EQ(table.search<ByUser>("user7").size(), count / 50);
+  ASSERT_EQ(table.search<ByUser>("user8").size(), 0);
+  ASSERT_EQ(table.range<ByTime>(0, count, [] (const Order&) {}), count / 2);
+}
+
+TEST_F(IndexedTableFixture, UpdateFoundTest) {
+  OrderTable table(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < 1000; ++i)
+    table.insert(MakeOrder(i));
+  // records found through an index are updated and removed by the RIDs handed to the visitor.
+  std::vector<std::pair<RID, Order>> found;
+  ASSERT_EQ(table.search<ByUser>("user3", [&found] (const RID &rid, const Order &order) {
+    found.push_back({rid, order});
+  }), 20);
+  for(auto &[rid, order] : found) {
+    order.amount = -1;
+    ASSERT_TRUE(table.update(rid, order));
+  }
+  for(const Order &order : table.search<ByUser>("user3"))
+    ASSERT_EQ(order.amount, -1);
+  std::vector<RID> early;
+  table.range<ByTime>(0, 100, [&early] (const RID &rid, const Order&) { early.push_back(rid); });
+  ASSERT_EQ(early.size(), 100);
+  for(const RID &rid : early)
+    ASSERT_TRUE(table.remove(rid));
+  ASSERT_EQ(table.range<ByTime>(0, 1000, [] (const Order&) {}), 900);
+}
+
+TEST_F(IndexedTableFixture, ConcurrentTest) {
+  const int count = 8000, workers = 4;
+  OrderTable table(base_fname, k_dist, buffer_capa, thread_cnt);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&table, t] {
+      for(int i = t; i < count; i += workers)
+        table.insert(MakeOrder(i));
+    });
+  for(auto &thread : threads)
+    thread.join();
+  for(int k = 0; k < 7; ++k) {
+    auto orders = table.search<ByTrain>("train" + std::to_string(k));
+    ASSERT_EQ(orders.size(), count / 7 + (k < count % 7));
+    for(auto &order : orders)
+      ASSERT_EQ(order.timestamp % 7, k);
+  }
+}
@@ -1,6 +1,9 @@
 // The main body of this file originally comes from a CMU15-445 2024fall project1 test file.
 // I've adjusted it in accord with my implementation.
 #include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
 #include "lru_k_replacer.h"
 
 using insomnia::LruKReplacer;
@@ -26,7 +29,7 @@ TEST(LRUKReplacerTest, SampleTest) {
   lru_replacer.pin(6);
 
   // The size of the replacer is the number of frames that can be evicted, _not_ the total number of frames entered.
-  ASSERT_EQ(5, lru_replacer.free_cnt());
+  ASSERT_EQ(5, lru_replacer.evictable_cnt());
 
   // Record an access for frame 1. Now frame 1 has two accesses total.
   lru_replacer.access(1);
@@ -38,7 +41,7 @@ TEST(LRUKReplacerTest, SampleTest) {
   ASSERT_EQ(2, lru_replacer.evict());
   ASSERT_EQ(3, lru_replacer.evict());
   ASSERT_EQ(4, lru_replacer.evict());
-  ASSERT_EQ(2, lru_replacer.free_cnt());
+  ASSERT_EQ(2, lru_replacer.evictable_cnt());
   // Now the replacer has the frames [5, 1].
 
   // Insert new frames [3, 4], and update the access history for 5. Now, the ordering is [3, 1, 5, 4].
@@ -48,42 +51,42 @@ TEST(LRUKReplacerTest, SampleTest) {
   lru_replacer.access(4);
   lru_replacer.unpin(3);
   lru_replacer.unpin(4);
-  ASSERT_EQ(4, lru_replacer.free_cnt());
+  ASSERT_EQ(4, lru_replacer.evictable_cnt());
 
   // Look for a frame to evict. We expect frame 3 to be evicted next.
   ASSERT_EQ(3, lru_replacer.evict());
-  ASSERT_EQ(3, lru_replacer.free_cnt());
+  ASSERT_EQ(3, lru_replacer.evictable_cnt());
 
   // Set 6 to be evictable. 6 Should be evicted next since it has the maximum backward k-distance.
   lru_replacer.unpin(6);
-  ASSERT_EQ(4, lru_replacer.free_cnt());
+  ASSERT_EQ(4, lru_replacer.evictable_cnt());
   ASSERT_EQ(6, lru_replacer.evict());
-  ASSERT_EQ(3, lru_replacer.free_cnt());
+  ASSERT_EQ(3, lru_replacer.evictable_cnt());
 
   // Mark frame 1 as non-evictable. We now have [5, 4].
   lru_replacer.pin(1);
 
   // We expect frame 5 to be evicted next.
-  ASSERT_EQ(2, lru_replacer.free_cnt());
+  ASSERT_EQ(2, lru_replacer.evictable_cnt());
   ASSERT_EQ(5, lru_replacer.evict());
-  ASSERT_EQ(1, lru_replacer.free_cnt());
+  ASSERT_EQ(1, lru_replacer.evictable_cnt());
 
   // Update the access history for frame 1 and make it evictable. Now we have [4, 1].
   lru_replacer.access(1);
   lru_replacer.access(1);
   lru_replacer.unpin(1);
-  ASSERT_EQ(2, lru_replacer.free_cnt());
+  ASSERT_EQ(2, lru_replacer.evictable_cnt());
 
   // Evict the last two frames.
   ASSERT_EQ(4, lru_replacer.evict());
-  ASSERT_EQ(1, lru_replacer.free_cnt());
+  ASSERT_EQ(1, lru_replacer.evictable_cnt());
   ASSERT_EQ(1, lru_replacer.evict());
-  ASSERT_EQ(0, lru_replacer.free_cnt());
+  ASSERT_EQ(0, lru_replacer.evictable_cnt());
 
   // Insert frame 1 again and mark it as non-evictable.
   lru_replacer.access(1);
   lru_replacer.pin(1);
-  ASSERT_EQ(0, lru_replacer.free_cnt());
+  ASSERT_EQ(0, lru_replacer.evictable_cnt());
 
   // A failed eviction should not change the size of the replacer.
   frame = lru_replacer.evict();
@@ -91,16 +94,124 @@ TEST(LRUKReplacerTest, SampleTest) {
 
   // Mark frame 1 as evictable again and evict it.
   lru_replacer.unpin(1);
-  ASSERT_EQ(1, lru_replacer.free_cnt());
+  ASSERT_EQ(1, lru_replacer.evictable_cnt());
   ASSERT_EQ(1, lru_replacer.evict());
-  ASSERT_EQ(0, lru_replacer.free_cnt());
+  ASSERT_EQ(0, lru_replacer.evictable_cnt());
 
   // There is nothing left in the replacer, so make sure this doesn't do something strange.
   frame = lru_replacer.evict();
   ASSERT_EQ(lru_replacer.npos, frame);
-  ASSERT_EQ(0, lru_replacer.free_cnt());
+  ASSERT_EQ(0, lru_replacer.evictable_cnt());
 
   // Make sure that setting a non-existent frame as evictable or non-evictable doesn't do something strange.
   lru_replacer.pin(6);
   lru_replacer.unpin(6);
-}
\ No newline at end of file
+}
+
+TEST(LRUKReplacerTest, ColdestTest) {
+  LruKReplacer lru_replacer(2, 7);
+  for(size_t frame = 1; frame <= 5; ++frame) {
+    lru_replacer.access(frame);
+    lru_replacer.unpin(frame);
+  }
+  lru_replacer.access(1);
+  lru_replacer.pin(3);
+  // frame 1 has two accesses, so it goes after the others. Frame 3 is not evictable.
+  auto coldest = lru_replacer.coldest(3);
+  ASSERT_EQ(coldest.size(), 3);
+  ASSERT_EQ(coldest[0], 2);
+  ASSERT_EQ(coldest[1], 4);
+  ASSERT_EQ(coldest[2], 5);
+  // the whole order runs through the hotspot frames after the obscure ones, and nothing is evicted.
+  coldest = lru_replacer.coldest(10);
+  ASSERT_EQ(coldest.size(), 4);
+  ASSERT_EQ(lru_replacer.evictable_cnt(), 4);
+  for(size_t frame : coldest)
+    ASSERT_EQ(lru_replacer.evict(), frame);
+  ASSERT_TRUE(lru_replacer.coldest(1).empty());
+  lru_replacer.unpin(3);
+  ASSERT_EQ(lru_replacer.coldest(1)[0], 3);
+}
+
+TEST(LRUKReplacerTest, AdmitTest) {
+  LruKReplacer lru_replacer(2, 7);
+  lru_replacer.access(1);
+  lru_replacer.unpin(1);
+  lru_replacer.admit(2);
+  ASSERT_EQ(lru_replacer.evictable_cnt(), 2);
+  // admitted after frame 1 was accessed, so it goes after frame 1.
+  auto coldest = lru_replacer.coldest(2);
+  ASSERT_EQ(coldest[0], 1);
+  ASSERT_EQ(coldest[1], 2);
+  // admitting a tracked frame changes nothing.
+  lru_replacer.admit(1);
+  ASSERT_EQ(lru_replacer.evictable_cnt(), 2);
+  ASSERT_EQ(lru_replacer.coldest(1)[0], 1);
+  // the first access after admission doesn't heat frame 2: it stays among the frames accessed once,
+  // before frame 3 accessed after it. Heated, it would go after frame 3.
+  lru_replacer.pin(2);
+  lru_replacer.access(2);
+  lru_replacer.unpin(2);
+  lru_replacer.access(3);
+  lru_replacer.unpin(3);
+  lru_replacer.access(1);
+  ASSERT_EQ(lru_replacer.evict(), 2);
+  ASSERT_EQ(lru_replacer.evict(), 3);
+  ASSERT_EQ(lru_replacer.evict(), 1);
+}
+
+TEST(LRUKReplacerTest, RandomOrderTest) {
+  // eviction order checked against a linear scan over the access histories.
+  const size_t k = 3, capacity = 300;
+  LruKReplacer lru_replacer(k, capacity);
+  std::vector<std::vector<size_t>> history(capacity);
+  std::vector<bool> evictable(capacity);
+  size_t timestamp = 0;
+  auto expected_victim = [&] {
+    size_t victim = capacity;
+    bool victim_heated = true;
+    size_t victim_dist = SIZE_MAX;
+    for(size_t frame = 0; frame < capacity; ++frame) {
+      if(!evictable[frame])
+        continue;
+      bool heated = history[frame].size() >= k;
+      size_t dist = heated ? history[frame][history[frame].size() - k] : history[frame][0];
+      if(victim == capacity || (victim_heated && !heated) || (victim_heated == heated && dist < victim_dist)) {
+        victim = frame;
+        victim_heated = heated;
+        victim_dist = dist;
+      }
+    }
+    return victim;
+  };
+  std::mt19937 rng(2025);
+  for(int round = 0; round < 20000; ++round) {
+    size_t frame = rng() % capacity;
+    switch(rng() % 4) {
+    case 0:
+    case 1:
+      lru_replacer.access(frame);
+      history[frame].push_back(timestamp++);
+      break;
+    case 2:
+      if(!history[frame].empty()) {
+        lru_replacer.unpin(frame);
+        evictable[frame] = true;
+      }
+      break;
+    default:
+      lru_replacer.pin(frame);
+      evictable[frame] = false;
+    }
+    if(round % 50 == 0) {
+      size_t victim = expected_victim();
+      auto coldest = lru_replacer.coldest(1);
+      ASSERT_EQ(coldest.empty() ? capacity : coldest[0], victim);
+      ASSERT_EQ(lru_replacer.evict(), victim);
+      if(victim != capacity) {
+        history[victim].clear();
+        evictable[victim] = false;
+      }
+    }
+  }
+}
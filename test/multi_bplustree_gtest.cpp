@@ -1,4 +1,9 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "array.h"
 #include "bplustree.h"
@@ -66,4 +71,716 @@ TEST_F(MultiBptFixture, MassInsertTest) {
     auto list = bpt.search("0");
     ASSERT_EQ(list.size(), range);
   }
-}
\ No newline at end of file
+}
+TEST_F(MultiBptFixture, RangeScanTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int range = 20000;
+  for(int i = 0; i < range; ++i) {
+    bpt.insert("key" + std::to_string(i), i);
+    bpt.insert("key" + std::to_string(i), -i);
+  }
+  {
+    // "key1000" <= key < "key1001": key1000, key10000..key10009
+    int cnt = 0;
+    for(auto cursor = bpt.range("key1000", "key1001"); cursor.valid(); cursor.next())
+      ++cnt;
+    ASSERT_EQ(cnt, 22);
+  }
+  {
+    int cnt = 0;
+    str_t last = "";
+    for(auto cursor = bpt.prefix_range("key12"); cursor.valid(); cursor.next()) {
+      ASSERT_EQ(strncmp(cursor.key().c_str(), "key12", 5), 0);
+      ASSERT_FALSE(cursor.key() < last);
+      last = cursor.key();
+      ++cnt;
+    }
+    // key12, key120..key129, key1200..key1299, key12000..key12999
+    ASSERT_EQ(cnt, 2 * (1 + 10 + 100 + 1000));
+  }
+  {
+    auto cursor = bpt.lower_bound("key9999");
+    ASSERT_TRUE(cursor.valid());
+    ASSERT_EQ(cursor.value(), -9999);
+    cursor.next();
+    ASSERT_EQ(cursor.value(), 9999);
+    cursor.next();
+    ASSERT_FALSE(cursor.valid());
+  }
+  ASSERT_FALSE(bpt.range("key5", "key5").valid());
+  ASSERT_FALSE(bpt.prefix_range("nokey").valid());
+}
+
+TEST_F(MultiBptFixture, ConcurrentWriteTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int thread_num = 8, range = 5000;
+  vector<std::thread> threads;
+  for(int t = 0; t < thread_num; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = 0; i < range; ++i)
+        bpt.insert(std::to_string(i), t);
+      for(int i = 0; i < range; i += 2)
+        bpt.remove(std::to_string(i), t);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  for(int i = 0; i < range; ++i) {
+    auto list = bpt.search(std::to_string(i));
+    ASSERT_EQ(list.size(), i % 2 == 0 ? 0 : thread_num);
+  }
+}
+
+TEST_F(MultiBptFixture, BulkLoadTest) {
+  const int range = 100000;
+  vector<std::pair<str_t, int>> pairs;
+  for(int i = 0; i < range; ++i) {
+    std::string key = std::to_string(i);
+    key = std::string(6 - key.length(), '0') + key;
+    pairs.push_back({key, i});
+    pairs.push_back({key, i + range});
+  }
+  {
+    MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    ASSERT_EQ(bpt.bulk_load(pairs.begin(), pairs.end(), 0.9), 2 * range);
+    ASSERT_THROW(bpt.bulk_load(pairs.begin(), pairs.end()), database_exception);
+  }
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; i += 7) {
+    auto list = bpt.search(pairs[2 * i].first);
+    ASSERT_EQ(list.size(), 2);
+    ASSERT_EQ(list[0], i);
+    ASSERT_EQ(list[1], i + range);
+  }
+  for(int i = 0; i < range; i += 2)
+    ASSERT_TRUE(bpt.remove(pairs[2 * i].first, i));
+  ASSERT_TRUE(bpt.insert("000000", -1));
+  auto list = bpt.search("000000");
+  ASSERT_EQ(list.size(), 2);
+  ASSERT_EQ(list[0], -1);
+}
+
+TEST_F(MultiBptFixture, BulkLoadUnsortedTest) {
+  vector<std::pair<str_t, int>> pairs;
+  for(int i = 0; i < 10000; ++i)
+    pairs.push_back({"key", i});
+  pairs.push_back({"aaa", 0});
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  ASSERT_THROW(bpt.bulk_load(pairs.begin(), pairs.end()), database_exception);
+  ASSERT_EQ(bpt.search("key").size(), 0);
+  ASSERT_TRUE(bpt.insert("key", 1));
+}
+
+TEST_F(MultiBptFixture, BatchTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int range = 50000;
+  vector<std::pair<str_t, int>> batch;
+  for(int i = range - 1; i >= 0; --i)
+    batch.push_back({std::to_string(i % 1000), i});
+  ASSERT_EQ(bpt.insert_batch(batch.begin(), batch.end()), range);
+  ASSERT_EQ(bpt.insert_batch(batch.begin(), batch.end()), 0);
+  for(int i = 0; i < 1000; ++i) {
+    auto list = bpt.search(std::to_string(i));
+    ASSERT_EQ(list.size(), range / 1000);
+    for(int j = 0; j < list.size(); ++j)
+      ASSERT_EQ(list[j], i + 1000 * j);
+  }
+  vector<std::pair<str_t, int>> removal;
+  for(int i = 0; i < range; i += 2)
+    removal.push_back({std::to_string(i % 1000), i});
+  removal.push_back({"nothing", 0});
+  ASSERT_EQ(bpt.remove_batch(removal.begin(), removal.end()), range / 2);
+  for(int i = 0; i < 1000; ++i)
+    ASSERT_EQ(bpt.search(std::to_string(i)).size(), i % 2 == 0 ? 0 : range / 1000);
+}
+
+TEST_F(MultiBptFixture, SharedPrefixTest) {
+  // long keys sharing long prefixes: separators get truncated and compressed.
+  auto key_of = [] (int i) {
+    return "station/" + std::to_string(i % 5) + "/platform/" + std::to_string(i % 11)
+      + "/train/" + std::to_string(i);
+  };
+  const int range = 30000;
+  {
+    MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i) {
+      ASSERT_TRUE(bpt.insert(key_of(i), i));
+      ASSERT_TRUE(bpt.insert(key_of(i), i + range));
+    }
+    for(int i = 0; i < range; i += 3)
+      ASSERT_TRUE(bpt.remove(key_of(i), i + range));
+  }
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; ++i) {
+    auto list = bpt.search(key_of(i));
+    ASSERT_EQ(list.size(), i % 3 == 0 ? 1 : 2);
+    ASSERT_EQ(list[0], i);
+  }
+  int cnt = 0;
+  for(auto cursor = bpt.prefix_range("station/2/platform/7/"); cursor.valid(); cursor.next())
+    ++cnt;
+  int expected = 0;
+  for(int i = 0; i < range; ++i)
+    if(i % 5 == 2 && i % 11 == 7)
+      expected += i % 3 == 0 ? 1 : 2;
+  ASSERT_EQ(cnt, expected);
+  for(int i = 0; i < range; ++i) {
+    ASSERT_TRUE(bpt.remove(key_of(i), i));
+    if(i % 3 != 0)
+      ASSERT_TRUE(bpt.remove(key_of(i), i + range));
+  }
+  ASSERT_FALSE(bpt.lower_bound("").valid());
+}
+
+TEST_F(MultiBptFixture, SearchVisitorTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int hot = 5000;
+  // the hot key spans many leaves, between two ordinary keys.
+  bpt.insert("Cold", 0);
+  bpt.insert("Warm", 0);
+  for(int i = hot - 1; i >= 0; --i)
+    bpt.insert("Hot", i);
+  ASSERT_EQ(bpt.count("Hot"), hot);
+  ASSERT_EQ(bpt.count("Cold"), 1);
+  ASSERT_EQ(bpt.count("Lukewarm"), 0);
+
+  std::vector<int> top;
+  bpt.search("Hot", std::back_inserter(top), 10);
+  ASSERT_EQ(top.size(), 10);
+  for(int i = 0; i < 10; ++i)
+    ASSERT_EQ(top[i], i);
+
+  int sum = 0;
+  ASSERT_EQ(bpt.search("Hot", [&sum] (int value) { sum += value; }), hot);
+  ASSERT_EQ(sum, hot * (hot - 1) / 2);
+  ASSERT_EQ(bpt.search("Hot", [] (int value) { return value < 100; }), 101);
+  ASSERT_EQ(bpt.search("Lukewarm", [] (int) {}), 0);
+
+  int expected = 0, leaves = 0;
+  for(auto view = bpt.search_view("Hot"); view.valid(); view.next()) {
+    ++leaves;
+    for(int i = 0; i < view.size(); ++i)
+      ASSERT_EQ(view[i], expected++);
+  }
+  ASSERT_EQ(expected, hot);
+  ASSERT_GT(leaves, 1);
+  ASSERT_FALSE(bpt.search_view("Lukewarm").valid());
+}
+
+TEST_F(MultiBptFixture, SnapshotTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int range = 20000;
+  for(int i = 0; i < range; ++i)
+    bpt.insert(std::to_string(i % 1000), i);
+  auto snapshot = bpt.snapshot();
+  // splits and merges all over the tree while the snapshot is read.
+  std::thread writer([&bpt] {
+    for(int i = 0; i < range; i += 2)
+      bpt.remove(std::to_string(i % 1000), i);
+    for(int i = range; i < 2 * range; ++i)
+      bpt.insert(std::to_string(i % 1000), i);
+  });
+  for(int round = 0; round < 3; ++round)
+    for(int k = 0; k < 1000; ++k) {
+      auto list = snapshot.search(std::to_string(k));
+      ASSERT_EQ(list.size(), range / 1000);
+      for(int j = 0; j < list.size(); ++j)
+        ASSERT_EQ(list[j], k + j * 1000);
+    }
+  writer.join();
+  ASSERT_EQ(snapshot.count("8"), range / 1000);
+  ASSERT_EQ(bpt.count("8"), range / 1000);
+  ASSERT_EQ(bpt.count("7"), 2 * range / 1000);
+  auto later = bpt.snapshot();
+  ASSERT_EQ(later.search("8")[0], range + 8);
+  snapshot.release();
+  ASSERT_EQ(later.search("8", [] (int) {}, 5), 5);
+  ASSERT_FALSE(MultiBpt::Snapshot().valid());
+}
+
+TEST_F(MultiBptFixture, ConcurrentSnapshotTest) {
+  // snapshots taken while batches go on see every batch in whole or not at all.
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int thread_num = 4, range = 3000;
+  std::atomic<bool> is_done{false};
+  vector<std::thread> threads;
+  for(int t = 0; t < thread_num; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = t; i < range; i += thread_num) {
+        std::pair<str_t, int> batch[] = {{"a", i}, {"m" + std::to_string(i), i}, {"z", i}};
+        bpt.insert_batch(batch, batch + 3);
+      }
+    });
+  std::thread reader([&bpt, &is_done] {
+    size_t last = 0;
+    while(!is_done) {
+      auto snapshot = bpt.snapshot();
+      size_t count = snapshot.count("a");
+      ASSERT_EQ(snapshot.count("z"), count);
+      ASSERT_GE(count, last);
+      last = count;
+    }
+  });
+  for(auto &thread : threads)
+    thread.join();
+  is_done = true;
+  reader.join();
+  auto snapshot = bpt.snapshot();
+  ASSERT_EQ(snapshot.count("a"), range);
+  ASSERT_EQ(snapshot.count("z"), range);
+}
+
+TEST_F(MultiBptFixture, VariableLengthKeyTest) {
+  const int range = 30000;
+  // lengths from 1 to 64, unrelated to the order of the keys.
+  auto key_of = [] (int i) {
+    std::string key = std::to_string(i);
+    return str_t(key + std::string((i * 7) % (64 - key.length()), 'v'));
+  };
+  {
+    MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i)
+      ASSERT_TRUE(bpt.insert(key_of((i * 7919) % range), i));
+    for(int i = 0; i < range; i += 3)
+      ASSERT_TRUE(bpt.remove(key_of((i * 7919) % range), i));
+  }
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; ++i) {
+    auto list = bpt.search(key_of((i * 7919) % range));
+    ASSERT_EQ(list.size(), i % 3 == 0 ? 0 : 1);
+    if(i % 3 != 0)
+      ASSERT_EQ(list[0], i);
+  }
+  int cnt = 0;
+  str_t last = "";
+  for(auto cursor = bpt.lower_bound(""); cursor.valid(); cursor.next()) {
+    ASSERT_FALSE(cursor.key() < last);
+    last = cursor.key();
+    ++cnt;
+  }
+  ASSERT_EQ(cnt, range - (range + 2) / 3);
+}
+
+TEST_F(MultiBptFixture, ShortKeyFootprintTest) {
+  const int range = 100000;
+  {
+    MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i)
+      bpt.insert("s" + std::to_string(i), i);
+  }
+  // short keys take their own length, not 64 bytes each (files grow by doubling).
+  ASSERT_LT(fs::file_size(fs::path(base_fname).concat(".dat")), range * 48);
+}
+
+TEST_F(MultiBptFixture, DeferredRebalanceTest) {
+  const int range = 50000;
+  {
+    MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i)
+      ASSERT_TRUE(bpt.insert(std::to_string(i % 500), i));
+    // large enough that only the explicit compaction runs.
+    bpt.defer_rebalance(range);
+    for(int i = 0; i < range; ++i)
+      if(i % 10 != 0)
+        ASSERT_TRUE(bpt.remove(std::to_string(i % 500), i));
+    ASSERT_FALSE(bpt.remove("0", 1));
+    for(int i = 0; i < 500; ++i)
+      ASSERT_EQ(bpt.count(std::to_string(i)), i % 10 == 0 ? range / 500 : 0);
+    ASSERT_GT(bpt.compact(), 0);
+    ASSERT_EQ(bpt.compact(), 0);
+    for(int i = 0; i < 500; ++i) {
+      auto list = bpt.search(std::to_string(i));
+      ASSERT_EQ(list.size(), i % 10 == 0 ? range / 500 : 0);
+      for(int j = 0; j < list.size(); ++j)
+        ASSERT_EQ(list[j], i + 500 * j);
+    }
+    // emptied leaves, then an emptied root.
+    for(int i = 0; i < range; i += 10)
+      ASSERT_TRUE(bpt.remove(std::to_string(i % 500), i));
+    ASSERT_EQ(bpt.search("0").size(), 0);
+    bpt.compact();
+    ASSERT_TRUE(bpt.insert("0", 1));
+  }
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  ASSERT_EQ(bpt.search("0").size(), 1);
+}
+
+TEST_F(MultiBptFixture, BackgroundCompactionTest) {
+  const int range = 40000, workers = 4;
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; ++i)
+    bpt.insert(std::to_string(i), i);
+  bpt.defer_rebalance(64);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = t; i < range; i += workers)
+        if(i % 8 != 0)
+          bpt.remove(std::to_string(i), i);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  bpt.compact_async().get();
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.count(std::to_string(i)), i % 8 == 0 ? 1 : 0);
+  auto cursor = bpt.lower_bound("");
+  int entries = 0;
+  for(; cursor.valid(); cursor.next())
+    ++entries;
+  ASSERT_EQ(entries, range / 8);
+}
+
+TEST_F(MultiBptFixture, StatsTest) {
+  const int range = 50000;
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  auto empty_stats = bpt.stats();
+  ASSERT_EQ(empty_stats.height, 0);
+  ASSERT_TRUE(empty_stats.error.empty());
+  vector<std::pair<str_t, int>> batch;
+  for(int i = 0; i < range; ++i)
+    batch.push_back({std::to_string(100000 + i), i});
+  ASSERT_EQ(bpt.bulk_load(batch.begin(), batch.end()), range);
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_GE(stats.height, 2);
+  ASSERT_EQ(stats.level_pages.size(), stats.height);
+  ASSERT_EQ(stats.level_pages[0], 1);
+  ASSERT_EQ(stats.entries, range);
+  size_t leaves = stats.level_pages[stats.height - 1], histogram_total = 0;
+  for(size_t count : stats.fill_histogram)
+    histogram_total += count;
+  ASSERT_EQ(histogram_total, leaves);
+  // bulk loaded leaves are written out one after another.
+  ASSERT_EQ(stats.contiguous_links, leaves - 1);
+  ASSERT_EQ(stats.underfull_nodes, 0);
+
+  bpt.defer_rebalance(range);
+  for(int i = 0; i < range; ++i)
+    if(i % 10 != 0)
+      bpt.remove(std::to_string(100000 + i), i);
+  stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_EQ(stats.entries, range / 10);
+  ASSERT_GT(stats.underfull_nodes, 0);
+  ASSERT_GT(stats.fill_histogram[0] + stats.fill_histogram[1], 0);
+  bpt.compact();
+  auto compacted = bpt.stats();
+  ASSERT_TRUE(compacted.error.empty()) << compacted.error;
+  ASSERT_EQ(compacted.entries, range / 10);
+  ASSERT_LT(compacted.level_pages[compacted.height - 1], leaves);
+  ASSERT_LT(compacted.underfull_nodes, stats.underfull_nodes);
+  ASSERT_GT(compacted.free_pages, 0);
+}
+
+TEST_F(MultiBptFixture, ConcurrentStatsTest) {
+  // splits and merges go on under the walk, which still finds a sound tree.
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int thread_num = 4, range = 5000;
+  std::atomic<bool> is_done{false};
+  vector<std::thread> threads;
+  for(int t = 0; t < thread_num; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = 0; i < range; ++i)
+        bpt.insert(std::to_string(i), t);
+      for(int i = 0; i < range; i += 2)
+        bpt.remove(std::to_string(i), t);
+    });
+  std::thread inspector([&bpt, &is_done] {
+    while(!is_done) {
+      auto stats = bpt.stats();
+      ASSERT_TRUE(stats.error.empty()) << stats.error;
+    }
+  });
+  for(auto &thread : threads)
+    thread.join();
+  is_done = true;
+  inspector.join();
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_EQ(stats.entries, range / 2 * thread_num);
+}
+
+TEST_F(MultiBptFixture, SearchCacheTest) {
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  bpt.enable_cache(1 << 20);
+  std::vector<std::pair<std::string, int>> sorted;
+  for(int i = 0; i < 1000; ++i)
+    sorted.push_back({std::to_string(i % 100), i});
+  std::sort(sorted.begin(), sorted.end());
+  vector<std::pair<str_t, int>> batch;
+  for(auto &[key, value] : sorted)
+    batch.push_back({key, value});
+  // bulk_load drops the empty results cached before it.
+  ASSERT_TRUE(bpt.search("7").empty());
+  bpt.bulk_load(batch.begin(), batch.end());
+  ASSERT_EQ(bpt.count("7"), 10);
+  ASSERT_EQ(bpt.search("7").size(), 10);
+  auto stats = bpt.stats();
+  ASSERT_GE(stats.cache_hits, 1);
+  ASSERT_GT(stats.cache_bytes, 0);
+
+  // a limited search hits the cache too, and one that stops early doesn't fill it.
+  ASSERT_EQ(bpt.search("7", [] (int) {}, 3), 3);
+  ASSERT_EQ(bpt.search("8", [] (int) { return false; }), 1);
+  ASSERT_EQ(bpt.count("8"), 10);
+
+  bpt.insert("7", 2000);
+  ASSERT_EQ(bpt.count("7"), 11);
+  bpt.remove("7", 7);
+  auto values = bpt.search("7");
+  ASSERT_EQ(values.size(), 10);
+  ASSERT_EQ(values[0], 107);
+  ASSERT_EQ(values[9], 2000);
+  // failed writes leave the cache alone.
+  ASSERT_FALSE(bpt.insert("7", 2000));
+  ASSERT_FALSE(bpt.remove("7", 7));
+
+  vector<std::pair<str_t, int>> removed;
+  for(int i = 0; i < 1000; i += 100)
+    removed.push_back({"0", i});
+  bpt.search("0");
+  ASSERT_EQ(bpt.remove_batch(removed.begin(), removed.end()), 10);
+  ASSERT_TRUE(bpt.search("0").empty());
+  ASSERT_EQ(bpt.insert_batch(removed.begin(), removed.end()), 10);
+  ASSERT_EQ(bpt.count("0"), 10);
+
+  bpt.enable_cache(0);
+  ASSERT_EQ(bpt.count("7"), 10);
+  ASSERT_EQ(bpt.stats().cache_bytes, 0);
+}
+
+TEST_F(MultiBptFixture, SearchCacheBudgetTest) {
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const size_t budget = 64 << 10;
+  bpt.enable_cache(budget);
+  for(int i = 0; i < 10000; ++i)
+    bpt.insert(i % 1000, i);
+  for(int round = 0; round < 2; ++round)
+    for(int i = 0; i < 1000; ++i)
+      ASSERT_EQ(bpt.count(i), 10);
+  auto stats = bpt.stats();
+  ASSERT_GT(stats.cache_bytes, 0);
+  ASSERT_LE(stats.cache_bytes, budget);
+  ASSERT_GT(stats.cache_misses, 1000);
+}
+
+TEST_F(MultiBptFixture, SearchCacheConcurrentTest) {
+  const int writer_cnt = 4, rounds = 2048, key_cnt = 16;
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  bpt.enable_cache(1 << 20);
+  std::atomic<bool> is_done{false};
+  std::vector<std::thread> threads;
+  // every writer flips its own values in and out; a reader racing them may cache anything but stale results.
+  for(int t = 0; t < writer_cnt; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = 0; i < rounds; ++i) {
+        int key = i % key_cnt;
+        bpt.insert(key, t * rounds + i);
+        if(i / key_cnt % 2 == 0)
+          bpt.remove(key, t * rounds + i);
+      }
+    });
+  std::thread reader([&bpt, &is_done] {
+    while(!is_done)
+      for(int key = 0; key < key_cnt; ++key)
+        bpt.search(key);
+  });
+  for(auto &thread : threads)
+    thread.join();
+  is_done = true;
+  reader.join();
+  for(int key = 0; key < key_cnt; ++key) {
+    auto values = bpt.search(key);
+    ASSERT_EQ(values.size(), writer_cnt * rounds / key_cnt / 2);
+    for(int value : values)
+      ASSERT_EQ(value % key_cnt, key);
+  }
+}
+
+TEST_F(MultiBptFixture, LogRecoveryTest) {
+  const int range = 20000;
+  // the child dies without a clean shutdown: no checkpoint, no destructor, only the log.
+  pid_t pid = fork();
+  if(pid == 0) {
+    auto *bpt = new MultiBPlusTree<int, int>(base_fname, k_dist, 64, thread_cnt, LogMode::sync);
+    for(int i = 0; i < range; ++i)
+      bpt->insert(i % 1000, i);
+    for(int i = 0; i < range; ++i)
+      if(i / 1000 % 2 == 0)
+        bpt->remove(i % 1000, i);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  ASSERT_TRUE(bpt.stats().error.empty());
+  for(int key = 0; key < 1000; ++key) {
+    auto values = bpt.search(key);
+    ASSERT_EQ(values.size(), range / 1000 / 2);
+    for(int value : values) {
+      ASSERT_EQ(value % 1000, key);
+      ASSERT_EQ(value / 1000 % 2, 1);
+    }
+  }
+}
+
+TEST_F(MultiBptFixture, LogAtomicBatchTest) {
+  const int range = 5000, batch = 200000;
+  pid_t pid = fork();
+  if(pid == 0) {
+    auto *bpt = new MultiBPlusTree<int, int>(base_fname, k_dist, 64, thread_cnt, LogMode::sync);
+    for(int i = 0; i < range; ++i)
+      bpt->insert(i, i);
+    std::vector<std::pair<int, int>> pairs;
+    for(int i = range; i < range + batch; ++i)
+      pairs.emplace_back(i, i);
+    std::atomic<bool> is_started{false};
+    // the batch steals frames from its one open group; the crash most likely lands before it commits.
+    std::thread killer([&is_started] {
+      while(!is_started)
+        std::this_thread::yield();
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      _exit(0);
+    });
+    is_started = true;
+    bpt->insert_batch(pairs.begin(), pairs.end());
+    killer.join();
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_TRUE(stats.entries == range || stats.entries == range + batch) << stats.entries;
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.search(i).size(), 1);
+}
+
+TEST_F(MultiBptFixture, LogConcurrentTest) {
+  const int writer_cnt = 4, range = 4000;
+  {
+    MultiBPlusTree<int, int> bpt(base_fname, k_dist, 512, thread_cnt, LogMode::async);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < writer_cnt; ++t)
+      threads.emplace_back([&bpt, t] {
+        for(int i = t; i < range; i += writer_cnt)
+          bpt.insert(i, i);
+      });
+    for(auto &thread : threads)
+      thread.join();
+  }
+  // reopened after a clean shutdown, which checkpoints and leaves nothing to replay.
+  ASSERT_EQ(fs::file_size(base_fname.string() + ".wal"), 0);
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt, LogMode::async);
+  ASSERT_EQ(bpt.stats().entries, range);
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.search(i).size(), 1);
+}
+
+TEST_F(MultiBptFixture, ConcurrentMissTest) {
+  const int writer_cnt = 4, reader_cnt = 4, range = 100000;
+  // far more pages than frames: nearly every descent misses, and misses overlap, on two pool shards.
+  MultiBpt bpt(base_fname, k_dist, 512, thread_cnt);
+  std::atomic<int> written{0};
+  std::vector<std::thread> threads;
+  for(int t = 0; t < writer_cnt; ++t)
+    threads.emplace_back([&bpt, &written, t] {
+      for(int i = t; i < range; i += writer_cnt) {
+        bpt.insert(std::to_string(i), i);
+        ++written;
+      }
+    });
+  for(int t = 0; t < reader_cnt; ++t)
+    threads.emplace_back([&bpt, &written, t] {
+      for(int i = t; written < range; i = (i + 7919) % range)
+        for(int value : bpt.search(std::to_string(i)))
+          ASSERT_EQ(value, i);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty());
+  ASSERT_GT(stats.level_pages[stats.height - 1], 512);
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.search(std::to_string(i)).size(), 1);
+}
+
+TEST_F(MultiBptFixture, LoggedMissTest) {
+  const int writer_cnt = 4, range = 60000;
+  {
+    // dirty victims on every other miss: the background writer cleans ahead, behind the log.
+    MultiBpt bpt(base_fname, k_dist, 256, thread_cnt, LogMode::async);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < writer_cnt; ++t)
+      threads.emplace_back([&bpt, t] {
+        for(int i = t; i < range; i += writer_cnt)
+          bpt.insert(std::to_string(i), i);
+      });
+    for(auto &thread : threads)
+      thread.join();
+    ASSERT_GT(bpt.stats().level_pages[bpt.stats().height - 1], 256);
+  }
+  MultiBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt, LogMode::async);
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_EQ(stats.entries, range);
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.search(std::to_string(i)).size(), 1);
+}
+
+TEST_F(MultiBptFixture, ReadAheadTest) {
+  const int range = 60000, run = 20000;
+  // the tree outgrows the pool, so scans and long runs of one key hop onto leaves read ahead.
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, 256, thread_cnt);
+  for(int i = 0; i < range; ++i)
+    bpt.insert(i, i);
+  for(int i = 0; i < run; ++i)
+    bpt.insert(range / 2, -i);
+  std::vector<std::thread> threads;
+  threads.emplace_back([&bpt, range] {
+    int expected = 0;
+    for(auto cursor = bpt.range(0, range); cursor.valid(); cursor.next())
+      if(cursor.key() != range / 2)
+        ASSERT_EQ(cursor.key(), expected++);
+      else if(expected == range / 2)
+        ++expected;
+    ASSERT_EQ(expected, range);
+  });
+  threads.emplace_back([&bpt, range, run] {
+    for(int round = 0; round < 3; ++round)
+      ASSERT_EQ(bpt.count(range / 2), run + 1);
+  });
+  threads.emplace_back([&bpt, range] {
+    for(int i = range; i < range + 5000; ++i)
+      bpt.insert(i, i);
+  });
+  for(auto &thread : threads)
+    thread.join();
+  auto values = bpt.search(range / 2);
+  ASSERT_EQ(values.size(), run + 1);
+  ASSERT_TRUE(std::is_sorted(values.begin(), values.end()));
+  auto stats = bpt.stats();
+  ASSERT_TRUE(stats.error.empty()) << stats.error;
+  ASSERT_GT(stats.level_pages[stats.height - 1], 256);
+}
+
+TEST_F(MultiBptFixture, MovedCursorTest) {
+  MultiBPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < 100; ++i)
+    bpt.insert(i % 10, i);
+  auto cursor = bpt.lower_bound(5);
+  auto moved = std::move(cursor);
+  ASSERT_FALSE(cursor.valid());
+  ASSERT_TRUE(moved.valid());
+  ASSERT_EQ(moved.key(), 5);
+  cursor = std::move(moved);
+  ASSERT_FALSE(moved.valid());
+  ASSERT_EQ(cursor.value(), 5);
+  auto view = bpt.search_view(3);
+  auto moved_view = std::move(view);
+  ASSERT_FALSE(view.valid());
+  ASSERT_EQ(view.size(), 0);
+  ASSERT_TRUE(moved_view.valid());
+  ASSERT_EQ(moved_view[0], 3);
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <unordered_map>
+
+#include "exception.h"
+#include "page_table.h"
+
+using insomnia::PageTable;
+
+TEST(PageTableTest, BasicTest) {
+  PageTable table(4);
+  ASSERT_EQ(table.find(1), PageTable::npos);
+  table.insert(1, 10);
+  table.insert(17, 11);
+  table.insert(33, 12);
+  ASSERT_EQ(table.size(), 3);
+  ASSERT_EQ(table.find(1), 10);
+  ASSERT_EQ(table.find(17), 11);
+  ASSERT_EQ(table.find(33), 12);
+  ASSERT_FALSE(table.contains(49));
+  ASSERT_TRUE(table.erase(17));
+  ASSERT_FALSE(table.erase(17));
+  ASSERT_EQ(table.find(17), PageTable::npos);
+  ASSERT_EQ(table.find(33), 12);
+  table.insert(49, 13);
+  table.insert(65, 14);
+  ASSERT_THROW(table.insert(81, 15), insomnia::pool_overflow);
+  // nullpos marks the empty slots, and is never found.
+  ASSERT_EQ(table.find(0), PageTable::npos);
+}
+
+TEST(PageTableTest, ChurnTest) {
+  // a full table under the evictions of a buffer pool: erase one page, map another, with strided page ids.
+  const size_t capacity = 512, stride = 4;
+  PageTable table(capacity);
+  std::unordered_map<size_t, size_t> expected;
+  std::mt19937 rng(2025);
+  std::uniform_int_distribution<size_t> page_dist(1, 20000);
+  while(expected.size() < capacity) {
+    size_t page_id = page_dist(rng) * stride;
+    if(expected.emplace(page_id, expected.size()).second)
+      table.insert(page_id, expected[page_id]);
+  }
+  for(int round = 0; round < 100000; ++round) {
+    auto victim = expected.begin();
+    std::advance(victim, rng() % 16);
+    ASSERT_TRUE(table.erase(victim->first));
+    size_t frame_id = victim->second;
+    expected.erase(victim);
+    size_t page_id;
+    do {
+      page_id = page_dist(rng) * stride;
+    } while(expected.count(page_id));
+    table.insert(page_id, frame_id);
+    expected.emplace(page_id, frame_id);
+  }
+  ASSERT_EQ(table.size(), capacity);
+  for(const auto &[page_id, frame_id] : expected)
+    ASSERT_EQ(table.find(page_id), frame_id);
+  for(size_t page_id = 1; page_id <= 20000 * stride; page_id += 7)
+    if(!expected.count(page_id))
+      ASSERT_FALSE(table.contains(page_id));
+}
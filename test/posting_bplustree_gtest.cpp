@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+
+#include "array.h"
+#include "posting_bplustree.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+class PostingBptFixture : public ::testing::Test {
+protected:
+  using str_t = array<char, 64>;
+  using PostingBpt = PostingMultiBPlusTree<str_t, int>;
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "posting_bpt_test"};
+  const size_t buffer_capa{1024}, k_dist{3}, thread_cnt{6};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+};
+
+TEST_F(PostingBptFixture, ExampleTest) {
+  PostingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  ASSERT_TRUE(bpt.insert("FlowersForAlgernon", 1966));
+  ASSERT_TRUE(bpt.insert("CppPrimer", 2012));
+  ASSERT_TRUE(bpt.insert("Dune", 2021));
+  ASSERT_TRUE(bpt.insert("CppPrimer", 2001));
+  ASSERT_FALSE(bpt.insert("CppPrimer", 2012));
+  auto list1 = bpt.search("CppPrimer");
+  ASSERT_EQ(list1.size(), 2);
+  ASSERT_EQ(list1[0], 2001);
+  ASSERT_EQ(list1[1], 2012);
+  ASSERT_EQ(bpt.search("Java").size(), 0);
+  ASSERT_FALSE(bpt.remove("Dune", 1965));
+  ASSERT_TRUE(bpt.remove("Dune", 2021));
+  ASSERT_FALSE(bpt.remove("Dune", 2021));
+  ASSERT_EQ(bpt.count("Dune"), 0);
+  ASSERT_TRUE(bpt.insert("Dune", 1965));
+  ASSERT_EQ(bpt.search("Dune")[0], 1965);
+}
+
+TEST_F(PostingBptFixture, LongRunTest) {
+  const int range = 100000;
+  {
+    PostingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 1; i <= range; ++i)
+      ASSERT_TRUE(bpt.insert("0", i));
+    // out of order, into the middle of the run.
+    for(int i = 1; i <= range; i += 3)
+      ASSERT_TRUE(bpt.insert("0", -i));
+    ASSERT_FALSE(bpt.insert("0", range / 2));
+  }
+  // about 4 bytes per value (files grow by doubling), where MultiBPlusTree leaves take over 72.
+  ASSERT_LT(fs::file_size(fs::path(base_fname).concat(".posting.dat")), range * 16);
+  PostingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  const int total = range + (range + 2) / 3;
+  ASSERT_EQ(bpt.count("0"), total);
+  auto list = bpt.search("0");
+  ASSERT_EQ(list.size(), total);
+  for(int i = 1; i < list.size(); ++i)
+    ASSERT_LT(list[i - 1], list[i]);
+  int visited = 0;
+  ASSERT_EQ(bpt.search("0", [&visited] (int value) { return ++visited < 10; }), 10);
+  ASSERT_EQ(bpt.search("0", [] (int) {}, 3000), 3000);
+
+  std::vector<int> values(list.data(), list.data() + list.size());
+  std::mt19937 rng(1);
+  std::shuffle(values.begin(), values.end(), rng);
+  for(int i = 0; i < values.size(); ++i) {
+    ASSERT_TRUE(bpt.remove("0", values[i]));
+    if(i % 10007 == 0)
+      ASSERT_EQ(bpt.count("0"), values.size() - i - 1);
+  }
+  ASSERT_EQ(bpt.search("0").size(), 0);
+  ASSERT_TRUE(bpt.insert("0", 7));
+  ASSERT_EQ(bpt.count("0"), 1);
+}
+
+TEST_F(PostingBptFixture, ManyKeysTest) {
+  const int keys = 2000, per_key = 40;
+  PostingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int v = 0; v < per_key; ++v)
+    for(int k = 0; k < keys; ++k)
+      ASSERT_TRUE(bpt.insert(std::to_string(k), v * keys + k));
+  for(int k = 0; k < keys; k += 2)
+    for(int v = 0; v < per_key; v += 2)
+      ASSERT_TRUE(bpt.remove(std::to_string(k), v * keys + k));
+  for(int k = 0; k < keys; ++k) {
+    auto list = bpt.search(std::to_string(k));
+    ASSERT_EQ(list.size(), k % 2 == 0 ? per_key / 2 : per_key);
+    for(int i = 0; i < list.size(); ++i)
+      ASSERT_EQ(list[i], (k % 2 == 0 ? 2 * i + 1 : i) * keys + k);
+  }
+}
+
+TEST_F(PostingBptFixture, ConcurrentTest) {
+  const int range = 20000, workers = 4;
+  PostingBpt bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = t; i < range; i += workers) {
+        bpt.insert("hot", i);
+        bpt.insert(std::to_string(i % 100), i);
+      }
+      for(int i = t; i < range; i += 2 * workers)
+        bpt.remove("hot", i);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  auto list = bpt.search("hot");
+  ASSERT_EQ(list.size(), range / 2);
+  for(int i = 0; i < list.size(); ++i)
+    ASSERT_EQ(list[i] % (2 * workers) >= workers, true);
+  for(int k = 0; k < 100; ++k)
+    ASSERT_EQ(bpt.count(std::to_string(k)), range / 100);
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+
+#include "array.h"
+#include "bplustree.h"
+#include "record_store.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+class RecordStoreFixture : public ::testing::Test {
+protected:
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "record_store_test"};
+  const size_t buffer_capa{256}, k_dist{3}, thread_cnt{4};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+
+  // a record of size bytes, telling seed apart.
+  static vector<char> MakeRecord(int seed, size_t size) {
+    vector<char> record;
+    for(size_t i = 0; i < size; ++i)
+      record.push_back(static_cast<char>(seed * 131 + i * 7));
+    return record;
+  }
+
+  static bool IsSame(vector<char> &lhs, vector<char> rhs) {
+    return lhs.size() == rhs.size() && memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+  }
+};
+
+TEST_F(RecordStoreFixture, ExampleTest) {
+  struct Train {
+    array<char, 20> id;
+    int seats;
+    int prices[100];
+  };
+  RecordStore store(base_fname, k_dist, buffer_capa, thread_cnt);
+  Train train{"G1234", 1000, {}};
+  train.prices[99] = 42;
+  RID rid = store.insert(train);
+  Train fetched;
+  ASSERT_TRUE(store.read(rid, fetched));
+  ASSERT_EQ(fetched.id, train.id);
+  ASSERT_EQ(fetched.prices[99], 42);
+  int wrong_size;
+  ASSERT_FALSE(store.read(rid, wrong_size));
+  train.seats = 999;
+  ASSERT_TRUE(store.update(rid, train));
+  ASSERT_TRUE(store.read(rid, fetched));
+  ASSERT_EQ(fetched.seats, 999);
+  ASSERT_TRUE(store.remove(rid));
+  ASSERT_FALSE(store.remove(rid));
+  ASSERT_FALSE(store.read(rid, fetched));
+  ASSERT_FALSE(store.read(RID(), fetched));
+  ASSERT_THROW(store.insert(nullptr, RecordStore::MAX_RECORD_SIZE + 1), database_exception);
+}
+
+TEST_F(RecordStoreFixture, VariableSizeTest) {
+  const int count = 3000;
+  std::mt19937 rng(5);
+  std::vector<RID> rids;
+  std::vector<size_t> sizes;
+  {
+    RecordStore store(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < count; ++i) {
+      // mostly small, some of several pages.
+      size_t size = i % 50 == 0 ? 4000 + rng() % 12000 : rng() % 300;
+      sizes.push_back(size);
+      rids.push_back(store.insert(MakeRecord(i, size).data(), size));
+    }
+    vector<char> data;
+    for(int i = 0; i < count; ++i) {
+      ASSERT_TRUE(store.read(rids[i], data));
+      ASSERT_TRUE(IsSame(data, MakeRecord(i, sizes[i])));
+    }
+    // grow, shrink and overflow records in place; RIDs stay.
+    for(int i = 0; i < count; i += 3) {
+      sizes[i] = i % 2 == 0 ? sizes[i] * 3 + 1000 : sizes[i] / 2;
+      ASSERT_TRUE(store.update(rids[i], MakeRecord(-i, sizes[i]).data(), sizes[i]));
+    }
+    for(int i = 1; i < count; i += 3)
+      ASSERT_TRUE(store.remove(rids[i]));
+  }
+  RecordStore store(base_fname, k_dist, buffer_capa, thread_cnt);
+  vector<char> data;
+  for(int i = 0; i < count; ++i) {
+    if(i % 3 == 1) {
+      ASSERT_FALSE(store.read(rids[i], data));
+      continue;
+    }
+    ASSERT_TRUE(store.read(rids[i], data));
+    ASSERT_TRUE(IsSame(data, MakeRecord(i % 3 == 0 ? -i : i, sizes[i])));
+  }
+  // freed room is reused before the file grows.
+  size_t file_size = fs::file_size(fs::path(base_fname).concat(".dat"));
+  for(int i = 0; i < count / 3; ++i)
+    store.insert(MakeRecord(i, 100).data(), 100);
+  ASSERT_EQ(fs::file_size(fs::path(base_fname).concat(".dat")), file_size);
+}
+
+TEST_F(RecordStoreFixture, IndexedTest) {
+  using str_t = array<char, 64>;
+  const int count = 2000;
+  RecordStore store(base_fname, k_dist, buffer_capa, thread_cnt);
+  MultiBPlusTree<str_t, RID> index(fs::path(base_fname).concat(".index"), k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < count; ++i) {
+    std::string record = "user" + std::to_string(i) + std::string(i % 500, '#');
+    RID rid = store.insert(record.data(), record.size());
+    ASSERT_TRUE(index.insert("user" + std::to_string(i % 100), rid));
+  }
+  vector<char> data;
+  for(int k = 0; k < 100; ++k) {
+    auto rids = index.search("user" + std::to_string(k));
+    ASSERT_EQ(rids.size(), count / 100);
+    for(auto &rid : rids) {
+      ASSERT_TRUE(store.read(rid, data));
+      std::string record(data.data(), data.size());
+      ASSERT_EQ(std::stoi(record.substr(4)) % 100, k);
+    }
+  }
+}
+
+TEST_F(RecordStoreFixture, ConcurrentTest) {
+  const int count = 4000, workers = 4;
+  RecordStore store(base_fname, k_dist, buffer_capa, thread_cnt);
+  std::vector<RID> rids(count);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&store, &rids, t] {
+      for(int i = t; i < count; i += workers)
+        rids[i] = store.insert(MakeRecord(i, i % 700).data(), i % 700);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  threads.clear();
+  // no inserts from here on, so the freed slots stay empty.
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&store, &rids, t] {
+      vector<char> data;
+      for(int i = t; i < count; i += 2 * workers) {
+        ASSERT_TRUE(store.remove(rids[i]));
+        ASSERT_TRUE(store.read(rids[i + workers], data));
+      }
+    });
+  for(auto &thread : threads)
+    thread.join();
+  vector<char> data;
+  for(int i = 0; i < count; ++i) {
+    if(i % (2 * workers) < workers) {
+      ASSERT_FALSE(store.read(rids[i], data));
+      continue;
+    }
+    ASSERT_TRUE(store.read(rids[i], data));
+    ASSERT_TRUE(IsSame(data, MakeRecord(i, i % 700)));
+  }
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <thread>
+
+#include "array.h"
+#include "sharded_bplustree.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+class ShardedBptFixture : public ::testing::Test {
+protected:
+  using str_t = array<char, 64>;
+  using ShardedBpt = ShardedMultiBPlusTree<str_t, int>;
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "sharded_bpt_test"};
+  const size_t shard_cnt{4}, buffer_capa{1024}, k_dist{3}, thread_cnt{6};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+};
+
+TEST_F(ShardedBptFixture, ExampleTest) {
+  ShardedBpt bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  bpt.insert("FlowersForAlgernon", 1966);
+  bpt.insert("CppPrimer", 2012);
+  bpt.insert("Dune", 2021);
+  bpt.insert("CppPrimer", 2001);
+  auto list1 = bpt.search("CppPrimer");
+  ASSERT_EQ(list1.size(), 2);
+  ASSERT_EQ(list1[0], 2001);
+  ASSERT_EQ(list1[1], 2012);
+  ASSERT_EQ(bpt.search("Java").size(), 0);
+  ASSERT_FALSE(bpt.remove("Java", 1));
+  ASSERT_TRUE(bpt.remove("Dune", 2021));
+  ASSERT_EQ(bpt.search("Dune").size(), 0);
+}
+
+TEST_F(ShardedBptFixture, PersistenceTest) {
+  const int range = 20000;
+  {
+    ShardedMultiBPlusTree<int, int> bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+    for(int i = 0; i < range; ++i)
+      bpt.insert(i % 1000, i);
+  }
+  ShardedMultiBPlusTree<int, int> bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  size_t entries = 0;
+  for(size_t shard = 0; shard < bpt.shard_count(); ++shard) {
+    auto stats = bpt.stats(shard);
+    ASSERT_TRUE(stats.error.empty()) << stats.error;
+    // the keys spread over every shard.
+    ASSERT_GT(stats.entries, range / shard_cnt / 2);
+    entries += stats.entries;
+  }
+  ASSERT_EQ(entries, range);
+  for(int key = 0; key < 1000; ++key)
+    ASSERT_EQ(bpt.count(key), range / 1000);
+}
+
+TEST_F(ShardedBptFixture, MergedRangeTest) {
+  ShardedMultiBPlusTree<int, int> bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < 3000; ++i)
+    bpt.insert(i / 3, i);
+  int expected = 300;
+  for(auto cursor = bpt.range(100, 700); cursor.valid(); cursor.next()) {
+    ASSERT_EQ(cursor.key(), expected / 3);
+    ASSERT_EQ(cursor.value(), expected);
+    ++expected;
+  }
+  ASSERT_EQ(expected, 2100);
+  auto cursor = bpt.lower_bound(999);
+  ASSERT_TRUE(cursor.valid());
+  ASSERT_EQ(cursor.value(), 2997);
+  auto moved = std::move(cursor);
+  ASSERT_FALSE(cursor.valid());
+  ASSERT_TRUE(moved.valid());
+  ASSERT_EQ(moved.value(), 2997);
+  moved.reset();
+  ASSERT_FALSE(moved.valid());
+  ASSERT_FALSE(bpt.lower_bound(1000).valid());
+}
+
+TEST_F(ShardedBptFixture, PrefixRangeTest) {
+  ShardedBpt bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < 1000; ++i)
+    bpt.insert(("key" + std::to_string(i)).c_str(), i);
+  std::vector<std::string> keys;
+  for(auto cursor = bpt.prefix_range("key12"); cursor.valid(); cursor.next())
+    keys.push_back(cursor.key().c_str());
+  std::vector<std::string> expected{"key12"};
+  for(int i = 0; i < 10; ++i)
+    expected.push_back("key12" + std::to_string(i));
+  ASSERT_EQ(keys, expected);
+}
+
+TEST_F(ShardedBptFixture, BatchAndBulkLoadTest) {
+  ShardedMultiBPlusTree<int, int> bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  std::vector<std::pair<int, int>> pairs;
+  for(int i = 0; i < 10000; ++i)
+    pairs.emplace_back(i, -i);
+  std::vector<std::pair<int, int>> unsorted{{2, 0}, {1, 0}};
+  ASSERT_THROW(bpt.bulk_load(unsorted.begin(), unsorted.end()), database_exception);
+  ASSERT_EQ(bpt.bulk_load(pairs.begin(), pairs.end()), 10000);
+  ASSERT_THROW(bpt.bulk_load(pairs.begin(), pairs.end()), database_exception);
+  std::vector<std::pair<int, int>> batch;
+  for(int i = 0; i < 10000; i += 2)
+    batch.emplace_back(i, -i);
+  ASSERT_EQ(bpt.remove_batch(batch.begin(), batch.end()), 5000);
+  ASSERT_EQ(bpt.insert_batch(pairs.begin(), pairs.end()), 5000);
+  int expected = 0;
+  for(auto cursor = bpt.lower_bound(0); cursor.valid(); cursor.next())
+    ASSERT_EQ(cursor.key(), expected++);
+  ASSERT_EQ(expected, 10000);
+}
+
+TEST_F(ShardedBptFixture, ConcurrentWriteTest) {
+  const int writer_cnt = 8, range = 40000;
+  ShardedMultiBPlusTree<int, int> bpt(base_fname, shard_cnt, k_dist, buffer_capa, thread_cnt);
+  bpt.enable_cache(1 << 20);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < writer_cnt; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int i = t; i < range; i += writer_cnt) {
+        bpt.insert(i % 5000, i);
+        if(i % 3 == 0)
+          bpt.remove(i % 5000, i);
+      }
+    });
+  for(auto &thread : threads)
+    thread.join();
+  for(int key = 0; key < 5000; ++key) {
+    auto values = bpt.search(key);
+    for(int value : values) {
+      ASSERT_EQ(value % 5000, key);
+      ASSERT_NE(value % 3, 0);
+    }
+    size_t expected = 0;
+    for(int i = key; i < range; i += 5000)
+      expected += i % 3 != 0;
+    ASSERT_EQ(values.size(), expected);
+  }
+}
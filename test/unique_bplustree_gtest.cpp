@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+
+#include "array.h"
+#include "unique_bplustree.h"
+
+
+using namespace insomnia;
+namespace fs = std::filesystem;
+
+class UniqueBptFixture : public ::testing::Test {
+protected:
+  using str_t = array<char, 64>;
+  const fs::path test_dir{"db_data"};
+  const fs::path base_fname{test_dir / "unique_bpt_test"};
+  const size_t buffer_capa{1024}, k_dist{3}, thread_cnt{6};
+
+  void SetUp() override {
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir);
+  }
+};
+
+TEST_F(UniqueBptFixture, ExampleTest) {
+  BPlusTree<str_t, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  int value;
+  ASSERT_TRUE(bpt.insert("FlowersForAlgernon", 1966));
+  ASSERT_TRUE(bpt.insert("CppPrimer", 2012));
+  ASSERT_FALSE(bpt.insert("CppPrimer", 2001));
+  ASSERT_TRUE(bpt.find("CppPrimer", value));
+  ASSERT_EQ(value, 2012);
+  ASSERT_FALSE(bpt.insert_or_assign("CppPrimer", 2001));
+  ASSERT_TRUE(bpt.find("CppPrimer", value));
+  ASSERT_EQ(value, 2001);
+  ASSERT_TRUE(bpt.insert_or_assign("Dune", 1965));
+  ASSERT_TRUE(bpt.contains("Dune"));
+  ASSERT_FALSE(bpt.update("Java", 1995));
+  ASSERT_TRUE(bpt.update("Dune", [] (int &year) { year += 56; }));
+  ASSERT_TRUE(bpt.find("Dune", value));
+  ASSERT_EQ(value, 2021);
+  ASSERT_TRUE(bpt.visit("Dune", [&value] (const int &year) { value = year; }));
+  ASSERT_EQ(value, 2021);
+  ASSERT_FALSE(bpt.visit("Java", [] (const int&) {}));
+  ASSERT_FALSE(bpt.remove_if("Dune", [] (const int &year) { return year < 2000; }));
+  ASSERT_FALSE(bpt.remove("Java"));
+  ASSERT_TRUE(bpt.remove_if("Dune", [] (const int &year) { return year > 2000; }));
+  ASSERT_TRUE(bpt.insert("Dune", 2021));
+  ASSERT_TRUE(bpt.remove("Dune"));
+  ASSERT_FALSE(bpt.contains("Dune"));
+  ASSERT_FALSE(bpt.find("Dune", value));
+}
+
+TEST_F(UniqueBptFixture, MassTest) {
+  const int range = 20000;
+  std::vector<int> keys(range);
+  for(int i = 0; i < range; ++i)
+    keys[i] = i;
+  std::mt19937 rng(1);
+  std::shuffle(keys.begin(), keys.end(), rng);
+  {
+    BPlusTree<int, long> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    for(int key : keys)
+      ASSERT_TRUE(bpt.insert(key, -key));
+    for(int key = 0; key < range; key += 2)
+      ASSERT_TRUE(bpt.update(key, [] (long &value) { value = -value; }));
+  }
+  {
+    BPlusTree<int, long> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+    long value;
+    for(int key = 0; key < range; ++key) {
+      ASSERT_TRUE(bpt.find(key, value));
+      ASSERT_EQ(value, key % 2 == 0 ? key : -key);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for(int i = 0; i < range; ++i) {
+      ASSERT_TRUE(bpt.remove(keys[i]));
+      ASSERT_FALSE(bpt.remove(keys[i]));
+      if(i % 97 == 0)
+        for(int j = i + 1; j < range; j += 101)
+          ASSERT_TRUE(bpt.contains(keys[j]));
+    }
+    ASSERT_FALSE(bpt.contains(keys[0]));
+    ASSERT_TRUE(bpt.insert(keys[0], 0));
+  }
+}
+
+TEST_F(UniqueBptFixture, SharedPrefixTest) {
+  const int range = 8000;
+  auto key_of = [] (int i) {
+    std::string key = std::to_string(i);
+    return str_t(std::string(40, 'p') + std::string(6 - key.length(), '0') + key);
+  };
+  BPlusTree<str_t, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int i = 0; i < range; ++i)
+    ASSERT_TRUE(bpt.insert(key_of((i * 7919) % range), i));
+  for(int i = 0; i < range; ++i)
+    ASSERT_FALSE(bpt.insert_or_assign(key_of((i * 7919) % range), -i));
+  int value;
+  for(int i = 0; i < range; ++i) {
+    ASSERT_TRUE(bpt.find(key_of((i * 7919) % range), value));
+    ASSERT_EQ(value, -i);
+  }
+  for(int i = 0; i < range; i += 2)
+    ASSERT_TRUE(bpt.remove(key_of(i)));
+  for(int i = 0; i < range; ++i)
+    ASSERT_EQ(bpt.contains(key_of(i)), i % 2 == 1);
+}
+
+TEST_F(UniqueBptFixture, ConcurrentTest) {
+  const int range = 4000, workers = 4;
+  BPlusTree<int, int> bpt(base_fname, k_dist, buffer_capa, thread_cnt);
+  for(int key = 0; key < range; ++key)
+    ASSERT_TRUE(bpt.insert(key, 0));
+  std::vector<std::thread> threads;
+  for(int t = 0; t < workers; ++t)
+    threads.emplace_back([&bpt, t] {
+      for(int key = 0; key < range; ++key)
+        bpt.update(key, [] (int &value) { ++value; });
+      for(int key = range + t; key < range * 2; key += workers)
+        bpt.insert(key, t);
+    });
+  for(auto &thread : threads)
+    thread.join();
+  int value;
+  for(int key = 0; key < range; ++key) {
+    ASSERT_TRUE(bpt.find(key, value));
+    ASSERT_EQ(value, workers);
+  }
+  for(int key = range; key < range * 2; ++key) {
+    ASSERT_TRUE(bpt.find(key, value));
+    ASSERT_EQ(value, (key - range) % workers);
+  }
+}